@@ -0,0 +1,150 @@
+﻿//块压缩(BC1/BC3/BC7)的编码速度和质量，解码编码结果后与原图比较PSNR
+//同时检查: 多线程与单线程的编码结果逐位相同；纯色块在端点量化的精度内无损；压缩后的大小符合每种格式的bpp
+//用法: block_compress_bench [image.png]，不指定图像时使用合成的 1024 x 1024 图像(渐变、硬边缘和带alpha的区域)
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#include "../mipmap.h"
+#include "../block_compress.h"
+
+static std::vector<uint8_t> makeImage(uint32_t width, uint32_t height) {
+	std::mt19937 rng(3);
+	std::vector<uint8_t> image(size_t(width) * height * 4);
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			uint8_t* p = &image[(size_t(y) * width + x) * 4];
+			float fx = x / float(width), fy = y / float(height);
+			p[0] = static_cast<uint8_t>(127.5f + 127.5f * std::sin(fx * 17.f + fy * 3.f));
+			p[1] = static_cast<uint8_t>(255.f * fy);
+			p[2] = ((x / 64 + y / 64) & 1) ? 200 : 40;	//棋盘格的硬边缘
+			p[3] = x < width / 2 ? 255 : static_cast<uint8_t>(255.f * fx * fy);
+			for (int c = 0; c < 3; ++c) {
+				p[c] = static_cast<uint8_t>(std::min(255, p[c] + static_cast<int>(rng() % 6)));
+			}
+		}
+	}
+	return image;
+}
+
+static double psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int channels) {
+	double sum = 0;
+	size_t count = 0;
+	for (size_t i = 0; i < a.size(); i += 4) {
+		for (int c = 0; c < channels; ++c) {
+			double d = double(a[i + c]) - double(b[i + c]);
+			sum += d * d;
+			++count;
+		}
+	}
+	double mse = sum / count;
+	return mse == 0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+static const char* formatName(bcn::Format format) {
+	switch (format) {
+	case bcn::Format::BC1: return "BC1";
+	case bcn::Format::BC3: return "BC3";
+	default: return "BC7";
+	}
+}
+
+//纯色块: BC7在7位端点 + p位的精度内误差不超过1，BC1/BC3的颜色不超过565量化的误差
+static bool checkSolidBlocks() {
+	std::mt19937 rng(11);
+	for (int n = 0; n < 2000; ++n) {
+		uint8_t color[4] = { static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()) };
+		uint8_t block[64], decoded[64], encoded[16];
+		for (int i = 0; i < 16; ++i) {
+			memcpy(block + 4 * i, color, 4);
+		}
+		for (bcn::Format format : { bcn::Format::BC1, bcn::Format::BC3, bcn::Format::BC7 }) {
+			bcn::encodeBlock(format, block, encoded);
+			if (!bcn::decodeBlock(format, encoded, decoded)) {
+				return false;
+			}
+			for (int i = 0; i < 16; ++i) {
+				for (int c = 0; c < 4; ++c) {
+					int tolerance = format == bcn::Format::BC7 ? 1 : (c == 1 ? 2 : 4);
+					if (c == 3) {
+						tolerance = format == bcn::Format::BC1 ? 255 : (format == bcn::Format::BC3 ? 0 : 1);
+					}
+					if (std::abs(int(decoded[4 * i + c]) - int(color[c])) > tolerance) {
+						printf("%s: solid color (%d %d %d %d) channel %d decoded to %d\n", formatName(format),
+							color[0], color[1], color[2], color[3], c, decoded[4 * i + c]);
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint32_t width = 1024, height = 1024;
+	std::vector<uint8_t> image;
+	if (argc > 1) {
+		int w, h, channels;
+		stbi_uc* pixels = stbi_load(argv[1], &w, &h, &channels, STBI_rgb_alpha);
+		if (!pixels) {
+			printf("failed to load %s\n", argv[1]);
+			return 1;
+		}
+		width = w;
+		height = h;
+		image.assign(pixels, pixels + size_t(w) * h * 4);
+		stbi_image_free(pixels);
+	} else {
+		image = makeImage(width, height);
+	}
+
+	JobSystem jobs;
+	jobs.start();
+	bool ok = checkSolidBlocks();
+	uint32_t levels = mipgen::levelCount(width, height);
+	std::vector<uint8_t> chain = mipgen::generateMipChain(image.data(), width, height, true, &jobs);
+	printf("%ux%u, %u levels, %zu bytes uncompressed\n", width, height, levels, chain.size());
+
+	for (bcn::Format format : { bcn::Format::BC1, bcn::Format::BC3, bcn::Format::BC7 }) {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<uint8_t> single = bcn::compressMipChain(chain.data(), width, height, levels, format, nullptr);
+		auto middle = std::chrono::high_resolution_clock::now();
+		std::vector<uint8_t> threaded = bcn::compressMipChain(chain.data(), width, height, levels, format, &jobs);
+		auto end = std::chrono::high_resolution_clock::now();
+		if (single != threaded) {
+			printf("%s: threaded result differs from single thread\n", formatName(format));
+			ok = false;
+		}
+
+		std::vector<uint8_t> decoded(size_t(width) * height * 4);
+		if (!bcn::decompressImage(single.data(), width, height, format, decoded.data())) {
+			printf("%s: failed to decode\n", formatName(format));
+			ok = false;
+			continue;
+		}
+		//BC1没有alpha，只比较RGB
+		double rgb = psnr(image, decoded, 3);
+		double rgba = format == bcn::Format::BC1 ? rgb : psnr(image, decoded, 4);
+		double ms1 = std::chrono::duration<double, std::milli>(middle - start).count();
+		double msN = std::chrono::duration<double, std::milli>(end - middle).count();
+		printf("%s: %8zu bytes (%.1fx), level 0 PSNR rgb %.2f dB rgba %.2f dB, encode %.1f ms (1 thread) %.1f ms (threads), %.1f Mpix/s\n",
+			formatName(format), single.size(), double(chain.size()) / single.size(), rgb, rgba, ms1, msN, chain.size() / 4 / 1e3 / ms1);
+		//合成图像上各格式的最低质量，编码器退化时检查失败
+		double minimum = format == bcn::Format::BC7 ? 38.0 : 30.0;
+		if (argc <= 1 && rgba < minimum) {
+			printf("%s: PSNR below %.0f dB\n", formatName(format), minimum);
+			ok = false;
+		}
+	}
+	printf("correctness: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
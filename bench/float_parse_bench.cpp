@@ -0,0 +1,206 @@
+﻿//对比obj中 "v x y z" 行在标量和AVX2实现下的解析速度(MB/s)
+//parse-only只计parseVertex3(不支持的行退回tinyobj::parseReal)，parseChunk一项包括找行、识别关键字和写入数组
+//同时用随机生成的行检查向量化结果与tinyobj::parseReal逐位一致，并统计向量化路径直接处理(不退回标量)的比例
+//用法: float_parse_bench [随机测试的行数]，默认 1000000 行
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+//用double比较，double逐位相同则转换为float后也相同
+#define TINYOBJLOADER_USE_DOUBLE
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tiny_obj_loader.h"
+#include "../obj_parallel.h"
+
+using parallelobj::simd::Level;
+
+//随机生成一个数字，覆盖向量化解析支持和不支持(需要退回标量)的格式
+static void appendNumber(std::string& line, std::mt19937& rng) {
+	std::uniform_int_distribution<int> pick(0, 99);
+	int kind = pick(rng);
+	char buffer[64];
+	if (kind < 50) {
+		std::uniform_real_distribution<double> value(-100.0, 100.0);
+		snprintf(buffer, sizeof(buffer), "%.*f", pick(rng) % 10, value(rng));
+	} else if (kind < 65) {
+		snprintf(buffer, sizeof(buffer), "%d", static_cast<int>(rng() % 2000000) - 1000000);
+	} else if (kind < 75) {
+		//很长的小数部分，超过pow_lut的范围
+		std::string digits = std::to_string(rng() % 1000) + ".";
+		int count = 8 + pick(rng) % 14;
+		for (int i = 0; i < count; ++i) digits += static_cast<char>('0' + rng() % 10);
+		snprintf(buffer, sizeof(buffer), "%s", digits.c_str());
+	} else if (kind < 80) {
+		snprintf(buffer, sizeof(buffer), "+%u.%u", static_cast<unsigned>(rng() % 100), static_cast<unsigned>(rng() % 1000));
+	} else if (kind < 85) {
+		snprintf(buffer, sizeof(buffer), "%e", std::uniform_real_distribution<double>(-1e5, 1e5)(rng));
+	} else if (kind < 88) {
+		snprintf(buffer, sizeof(buffer), "%u.", static_cast<unsigned>(rng() % 100));
+	} else if (kind < 91) {
+		snprintf(buffer, sizeof(buffer), ".%u", static_cast<unsigned>(rng() % 100));
+	} else if (kind < 94) {
+		snprintf(buffer, sizeof(buffer), "-%u.%u.%u", static_cast<unsigned>(rng() % 10), static_cast<unsigned>(rng() % 10), static_cast<unsigned>(rng() % 10));
+	} else if (kind < 97) {
+		snprintf(buffer, sizeof(buffer), "%u-%u", static_cast<unsigned>(rng() % 10), static_cast<unsigned>(rng() % 10));
+	} else {
+		snprintf(buffer, sizeof(buffer), "%s", pick(rng) % 2 ? "-" : "nan");
+	}
+	line += buffer;
+}
+
+static std::string randomLine(std::mt19937& rng) {
+	static const char* separators[] = { " ", "  ", "\t", " \t" };
+	std::string line = "v";
+	int count = 2 + static_cast<int>(rng() % 3);
+	for (int i = 0; i < count; ++i) {
+		line += separators[rng() % 4];
+		appendNumber(line, rng);
+	}
+	if (rng() % 10 == 0) line += " ";
+	return line;
+}
+
+static bool sameBits(tinyobj::real_t a, tinyobj::real_t b) {
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+//逐行检查所有可用的指令集，返回不一致的行数
+static size_t fuzz(size_t lineCount, Level detected) {
+	std::mt19937 rng(12345);
+	size_t mismatches = 0;
+	size_t accepted[2] = {};
+	for (size_t n = 0; n < lineCount; ++n) {
+		std::string line = randomLine(rng);
+		const char* lineEnd = line.data() + line.size();
+
+		//以tinyobj原本的实现为准，而不是parallelobj中复制的版本，避免两边一起改错
+		const char* token = line.c_str() + 2;
+		tinyobj::real_t expected[3];
+		for (tinyobj::real_t& value : expected) {
+			value = tinyobj::parseReal(&token);
+		}
+		for (Level level : { Level::AVX2 }) {
+			if (level > detected) continue;
+			parallelobj::simd::activeLevel() = level;
+			double result[3];
+			//分别测试直接读取和靠近缓冲区末尾时复制的两种情况
+			for (const char* bufferEnd : { lineEnd, lineEnd + 64 }) {
+				std::string padded = line + std::string(64, '#');
+				const char* begin = bufferEnd == lineEnd ? line.data() : padded.data();
+				if (!parallelobj::simd::parseVertex3(begin + 2, begin + line.size(), begin + (bufferEnd - line.data()), result)) {
+					continue;
+				}
+				++accepted[static_cast<int>(level)];
+				for (int i = 0; i < 3; ++i) {
+					if (!sameBits(static_cast<tinyobj::real_t>(result[i]), expected[i])) {
+						if (++mismatches <= 10) {
+							printf("mismatch (%s): \"%s\" component %d: %.17g vs %.17g\n",
+								parallelobj::simd::levelName(level), line.c_str(), i, result[i], expected[i]);
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+	for (Level level : { Level::AVX2 }) {
+		if (level > detected) continue;
+		size_t handled = accepted[static_cast<int>(level)] / 2;
+		printf("%-8s handled %zu of %zu random lines (%.1f%%) without falling back\n",
+			parallelobj::simd::levelName(level), handled, lineCount, lineCount ? 100.0 * handled / lineCount : 0.0);
+	}
+	return mismatches;
+}
+
+int main(int argc, char** argv) {
+	size_t fuzzLines = argc > 1 ? static_cast<size_t>(std::stoull(argv[1])) : 1000000;
+	Level detected = parallelobj::simd::activeLevel();
+	printf("detected instruction set: %s\n", parallelobj::simd::levelName(detected));
+
+	size_t mismatches = fuzz(fuzzLines, detected);
+
+	//典型的导出格式: 6位小数
+	std::string corpus;
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> value(-10.0, 10.0);
+	char line[128];
+	while (corpus.size() < (64u << 20)) {
+		int len = snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", value(rng), value(rng), value(rng));
+		corpus.append(line, len);
+	}
+
+	//预先切分好的行，parse-only的计时不包括找行
+	std::vector<const char*> tokens, lineEnds;
+	for (const char* p = corpus.data(); p < corpus.data() + corpus.size();) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', corpus.data() + corpus.size() - p));
+		tokens.push_back(p + 2);
+		lineEnds.push_back(lineEnd);
+		p = lineEnd + 1;
+	}
+	const char* corpusEnd = corpus.data() + corpus.size();
+
+	std::vector<double> parsedReference;
+	for (Level level : { Level::Scalar, Level::AVX2 }) {
+		if (level > detected) continue;
+		parallelobj::simd::activeLevel() = level;
+		std::vector<double> parsed(tokens.size() * 3);
+		double best = 1e30;
+		for (int run = 0; run < 5; ++run) {
+			auto start = std::chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < tokens.size(); ++i) {
+				double* out = &parsed[i * 3];
+				if (level == Level::Scalar || !parallelobj::simd::parseVertex3(tokens[i], lineEnds[i], corpusEnd, out)) {
+					const char* token = tokens[i];
+					for (int c = 0; c < 3; ++c) {
+						out[c] = tinyobj::parseReal(&token);
+					}
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double>(end - start).count());
+		}
+		bool same = true;
+		if (level == Level::Scalar) {
+			parsedReference = parsed;
+		} else {
+			same = parsed == parsedReference;
+			if (!same) ++mismatches;
+		}
+		printf("parse-only %-8s %8.1f MB/s  %s\n", parallelobj::simd::levelName(level), corpus.size() / best / (1 << 20), same ? "identical" : "MISMATCH");
+	}
+
+	std::vector<tinyobj::real_t> reference;
+	for (Level level : { Level::Scalar, Level::AVX2 }) {
+		if (level > detected) continue;
+		parallelobj::simd::activeLevel() = level;
+		double best = 1e30;
+		parallelobj::Chunk chunk;
+		for (int run = 0; run < 3; ++run) {
+			chunk = parallelobj::Chunk();
+			auto start = std::chrono::high_resolution_clock::now();
+			parallelobj::parseChunk(corpus.data(), corpus.data() + corpus.size(), chunk);
+			auto end = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double>(end - start).count());
+		}
+		bool same = true;
+		if (level == Level::Scalar) {
+			reference = chunk.v;
+		} else {
+			same = reference.size() == chunk.v.size() && memcmp(reference.data(), chunk.v.data(), reference.size() * sizeof(tinyobj::real_t)) == 0;
+			if (!same) ++mismatches;
+		}
+		printf("parseChunk %-8s %8.1f MB/s  %s\n", parallelobj::simd::levelName(level), corpus.size() / best / (1 << 20), same ? "identical" : "MISMATCH");
+	}
+	parallelobj::simd::activeLevel() = detected;
+
+	if (mismatches) {
+		printf("%zu mismatches\n", mismatches);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,110 @@
+﻿//在CPU上模拟post-transform cache，比较网格优化前后的ACMR/ATVR，不需要GPU
+//用法: mesh_optimizer_bench [model.obj]，不指定模型时使用打乱三角形顺序的规则网格
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tiny_obj_loader.h"
+#include "../obj_parallel.h"
+#include "../mesh_optimizer.h"
+
+struct Position {
+	float x, y, z;
+};
+
+//n x n 的规则网格，三角形随机打乱，模拟扫描数据那样没有局部性的索引顺序
+static void generateGrid(size_t n, std::vector<Position>& positions, std::vector<uint32_t>& indices) {
+	for (size_t y = 0; y <= n; ++y) {
+		for (size_t x = 0; x <= n; ++x) {
+			float fx = x / float(n), fy = y / float(n);
+			positions.push_back({ fx, fy, 0.1f * std::sin(fx * 12.f) * std::cos(fy * 9.f) });
+		}
+	}
+	std::vector<std::array<uint32_t, 3>> triangles;
+	for (size_t y = 0; y < n; ++y) {
+		for (size_t x = 0; x < n; ++x) {
+			uint32_t a = static_cast<uint32_t>(y * (n + 1) + x), b = a + 1, c = a + static_cast<uint32_t>(n) + 1, d = c + 1;
+			triangles.push_back({ a, b, d });
+			triangles.push_back({ a, d, c });
+		}
+	}
+	std::shuffle(triangles.begin(), triangles.end(), std::mt19937(7));
+	for (auto& t : triangles) {
+		indices.insert(indices.end(), t.begin(), t.end());
+	}
+}
+
+//与loadModel相同的去重方式，只保留位置
+static bool loadPositions(const char* path, std::vector<Position>& positions, std::vector<uint32_t>& indices) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+	JobSystem jobs;
+	jobs.start();
+	if (!parallelobj::loadObj(&attrib, &shapes, &materials, &err, path, nullptr, true, &jobs)) {
+		std::cerr << err << std::endl;
+		return false;
+	}
+	positions.resize(attrib.vertices.size() / 3);
+	for (size_t i = 0; i < positions.size(); ++i) {
+		positions[i] = { attrib.vertices[i * 3], attrib.vertices[i * 3 + 1], attrib.vertices[i * 3 + 2] };
+	}
+	for (auto&& shape : shapes) {
+		for (auto&& index : shape.mesh.indices) {
+			indices.push_back(static_cast<uint32_t>(index.vertex_index));
+		}
+	}
+	return true;
+}
+
+static void report(const char* stage, const std::vector<uint32_t>& indices, size_t vertexCount) {
+	for (uint32_t cacheSize : { 16u, 32u }) {
+		meshopt::CacheStats stats = meshopt::simulateVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+		printf("%-12s cache %2u: ACMR %.3f  ATVR %.3f\n", stage, cacheSize, stats.acmr, stats.atvr);
+	}
+}
+
+int main(int argc, char** argv) {
+	std::vector<Position> positions;
+	std::vector<uint32_t> indices;
+	if (argc > 1) {
+		if (!loadPositions(argv[1], positions, indices)) {
+			return 1;
+		}
+	} else {
+		generateGrid(512, positions, indices);
+	}
+	printf("%zu triangles, %zu vertices\n", indices.size() / 3, positions.size());
+	report("original", indices, positions.size());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<uint32_t> cacheOptimized(indices.size());
+	std::vector<uint32_t> clusters;
+	meshopt::optimizeVertexCache(cacheOptimized.data(), indices.data(), indices.size(), positions.size(), 16, &clusters);
+	auto cacheEnd = std::chrono::high_resolution_clock::now();
+	report("tipsify", cacheOptimized, positions.size());
+
+	std::vector<uint32_t> overdrawOptimized(indices.size());
+	meshopt::optimizeOverdraw(overdrawOptimized.data(), cacheOptimized.data(), cacheOptimized.size(), &positions[0].x, sizeof(Position), positions.size(), clusters);
+	auto overdrawEnd = std::chrono::high_resolution_clock::now();
+	report("overdraw", overdrawOptimized, positions.size());
+
+	std::vector<Position> fetchOptimized(positions.size());
+	size_t used = meshopt::optimizeVertexFetch(fetchOptimized.data(), overdrawOptimized.data(), overdrawOptimized.size(), positions.data(), positions.size());
+	auto fetchEnd = std::chrono::high_resolution_clock::now();
+	report("fetch", overdrawOptimized, used);
+
+	auto ms = [](auto a, auto b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+	printf("%zu clusters, tipsify %.1f ms, overdraw %.1f ms, vertex fetch %.1f ms\n",
+		clusters.size(), ms(start, cacheEnd), ms(cacheEnd, overdrawEnd), ms(overdrawEnd, fetchEnd));
+	return 0;
+}
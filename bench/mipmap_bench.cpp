@@ -0,0 +1,133 @@
+﻿//CPU生成mipmap链的速度(标量/SSE2，单线程/多线程)，同时检查结果:
+//1. SSE2和多线程的结果与单线程标量实现逐位相同
+//2. 每一层与直接用sRGB公式(不查表)、按面积加权计算的box滤波参考结果相差不超过1，奇数尺寸的层也覆盖全部源纹素
+//用法: mipmap_bench [宽] [高]，默认 2048 x 2048，也测试奇数尺寸的小图像
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../mipmap.h"
+
+static std::vector<uint8_t> makeImage(uint32_t width, uint32_t height, uint32_t seed) {
+	std::mt19937 rng(seed);
+	std::vector<uint8_t> image(size_t(width) * height * 4);
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			uint8_t* p = &image[(size_t(y) * width + x) * 4];
+			//平滑的渐变加上噪声，覆盖0和255附近的值
+			p[0] = static_cast<uint8_t>(std::min<uint32_t>(255u, x * 255 / std::max(1u, width - 1) + rng() % 8));
+			p[1] = static_cast<uint8_t>(std::min<uint32_t>(255u, y * 255 / std::max(1u, height - 1) + rng() % 8));
+			p[2] = static_cast<uint8_t>(rng());
+			p[3] = static_cast<uint8_t>(rng() % 4 ? 255 : rng());
+		}
+	}
+	return image;
+}
+
+static double srgbToLinear(uint8_t v) {
+	double c = v / 255.0;
+	return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+static uint8_t linearToSrgb(double l) {
+	double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+	return static_cast<uint8_t>(std::min(255.0, std::max(0.0, c * 255.0 + 0.5)));
+}
+
+//目标像素x在源图像中覆盖[x * srcSize / dstSize, (x + 1) * srcSize / dstSize)，返回与之相交的源纹素和相交长度占覆盖长度的比例
+//只依赖两层的尺寸，不使用mipgen选取源像素的规则
+static std::vector<std::pair<uint32_t, double>> coverage(uint32_t srcSize, uint32_t dstSize, uint32_t x) {
+	double begin = double(x) * srcSize / dstSize;
+	double end = double(x + 1) * srcSize / dstSize;
+	std::vector<std::pair<uint32_t, double>> texels;
+	for (uint32_t s = static_cast<uint32_t>(std::floor(begin)); s < srcSize && s < end; ++s) {
+		double overlap = std::min(end, s + 1.0) - std::max(begin, double(s));
+		if (overlap > 0) {
+			texels.emplace_back(s, overlap / (end - begin));
+		}
+	}
+	return texels;
+}
+
+//用double和sRGB公式计算的参考结果
+static int maxReferenceError(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, const uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight, bool srgb) {
+	int maxError = 0;
+	for (uint32_t y = 0; y < dstHeight; ++y) {
+		for (uint32_t x = 0; x < dstWidth; ++x) {
+			auto xs = coverage(srcWidth, dstWidth, x);
+			auto ys = coverage(srcHeight, dstHeight, y);
+			for (int c = 0; c < 4; ++c) {
+				double sum = 0;
+				for (auto& sy : ys) {
+					for (auto& sx : xs) {
+						uint8_t v = src[(size_t(sy.first) * srcWidth + sx.first) * 4 + c];
+						sum += sy.second * sx.second * (srgb && c < 3 ? srgbToLinear(v) : v);
+					}
+				}
+				int expected = srgb && c < 3 ? linearToSrgb(sum) : static_cast<int>(std::floor(sum + 0.5));
+				maxError = std::max(maxError, std::abs(expected - int(dst[(size_t(y) * dstWidth + x) * 4 + c])));
+			}
+		}
+	}
+	return maxError;
+}
+
+static bool check(JobSystem& jobs, uint32_t width, uint32_t height, bool srgb) {
+	std::vector<uint8_t> image = makeImage(width, height, width * 31 + height);
+	std::vector<uint8_t> reference = mipgen::generateMipChain(image.data(), width, height, srgb, nullptr, false);
+	std::vector<uint8_t> simd = mipgen::generateMipChain(image.data(), width, height, srgb, nullptr, true);
+	std::vector<uint8_t> threaded = mipgen::generateMipChain(image.data(), width, height, srgb, &jobs, true);
+	if (simd != reference || threaded != reference) {
+		printf("%ux%u %s: SIMD/threaded result differs from scalar\n", width, height, srgb ? "sRGB" : "UNORM");
+		return false;
+	}
+	uint32_t levels = mipgen::levelCount(width, height);
+	std::vector<size_t> offsets = mipgen::levelOffsets(width, height, levels);
+	int maxError = 0;
+	for (uint32_t level = 1; level < levels; ++level) {
+		maxError = std::max(maxError, maxReferenceError(&reference[offsets[level - 1]], mipgen::levelWidth(width, level - 1), mipgen::levelHeight(height, level - 1),
+			&reference[offsets[level]], mipgen::levelWidth(width, level), mipgen::levelHeight(height, level), srgb));
+	}
+	if (maxError > 1) {
+		printf("%ux%u %s: max error %d against the reference filter\n", width, height, srgb ? "sRGB" : "UNORM", maxError);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint32_t width = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 2048;
+	uint32_t height = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 2048;
+
+	JobSystem jobs;
+	jobs.start();
+	bool ok = true;
+	for (bool srgb : { false, true }) {
+		for (auto size : { std::make_pair(1u, 1u), std::make_pair(1u, 7u), std::make_pair(13u, 1u), std::make_pair(3u, 3u), std::make_pair(6u, 5u), std::make_pair(37u, 19u), std::make_pair(256u, 64u), std::make_pair(width, height) }) {
+			ok = check(jobs, size.first, size.second, srgb) && ok;
+		}
+	}
+	printf("correctness: %s\n", ok ? "ok" : "FAILED");
+
+	std::vector<uint8_t> image = makeImage(width, height, 1);
+	for (bool srgb : { false, true }) {
+		for (bool useSimd : { false, true }) {
+			for (JobSystem* pool : { static_cast<JobSystem*>(nullptr), &jobs }) {
+				auto start = std::chrono::high_resolution_clock::now();
+				const int runs = 5;
+				for (int i = 0; i < runs; ++i) {
+					mipgen::generateMipChain(image.data(), width, height, srgb, pool, useSimd);
+				}
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+				printf("%ux%u %-5s %-6s %-8s %7.2f ms\n", width, height, srgb ? "sRGB" : "UNORM", useSimd ? "SSE2" : "scalar",
+					pool ? "threads" : "1 thread", ms);
+			}
+		}
+	}
+	return ok ? 0 : 1;
+}
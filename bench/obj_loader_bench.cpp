@@ -0,0 +1,192 @@
+﻿//对比 tinyobj::LoadObj 和 parallelobj::loadObj 的解析速度，并检查两者结果是否完全一致
+//同时用objstream两遍流式读取同一个文件，检查输出的每个三角形角点与LoadObj的索引指向的位置和纹理坐标逐位相同
+//用法: obj_loader_bench [百万三角形数 ...]，默认测试 1M 5M 10M 50M 个三角形的网格
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tiny_obj_loader.h"
+#include "../obj_parallel.h"
+#include "../obj_stream.h"
+
+//生成一个 n x n 的规则网格(每个格子两个三角形)，带纹理坐标和法线
+static void generateGrid(const std::string& path, size_t triangleCount) {
+	size_t quads = triangleCount / 2;
+	size_t n = 1;
+	while (n * n < quads) ++n;
+
+	std::ofstream file(path, std::ios::binary);
+	std::vector<char> buffer(1 << 20);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+
+	char line[256];
+	for (size_t y = 0; y <= n; ++y) {
+		for (size_t x = 0; x <= n; ++x) {
+			float fx = x / float(n), fy = y / float(n);
+			int len = snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn 0 0 1\n", fx * 2.f - 1.f, fy * 2.f - 1.f, (fx - fy) * 0.25f, fx, fy);
+			file.write(line, len);
+		}
+	}
+	size_t written = 0;
+	for (size_t y = 0; y < n && written < quads; ++y) {
+		for (size_t x = 0; x < n && written < quads; ++x, ++written) {
+			size_t a = y * (n + 1) + x + 1, b = a + 1, c = a + n + 1, d = c + 1;
+			int len = snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\nf %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+				a, a, a, b, b, b, d, d, d, a, a, a, d, d, d, c, c, c);
+			file.write(line, len);
+		}
+	}
+}
+
+//覆盖流式读取的其他情况: 四边形(扇形三角化)、相对索引、没有纹理坐标的面、引用文件中之后才出现的顶点
+static void generatePolygons(const std::string& path, size_t quadCount) {
+	std::ofstream file(path, std::ios::binary);
+	char line[256];
+	for (size_t q = 0; q < quadCount; ++q) {
+		for (int k = 0; k < 4; ++k) {
+			float fx = float(q % 100) + (k == 1 || k == 2), fy = float(q / 100) + (k >= 2);
+			int len = snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\n", fx, fy, fx * 0.01f, fx * 0.01f, fy * 0.01f);
+			file.write(line, len);
+		}
+		size_t a = 4 * q + 1;
+		int len;
+		if (q % 3 == 0) {
+			len = snprintf(line, sizeof(line), "f -4/-4 -3/-3 -2/-2 -1/-1\n");
+		} else if (q % 3 == 1 || q + 1 == quadCount) {
+			len = snprintf(line, sizeof(line), "f %zu %zu %zu %zu\n", a, a + 1, a + 2, a + 3);
+		} else {
+			len = snprintf(line, sizeof(line), "f %zu/%zu %zu/%zu %zu/%zu\n", a, a, a + 1, a + 1, a + 4, a + 4);
+		}
+		file.write(line, len);
+	}
+}
+
+//用objstream读取path，逐个角点与LoadObj的结果(按shape的顺序)比较
+static bool sameStreamedCorners(const std::string& path, const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, double& ms) {
+	auto start = std::chrono::high_resolution_clock::now();
+	objstream::AttributeSpill spill(path);
+	std::ifstream first(path, std::ios::binary);
+	if (!spill.write(first, nullptr)) {
+		return false;
+	}
+	size_t total = 0;
+	for (const auto& shape : shapes) {
+		total += shape.mesh.indices.size();
+	}
+	size_t shape = 0, k = 0, emitted = 0;
+	bool same = spill.cornerCount() == total;
+	auto emit = [&](const objstream::Corner& corner) {
+		while (shape < shapes.size() && k == shapes[shape].mesh.indices.size()) {
+			++shape;
+			k = 0;
+		}
+		if (shape == shapes.size()) {
+			return false;
+		}
+		const tinyobj::index_t& index = shapes[shape].mesh.indices[k++];
+		static const float noTexcoord[2] = { 0.f, 0.f };
+		const float* texcoord = index.texcoord_index >= 0 ? &attrib.texcoords[2 * index.texcoord_index] : noTexcoord;
+		uint64_t key = uint64_t(index.vertex_index) << 32 | uint64_t(index.texcoord_index + 1);
+		same = same && corner.key == key && memcmp(corner.position, &attrib.vertices[3 * index.vertex_index], 3 * sizeof(float)) == 0
+			&& memcmp(corner.texcoord, texcoord, 2 * sizeof(float)) == 0;
+		++emitted;
+		return true;
+	};
+	objstream::Reader<decltype(emit)> reader(spill, emit);
+	std::ifstream second(path, std::ios::binary);
+	std::string err;
+	bool ok = reader.read(second, &err);
+	ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	if (!ok) {
+		std::cout << "objstream: " << err << std::endl;
+	}
+	return ok && same && emitted == total;
+}
+
+static bool sameResult(const tinyobj::attrib_t& a, const std::vector<tinyobj::shape_t>& sa, const tinyobj::attrib_t& b, const std::vector<tinyobj::shape_t>& sb) {
+	auto sameReals = [](const std::vector<tinyobj::real_t>& x, const std::vector<tinyobj::real_t>& y) {
+		return x.size() == y.size() && (x.empty() || memcmp(x.data(), y.data(), x.size() * sizeof(tinyobj::real_t)) == 0);
+	};
+	if (!sameReals(a.vertices, b.vertices) || !sameReals(a.normals, b.normals) || !sameReals(a.texcoords, b.texcoords) || sa.size() != sb.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < sa.size(); ++i) {
+		const auto& x = sa[i].mesh;
+		const auto& y = sb[i].mesh;
+		if (sa[i].name != sb[i].name || x.indices.size() != y.indices.size() || x.num_face_vertices != y.num_face_vertices || x.material_ids != y.material_ids) {
+			return false;
+		}
+		for (size_t k = 0; k < x.indices.size(); ++k) {
+			if (x.indices[k].vertex_index != y.indices[k].vertex_index || x.indices[k].normal_index != y.indices[k].normal_index
+				|| x.indices[k].texcoord_index != y.indices[k].texcoord_index) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	std::vector<size_t> sizes;
+	for (int i = 1; i < argc; ++i) {
+		sizes.push_back(static_cast<size_t>(atof(argv[i]) * 1000000));
+	}
+	if (sizes.empty()) {
+		sizes = { 1000000, 5000000, 10000000, 50000000 };
+	}
+
+	JobSystem jobs;
+	jobs.start();
+	bool ok = true;
+	{
+		std::string path = "obj_loader_bench_polygons.obj";
+		generatePolygons(path, 1000);
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string err;
+		double ms;
+		bool same = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()) && sameStreamedCorners(path, attrib, shapes, ms);
+		std::cout << "polygons, relative and forward indices: objstream " << (same ? "identical" : "MISMATCH") << std::endl;
+		ok = ok && same;
+		std::remove(path.c_str());
+	}
+
+	using clock = std::chrono::high_resolution_clock;
+	for (size_t triangles : sizes) {
+		std::string path = "obj_loader_bench_" + std::to_string(triangles) + ".obj";
+		generateGrid(path, triangles);
+
+		tinyobj::attrib_t attribA, attribB;
+		std::vector<tinyobj::shape_t> shapesA, shapesB;
+		std::vector<tinyobj::material_t> materials;
+		std::string err;
+
+		auto t0 = clock::now();
+		tinyobj::LoadObj(&attribA, &shapesA, &materials, &err, path.c_str());
+		auto t1 = clock::now();
+		parallelobj::loadObj(&attribB, &shapesB, &materials, &err, path.c_str(), nullptr, true, &jobs);
+		auto t2 = clock::now();
+
+		double serialMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+		double parallelMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+		bool same = sameResult(attribA, shapesA, attribB, shapesB);
+		std::cout << triangles << " triangles: tinyobj " << serialMs << " ms, parallel " << parallelMs << " ms ("
+			<< serialMs / parallelMs << "x, " << jobs.size() << " threads), "
+			<< (same ? "identical" : "MISMATCH") << std::endl;
+
+		double streamMs;
+		bool streamed = sameStreamedCorners(path, attribA, shapesA, streamMs);
+		std::cout << triangles << " triangles: objstream (two passes) " << streamMs << " ms, " << (streamed ? "identical" : "MISMATCH") << std::endl;
+		ok = ok && same && streamed;
+
+		std::remove(path.c_str());
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+﻿//PNG解码的速度: stb_image和pngdec(标量/SSE2反滤波)，同时检查结果:
+//1. 生成各种颜色类型(灰度/灰度+alpha/RGB/RGBA/调色板，带或不带tRNS)、各种滤波方式的PNG，pngdec的结果与stbi_load_from_memory逐位相同
+//   zlib数据分别用stored块和固定Huffman码的块(带LZ77匹配)，动态Huffman码由下面的真实纹理覆盖
+//2. 测速的文件也先比较结果，pngdec不支持的文件(例如JPEG)只报告stb_image的时间
+//3. 每种滤波方式单独的反滤波时间(标量/SSE2)，判断SIMD路径是否值得保留
+//用法: png_decode_bench [图像...]，默认textures目录下的viking_room.png和texture.jpg
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#include "../png_decode.h"
+#include "png_writer.h"
+
+//pngdec必须能解码，并且标量和SSE2的结果都与stb_image相同
+static bool check(const std::vector<uint8_t>& png, const char* name) {
+	int width, height, channels;
+	stbi_uc* expected = stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &width, &height, &channels, STBI_rgb_alpha);
+	if (!expected) {
+		printf("%s: stb_image failed: %s\n", name, stbi_failure_reason());
+		return false;
+	}
+	bool ok = true;
+	for (bool useSimd : { false, true }) {
+		std::vector<uint8_t> rgba;
+		uint32_t w, h;
+		if (!pngdec::decodeRgba(png.data(), png.size(), rgba, w, h, useSimd)) {
+			printf("%s: pngdec (%s) failed\n", name, useSimd ? "SSE2" : "scalar");
+			ok = false;
+		} else if (int(w) != width || int(h) != height || memcmp(rgba.data(), expected, rgba.size()) != 0) {
+			printf("%s: pngdec (%s) differs from stb_image\n", name, useSimd ? "SSE2" : "scalar");
+			ok = false;
+		}
+	}
+	stbi_image_free(expected);
+	return ok;
+}
+
+template<typename F>
+static double averageMs(int runs, F&& f) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < runs; ++i) {
+		f();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+}
+
+int main(int argc, char** argv) {
+	bool ok = true;
+	uint32_t seed = 1;
+	for (uint32_t colorType : { 0u, 2u, 3u, 4u, 6u }) {
+		for (auto size : { std::make_pair(1u, 1u), std::make_pair(5u, 3u), std::make_pair(37u, 19u), std::make_pair(256u, 64u) }) {
+			for (bool fixedHuffman : { false, true }) {
+				for (bool transparency : { false, true }) {
+					if (transparency && (colorType == 4 || colorType == 6)) {
+						continue;
+					}
+					char name[96];
+					snprintf(name, sizeof(name), "type %u %ux%u %s%s", colorType, size.first, size.second, fixedHuffman ? "fixed" : "stored", transparency ? " tRNS" : "");
+					ok = check(makePng(size.first, size.second, colorType, transparency, fixedHuffman, seed++), name) && ok;
+				}
+			}
+		}
+	}
+	printf("correctness: %s\n", ok ? "ok" : "FAILED");
+
+	//随机的滤波后数据，4096个像素 x 256行，每行都用同一种滤波
+	const char* filterNames[] = { "None", "Sub", "Up", "Avg", "Paeth" };
+	for (uint32_t bpp : { 3u, 4u }) {
+		const size_t rowBytes = 4096 * bpp;
+		const size_t rows = 256;
+		std::mt19937 rng(bpp);
+		std::vector<uint8_t> filtered(rowBytes * rows), unfiltered(rowBytes * rows), zeroRow(rowBytes, 0);
+		for (auto& v : filtered) {
+			v = static_cast<uint8_t>(rng());
+		}
+		for (uint32_t filter = 1; filter <= 4; ++filter) {
+			//Paeth没有SIMD实现，unfilterRow总是使用标量，只报告一次
+			bool hasSimd = filter != 4;
+			double ms[2] = {};
+			for (bool useSimd : { false, true }) {
+				if (useSimd && !hasSimd) {
+					continue;
+				}
+				//取多次中最快的一次，平均值受第一次运行时缓存和频率变化的影响较大
+				ms[useSimd] = 1e30;
+				for (int run = 0; run < 20; ++run) {
+					ms[useSimd] = std::min(ms[useSimd], averageMs(1, [&] {
+						for (size_t y = 0; y < rows; ++y) {
+							const uint8_t* prev = y == 0 ? zeroRow.data() : unfiltered.data() + (y - 1) * rowBytes;
+							pngdec::unfilterRow(filter, filtered.data() + y * rowBytes, prev, unfiltered.data() + y * rowBytes, rowBytes, bpp, useSimd);
+						}
+					}));
+				}
+			}
+			if (hasSimd) {
+				printf("unfilter %-5s bpp %u  scalar %6.3f ms  SSE2 %6.3f ms (%.2fx)\n", filterNames[filter], bpp, ms[0], ms[1], ms[0] / ms[1]);
+			} else {
+				printf("unfilter %-5s bpp %u  scalar %6.3f ms  (scalar only)\n", filterNames[filter], bpp, ms[0]);
+			}
+		}
+	}
+
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; ++i) {
+		paths.push_back(argv[i]);
+	}
+	if (paths.empty()) {
+		paths = { "textures/viking_room.png", "textures/texture.jpg" };
+	}
+	for (const auto& path : paths) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			printf("%s: not found\n", path.c_str());
+			continue;
+		}
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		int width = 0, height = 0, channels;
+		const int runs = 10;
+		double stbiMs = averageMs(runs, [&] {
+			stbi_image_free(stbi_load_from_memory(data.data(), static_cast<int>(data.size()), &width, &height, &channels, STBI_rgb_alpha));
+		});
+		double megabytes = double(width) * height * 4 / (1 << 20);
+		printf("%s %dx%d\n  stb_image     %7.2f ms %7.1f MB/s\n", path.c_str(), width, height, stbiMs, megabytes / stbiMs * 1000);
+		std::vector<uint8_t> rgba;
+		uint32_t w, h;
+		if (!pngdec::decodeRgba(data.data(), data.size(), rgba, w, h)) {
+			printf("  pngdec        not supported, falls back to stb_image\n");
+			continue;
+		}
+		ok = check(data, path.c_str()) && ok;
+		for (bool useSimd : { false, true }) {
+			double ms = averageMs(runs, [&] { pngdec::decodeRgba(data.data(), data.size(), rgba, w, h, useSimd); });
+			printf("  pngdec %-6s %7.2f ms %7.1f MB/s (%.2fx)\n", useSimd ? "SSE2" : "scalar", ms, megabytes / ms * 1000, stbiMs / ms);
+		}
+	}
+	return ok ? 0 : 1;
+}
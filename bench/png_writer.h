@@ -0,0 +1,189 @@
+﻿#pragma once
+//测试程序共用的PNG生成: 各种颜色类型和滤波方式，zlib数据用stored块或固定Huffman码的块
+
+#include <cstdint>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../png_decode.h"
+
+inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+inline void appendChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data) {
+	uint32_t length = static_cast<uint32_t>(data.size());
+	uint8_t header[8] = { uint8_t(length >> 24), uint8_t(length >> 16), uint8_t(length >> 8), uint8_t(length),
+		uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3]) };
+	png.insert(png.end(), header, header + 8);
+	png.insert(png.end(), data.begin(), data.end());
+	uint32_t crc = crc32(data.data(), data.size(), crc32(header + 4, 4));
+	uint8_t tail[4] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+	png.insert(png.end(), tail, tail + 4);
+}
+
+struct BitWriter {
+	std::vector<uint8_t> bytes;
+	uint64_t buffer = 0;
+	uint32_t count = 0;
+
+	void put(uint32_t value, uint32_t bits) {
+		buffer |= uint64_t(value) << count;
+		count += bits;
+		while (count >= 8) {
+			bytes.push_back(static_cast<uint8_t>(buffer));
+			buffer >>= 8;
+			count -= 8;
+		}
+	}
+
+	//Huffman码从高位开始写
+	void putCode(uint32_t code, uint32_t length) {
+		put(pngdec::reverseBits(code, length), length);
+	}
+
+	void flush() {
+		if (count > 0) {
+			put(0, 8 - count);
+		}
+	}
+};
+
+inline void putLitLen(BitWriter& writer, uint32_t symbol) {
+	if (symbol < 144) {
+		writer.putCode(0x30 + symbol, 8);
+	} else if (symbol < 256) {
+		writer.putCode(0x190 + symbol - 144, 9);
+	} else if (symbol < 280) {
+		writer.putCode(symbol - 256, 7);
+	} else {
+		writer.putCode(0xc0 + symbol - 280, 8);
+	}
+}
+
+//固定Huffman码的deflate，只在几个固定的距离(1、一个像素、上一行、上两行)中找匹配，覆盖短距离和长距离的拷贝
+inline std::vector<uint8_t> deflateFixed(const std::vector<uint8_t>& raw, uint32_t pixelBytes, size_t rowBytes) {
+	BitWriter writer;
+	writer.put(1, 1);
+	writer.put(1, 2);
+	const size_t distances[4] = { 1, pixelBytes, rowBytes + 1, 2 * (rowBytes + 1) };
+	for (size_t i = 0; i < raw.size();) {
+		size_t bestLength = 0, bestDistance = 0;
+		for (size_t distance : distances) {
+			if (distance > i || distance > 32768) {
+				continue;
+			}
+			size_t length = 0;
+			while (length < 258 && i + length < raw.size() && raw[i + length] == raw[i + length - distance]) {
+				++length;
+			}
+			if (length > bestLength) {
+				bestLength = length;
+				bestDistance = distance;
+			}
+		}
+		if (bestLength < 3) {
+			putLitLen(writer, raw[i++]);
+			continue;
+		}
+		uint32_t lengthCode = 28;
+		while (pngdec::lengthBase[lengthCode] > bestLength) {
+			--lengthCode;
+		}
+		putLitLen(writer, 257 + lengthCode);
+		writer.put(static_cast<uint32_t>(bestLength - pngdec::lengthBase[lengthCode]), pngdec::lengthExtra[lengthCode]);
+		uint32_t distanceCode = 29;
+		while (pngdec::distanceBase[distanceCode] > bestDistance) {
+			--distanceCode;
+		}
+		writer.putCode(distanceCode, 5);
+		writer.put(static_cast<uint32_t>(bestDistance - pngdec::distanceBase[distanceCode]), pngdec::distanceExtra[distanceCode]);
+		i += bestLength;
+	}
+	putLitLen(writer, 256);
+	writer.flush();
+	return writer.bytes;
+}
+
+inline std::vector<uint8_t> deflateStored(const std::vector<uint8_t>& raw) {
+	std::vector<uint8_t> out;
+	size_t offset = 0;
+	do {
+		uint16_t length = static_cast<uint16_t>(std::min<size_t>(65535, raw.size() - offset));
+		out.push_back(offset + length == raw.size() ? 1 : 0);
+		out.push_back(static_cast<uint8_t>(length));
+		out.push_back(static_cast<uint8_t>(length >> 8));
+		out.push_back(static_cast<uint8_t>(~length));
+		out.push_back(static_cast<uint8_t>(~length >> 8));
+		out.insert(out.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+	} while (offset < raw.size());
+	return out;
+}
+
+//滤波后的数据直接随机生成(每行的滤波方式轮流使用5种)，混合重复的片段和噪声，使固定Huffman码的块中有各种匹配
+inline std::vector<uint8_t> makePng(uint32_t width, uint32_t height, uint32_t colorType, bool transparency, bool fixedHuffman, uint32_t seed) {
+	std::mt19937 rng(seed);
+	const uint32_t pixelBytes = colorType == 3 ? 1 : (colorType & 2 ? 3 : 1) + (colorType & 4 ? 1 : 0);
+	const size_t rowBytes = size_t(width) * pixelBytes;
+	std::vector<uint8_t> raw;
+	for (uint32_t y = 0; y < height; ++y) {
+		raw.push_back(static_cast<uint8_t>((y + seed) % 5));
+		for (size_t x = 0; x < rowBytes; ++x) {
+			raw.push_back(rng() % 4 == 0 ? static_cast<uint8_t>(rng()) : static_cast<uint8_t>(x % 7));
+		}
+	}
+
+	std::vector<uint8_t> png = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	appendChunk(png, "IHDR", { uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+		uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height), 8, uint8_t(colorType), 0, 0, 0 });
+	appendChunk(png, "tEXt", { 'k', 0, 'v' });
+	if (colorType == 3) {
+		//完整的256项调色板，随机的索引都有效
+		std::vector<uint8_t> palette(256 * 3);
+		for (auto& v : palette) {
+			v = static_cast<uint8_t>(rng());
+		}
+		appendChunk(png, "PLTE", palette);
+		if (transparency) {
+			std::vector<uint8_t> alpha(1 + rng() % 256);
+			for (auto& v : alpha) {
+				v = static_cast<uint8_t>(rng());
+			}
+			appendChunk(png, "tRNS", alpha);
+		}
+	} else if (transparency) {
+		//透明色取较小的值，使部分像素能匹配
+		std::vector<uint8_t> key;
+		for (uint32_t i = 0; i < pixelBytes; ++i) {
+			key.push_back(0);
+			key.push_back(static_cast<uint8_t>(rng() % 7));
+		}
+		appendChunk(png, "tRNS", key);
+	}
+
+	std::vector<uint8_t> deflate = fixedHuffman ? deflateFixed(raw, pixelBytes, rowBytes) : deflateStored(raw);
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	zlib.insert(zlib.end(), deflate.begin(), deflate.end());
+	uint32_t a = 1, b = 0;
+	for (uint8_t v : raw) {
+		a = (a + v) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint32_t adler = (b << 16) | a;
+	zlib.insert(zlib.end(), { uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler) });
+	//分成多个IDAT块，inflate需要把它们连接起来
+	for (size_t offset = 0; offset < zlib.size(); offset += 1000) {
+		appendChunk(png, "IDAT", std::vector<uint8_t>(zlib.begin() + offset, zlib.begin() + std::min(zlib.size(), offset + 1000)));
+	}
+	appendChunk(png, "IEND", {});
+	return png;
+}
@@ -0,0 +1,118 @@
+﻿//纹理加载服务的扩展性: 生成一组纹理文件，分别用1到N个工作线程加载，比较总时间
+//同时检查每个纹理的加载结果与在当前线程上直接加载的结果逐位相同
+//用法: texture_loader_bench [纹理数量] [源图像...]
+//默认把textures目录下的viking_room.png和texture.jpg各复制成一半数量的文件(PNG和JPEG的解码路径都覆盖)，默认128个
+//源图像不存在时生成带噪声的未压缩PNG(deflate的stored块)，这时解码主要是反滤波，inflate几乎不花时间
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#include "../texture_loader.h"
+#include "png_writer.h"
+
+static double loadAll(const std::vector<TextureRequest>& requests, unsigned threads, std::vector<LoadedTexture>& results) {
+	auto start = std::chrono::high_resolution_clock::now();
+	results.clear();
+	results.resize(requests.size());
+	if (threads == 0) {
+		//不使用加载服务，在当前线程上依次加载
+		for (size_t i = 0; i < requests.size(); ++i) {
+			TextureLoader::loadTexture(requests[i], nullptr, results[i]);
+		}
+	} else {
+		//调用者是0号线程，next等待时也执行加载任务
+		JobSystem jobs;
+		jobs.start(threads);
+		TextureLoader loader(jobs);
+		for (auto&& request : requests) {
+			loader.load(request);
+		}
+		LoadedTexture texture;
+		while (loader.next(texture)) {
+			uint32_t index = texture.id - 1;
+			results[index] = std::move(texture);
+		}
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 128;
+	std::vector<std::string> sources;
+	for (int i = 2; i < argc; ++i) {
+		sources.push_back(argv[i]);
+	}
+	if (sources.empty()) {
+		for (const char* path : { "textures/viking_room.png", "textures/texture.jpg", "../textures/viking_room.png", "../textures/texture.jpg" }) {
+			if (std::filesystem::exists(path) && sources.size() < 2) {
+				sources.push_back(path);
+			}
+		}
+	}
+
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "texture_loader_bench";
+	std::filesystem::create_directories(dir);
+	std::vector<TextureRequest> requests;
+	for (size_t i = 0; i < count; ++i) {
+		std::vector<uint8_t> bytes;
+		std::string extension = ".png";
+		if (!sources.empty()) {
+			const std::string& source = sources[i % sources.size()];
+			std::ifstream in(source, std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			extension = std::filesystem::path(source).extension().string();
+		} else {
+			bytes = makePng(512, 512, 6, false, false, static_cast<uint32_t>(i));
+		}
+		std::filesystem::path path = dir / ("texture_" + std::to_string(i) + extension);
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		TextureRequest request;
+		request.path = path.string();
+		request.mipmaps = true;
+		requests.push_back(request);
+	}
+	printf("%zu textures from %s\n", count, sources.empty() ? "generated PNGs" : "copies of the source images");
+
+	std::vector<LoadedTexture> reference;
+	double sequential = loadAll(requests, 0, reference);
+	printf("sequential:  %8.1f ms\n", sequential);
+	bool ok = true;
+	for (auto&& texture : reference) {
+		if (!texture.error.empty()) {
+			printf("%s\n", texture.error.c_str());
+			ok = false;
+		}
+	}
+
+	unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < hardware; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardware);
+	for (unsigned threads : threadCounts) {
+		std::vector<LoadedTexture> results;
+		double ms = loadAll(requests, threads, results);
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (results[i].data != reference[i].data || results[i].width != reference[i].width || results[i].levelCount != reference[i].levelCount) {
+				printf("texture %zu differs from the sequential result with %u threads\n", i, threads);
+				ok = false;
+				break;
+			}
+		}
+		printf("%2u threads:  %8.1f ms  (%.2fx)\n", threads, ms, sequential / ms);
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+	printf("correctness: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
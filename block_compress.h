@@ -0,0 +1,579 @@
+﻿#pragma once
+//RGBA8纹理的块压缩(BC1/BC3/BC7)编码和解码，在烘焙纹理时使用，解码只用来验证编码结果
+//每个4x4的块独立编码: BC1每块8字节(RGB，4bpp)，BC3每块16字节(BC1颜色 + 插值alpha，8bpp)，BC7每块16字节(8bpp)
+//BC7只使用mode 6(单个子集，RGBA端点7位 + p位，4位索引)，对纹理来说质量已经明显好于BC1/BC3，编码速度也快得多
+//编码直接作用于sRGB编码后的字节，与硬件对*_SRGB_BLOCK格式的解码方式一致
+//端点先沿主成分方向取投影的最小/最大值，再用最小二乘法根据选出的索引调整一次
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "job_system.h"
+
+namespace bcn {
+
+	enum class Format {
+		BC1,
+		BC3,
+		BC7,
+	};
+
+	inline uint32_t blockBytes(Format format) {
+		return format == Format::BC1 ? 8 : 16;
+	}
+
+	//各层压缩后在连续存储中的字节偏移，最后一个元素是总大小，尺寸不是4的倍数时按整块计算
+	inline std::vector<size_t> levelOffsets(uint32_t width, uint32_t height, uint32_t levels, Format format) {
+		std::vector<size_t> offsets(levels + 1, 0);
+		for (uint32_t i = 0; i < levels; ++i) {
+			uint32_t w = std::max(1u, width >> i), h = std::max(1u, height >> i);
+			offsets[i + 1] = offsets[i] + size_t((w + 3) / 4) * ((h + 3) / 4) * blockBytes(format);
+		}
+		return offsets;
+	}
+
+	namespace detail {
+
+		inline int colorError(const uint8_t* a, const uint8_t* b, int channels) {
+			int error = 0;
+			for (int c = 0; c < channels; ++c) {
+				int d = int(a[c]) - int(b[c]);
+				error += d * d;
+			}
+			return error;
+		}
+
+		//4x4块中channels个通道的主成分方向，返回false表示块中所有像素相同
+		inline bool principalAxis(const uint8_t block[64], int channels, float mean[4], float axis[4]) {
+			for (int c = 0; c < 4; ++c) {
+				mean[c] = 0.f;
+				axis[c] = 0.f;
+			}
+			for (int i = 0; i < 16; ++i) {
+				for (int c = 0; c < channels; ++c) {
+					mean[c] += block[4 * i + c];
+				}
+			}
+			for (int c = 0; c < channels; ++c) {
+				mean[c] /= 16.f;
+			}
+			float cov[4][4] = {};
+			for (int i = 0; i < 16; ++i) {
+				float d[4];
+				for (int c = 0; c < channels; ++c) {
+					d[c] = block[4 * i + c] - mean[c];
+				}
+				for (int r = 0; r < channels; ++r) {
+					for (int c = 0; c < channels; ++c) {
+						cov[r][c] += d[r] * d[c];
+					}
+				}
+			}
+			//幂迭代，初始方向取方差最大的通道
+			int start = 0;
+			for (int c = 1; c < channels; ++c) {
+				if (cov[c][c] > cov[start][start]) {
+					start = c;
+				}
+			}
+			if (cov[start][start] <= 0.f) {
+				return false;
+			}
+			float v[4] = {};
+			for (int c = 0; c < channels; ++c) {
+				v[c] = cov[start][c];
+			}
+			for (int iter = 0; iter < 8; ++iter) {
+				float next[4] = {};
+				float length = 0.f;
+				for (int r = 0; r < channels; ++r) {
+					for (int c = 0; c < channels; ++c) {
+						next[r] += cov[r][c] * v[c];
+					}
+					length += next[r] * next[r];
+				}
+				if (length <= 0.f) {
+					break;
+				}
+				length = 1.f / std::sqrt(length);
+				for (int c = 0; c < channels; ++c) {
+					v[c] = next[c] * length;
+				}
+			}
+			float length = 0.f;
+			for (int c = 0; c < channels; ++c) {
+				length += v[c] * v[c];
+			}
+			if (length <= 0.f) {
+				return false;
+			}
+			length = 1.f / std::sqrt(length);
+			for (int c = 0; c < channels; ++c) {
+				axis[c] = v[c] * length;
+			}
+			return true;
+		}
+
+		//沿主成分方向的两个端点(浮点，已钳制到[0, 255])
+		inline void axisEndpoints(const uint8_t block[64], int channels, float e0[4], float e1[4]) {
+			float mean[4], axis[4];
+			if (!principalAxis(block, channels, mean, axis)) {
+				for (int c = 0; c < 4; ++c) {
+					e0[c] = e1[c] = block[c];
+				}
+				return;
+			}
+			float tMin = 0.f, tMax = 0.f;
+			for (int i = 0; i < 16; ++i) {
+				float t = 0.f;
+				for (int c = 0; c < channels; ++c) {
+					t += (block[4 * i + c] - mean[c]) * axis[c];
+				}
+				tMin = std::min(tMin, t);
+				tMax = std::max(tMax, t);
+			}
+			for (int c = 0; c < 4; ++c) {
+				e0[c] = std::min(255.f, std::max(0.f, mean[c] + tMax * axis[c]));
+				e1[c] = std::min(255.f, std::max(0.f, mean[c] + tMin * axis[c]));
+			}
+		}
+
+		//已知每个像素在两个端点之间的权重(weights[i]为e1的比例)，用最小二乘法求端点
+		inline bool leastSquaresEndpoints(const uint8_t block[64], int channels, const float weights[16], float e0[4], float e1[4]) {
+			float aa = 0.f, bb = 0.f, ab = 0.f;
+			float ax[4] = {}, bx[4] = {};
+			for (int i = 0; i < 16; ++i) {
+				float b = weights[i], a = 1.f - b;
+				aa += a * a;
+				bb += b * b;
+				ab += a * b;
+				for (int c = 0; c < channels; ++c) {
+					ax[c] += a * block[4 * i + c];
+					bx[c] += b * block[4 * i + c];
+				}
+			}
+			float det = aa * bb - ab * ab;
+			if (std::fabs(det) < 1e-6f) {
+				return false;
+			}
+			for (int c = 0; c < channels; ++c) {
+				e0[c] = std::min(255.f, std::max(0.f, (ax[c] * bb - bx[c] * ab) / det));
+				e1[c] = std::min(255.f, std::max(0.f, (bx[c] * aa - ax[c] * ab) / det));
+			}
+			return true;
+		}
+
+		inline uint16_t packRgb565(const float color[4]) {
+			uint32_t r = static_cast<uint32_t>(color[0] * 31.f / 255.f + 0.5f);
+			uint32_t g = static_cast<uint32_t>(color[1] * 63.f / 255.f + 0.5f);
+			uint32_t b = static_cast<uint32_t>(color[2] * 31.f / 255.f + 0.5f);
+			return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+		}
+
+		inline void unpackRgb565(uint16_t packed, uint8_t color[4]) {
+			uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+			color[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+			color[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+			color[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+			color[3] = 255;
+		}
+
+		//BC1的4色调色板，c0 <= c1时第3个颜色为透明黑(只有BC1会这样解释)
+		inline void bc1Palette(uint16_t c0, uint16_t c1, bool allowTransparent, uint8_t palette[4][4]) {
+			unpackRgb565(c0, palette[0]);
+			unpackRgb565(c1, palette[1]);
+			if (c0 > c1 || !allowTransparent) {
+				for (int c = 0; c < 3; ++c) {
+					palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+					palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+				}
+				palette[2][3] = palette[3][3] = 255;
+			} else {
+				for (int c = 0; c < 3; ++c) {
+					palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+					palette[3][c] = 0;
+				}
+				palette[2][3] = 255;
+				palette[3][3] = 0;
+			}
+		}
+
+		//用4色模式编码RGB，返回误差
+		inline int encodeBC1Color(const uint8_t block[64], const float e0[4], const float e1[4], uint8_t out[8]) {
+			uint16_t c0 = packRgb565(e0), c1 = packRgb565(e1);
+			if (c0 < c1) {
+				std::swap(c0, c1);
+			}
+			uint32_t indices = 0;
+			int error = 0;
+			if (c0 == c1) {
+				//两个端点相同时解码器进入3色模式，所有像素都使用索引0
+				uint8_t color[4];
+				unpackRgb565(c0, color);
+				for (int i = 0; i < 16; ++i) {
+					error += colorError(block + 4 * i, color, 3);
+				}
+			} else {
+				uint8_t palette[4][4];
+				bc1Palette(c0, c1, false, palette);
+				for (int i = 0; i < 16; ++i) {
+					int best = 0, bestError = colorError(block + 4 * i, palette[0], 3);
+					for (int p = 1; p < 4; ++p) {
+						int e = colorError(block + 4 * i, palette[p], 3);
+						if (e < bestError) {
+							best = p;
+							bestError = e;
+						}
+					}
+					indices |= uint32_t(best) << (2 * i);
+					error += bestError;
+				}
+			}
+			memcpy(out, &c0, 2);
+			memcpy(out + 2, &c1, 2);
+			memcpy(out + 4, &indices, 4);
+			return error;
+		}
+
+		inline void encodeBC1ColorRefined(const uint8_t block[64], uint8_t out[8]) {
+			float e0[4], e1[4];
+			axisEndpoints(block, 3, e0, e1);
+			int error = encodeBC1Color(block, e0, e1, out);
+			if (error == 0) {
+				return;
+			}
+			//根据索引得到每个像素的权重，最小二乘调整端点后再编码一次，误差更小时使用新的结果
+			const float indexWeights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+			uint32_t indices;
+			memcpy(&indices, out + 4, 4);
+			float weights[16];
+			for (int i = 0; i < 16; ++i) {
+				weights[i] = indexWeights[(indices >> (2 * i)) & 3];
+			}
+			uint16_t c0, c1;
+			memcpy(&c0, out, 2);
+			memcpy(&c1, out + 2, 2);
+			if (c0 == c1 || !leastSquaresEndpoints(block, 3, weights, e0, e1)) {
+				return;
+			}
+			uint8_t refined[8];
+			if (encodeBC1Color(block, e0, e1, refined) < error) {
+				memcpy(out, refined, 8);
+			}
+		}
+
+		//BC3/BC4的alpha块: 两个8位端点和16个3位索引，a0 > a1时使用8个插值
+		inline void alphaPalette(uint8_t a0, uint8_t a1, uint8_t palette[8]) {
+			palette[0] = a0;
+			palette[1] = a1;
+			if (a0 > a1) {
+				for (int i = 1; i < 7; ++i) {
+					palette[i + 1] = static_cast<uint8_t>(((7 - i) * a0 + i * a1) / 7);
+				}
+			} else {
+				for (int i = 1; i < 5; ++i) {
+					palette[i + 1] = static_cast<uint8_t>(((5 - i) * a0 + i * a1) / 5);
+				}
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+		}
+
+		inline void encodeAlpha(const uint8_t block[64], uint8_t out[8]) {
+			uint8_t a0 = 0, a1 = 255;
+			for (int i = 0; i < 16; ++i) {
+				a0 = std::max(a0, block[4 * i + 3]);
+				a1 = std::min(a1, block[4 * i + 3]);
+			}
+			uint8_t palette[8];
+			alphaPalette(a0, a1, palette);
+			uint64_t bits = uint64_t(a0) | (uint64_t(a1) << 8);
+			for (int i = 0; i < 16 && a0 != a1; ++i) {
+				int best = 0, bestError = 256;
+				for (int p = 0; p < 8; ++p) {
+					int e = std::abs(int(block[4 * i + 3]) - int(palette[p]));
+					if (e < bestError) {
+						best = p;
+						bestError = e;
+					}
+				}
+				bits |= uint64_t(best) << (16 + 3 * i);
+			}
+			memcpy(out, &bits, 8);
+		}
+
+		const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+		//按位从低到高写入128位的块
+		struct BitWriter {
+			uint8_t* out;
+			uint32_t position = 0;
+			void write(uint32_t value, uint32_t bits) {
+				for (uint32_t i = 0; i < bits; ++i, ++position) {
+					if ((value >> i) & 1) {
+						out[position >> 3] |= static_cast<uint8_t>(1u << (position & 7));
+					}
+				}
+			}
+		};
+
+		struct BitReader {
+			const uint8_t* in;
+			uint32_t position = 0;
+			uint32_t read(uint32_t bits) {
+				uint32_t value = 0;
+				for (uint32_t i = 0; i < bits; ++i, ++position) {
+					value |= uint32_t((in[position >> 3] >> (position & 7)) & 1) << i;
+				}
+				return value;
+			}
+		};
+
+		//BC7 mode 6的一组端点(7位) + p位对应的16色调色板
+		inline void bc7Mode6Palette(const uint8_t q0[4], const uint8_t q1[4], uint32_t p0, uint32_t p1, uint8_t palette[16][4]) {
+			for (int c = 0; c < 4; ++c) {
+				int v0 = (q0[c] << 1) | p0, v1 = (q1[c] << 1) | p1;
+				for (int i = 0; i < 16; ++i) {
+					palette[i][c] = static_cast<uint8_t>(((64 - bc7Weights4[i]) * v0 + bc7Weights4[i] * v1 + 32) >> 6);
+				}
+			}
+		}
+
+		//给定浮点端点，尝试4种p位组合，返回误差最小的量化端点和索引
+		inline int encodeBC7Mode6Endpoints(const uint8_t block[64], const float e0[4], const float e1[4],
+			uint8_t q0[4], uint8_t q1[4], uint32_t& p0, uint32_t& p1, uint8_t indices[16]) {
+			int bestError = INT32_MAX;
+			for (uint32_t pbits = 0; pbits < 4; ++pbits) {
+				uint32_t tp0 = pbits & 1, tp1 = pbits >> 1;
+				uint8_t t0[4], t1[4];
+				for (int c = 0; c < 4; ++c) {
+					t0[c] = static_cast<uint8_t>(std::min(127.f, std::max(0.f, std::floor((e0[c] - tp0) / 2.f + 0.5f))));
+					t1[c] = static_cast<uint8_t>(std::min(127.f, std::max(0.f, std::floor((e1[c] - tp1) / 2.f + 0.5f))));
+				}
+				uint8_t palette[16][4];
+				bc7Mode6Palette(t0, t1, tp0, tp1, palette);
+				//像素投影到端点连线上得到近似的索引，只比较相邻的三个颜色，不用遍历整个调色板
+				float direction[4], lengthSquared = 0.f;
+				for (int c = 0; c < 4; ++c) {
+					direction[c] = float(palette[15][c]) - float(palette[0][c]);
+					lengthSquared += direction[c] * direction[c];
+				}
+				float scale = lengthSquared > 0.f ? 15.f / lengthSquared : 0.f;
+				int error = 0;
+				uint8_t tIndices[16];
+				for (int i = 0; i < 16 && error < bestError; ++i) {
+					float t = 0.f;
+					for (int c = 0; c < 4; ++c) {
+						t += (float(block[4 * i + c]) - float(palette[0][c])) * direction[c];
+					}
+					int guess = std::min(15, std::max(0, static_cast<int>(t * scale + 0.5f)));
+					int best = guess, bestTexelError = colorError(block + 4 * i, palette[guess], 4);
+					for (int p = std::max(0, guess - 1); p <= std::min(15, guess + 1); ++p) {
+						int e = colorError(block + 4 * i, palette[p], 4);
+						if (e < bestTexelError) {
+							best = p;
+							bestTexelError = e;
+						}
+					}
+					tIndices[i] = static_cast<uint8_t>(best);
+					error += bestTexelError;
+				}
+				if (error < bestError) {
+					bestError = error;
+					memcpy(q0, t0, 4);
+					memcpy(q1, t1, 4);
+					memcpy(indices, tIndices, 16);
+					p0 = tp0;
+					p1 = tp1;
+				}
+			}
+			return bestError;
+		}
+	}
+
+	inline void encodeBC1Block(const uint8_t block[64], uint8_t out[8]) {
+		detail::encodeBC1ColorRefined(block, out);
+	}
+
+	inline void encodeBC3Block(const uint8_t block[64], uint8_t out[16]) {
+		detail::encodeAlpha(block, out);
+		detail::encodeBC1ColorRefined(block, out + 8);
+	}
+
+	inline void encodeBC7Block(const uint8_t block[64], uint8_t out[16]) {
+		float e0[4], e1[4];
+		detail::axisEndpoints(block, 4, e0, e1);
+		uint8_t q0[4], q1[4], indices[16];
+		uint32_t p0 = 0, p1 = 0;
+		int error = detail::encodeBC7Mode6Endpoints(block, e0, e1, q0, q1, p0, p1, indices);
+		if (error > 0) {
+			float weights[16];
+			for (int i = 0; i < 16; ++i) {
+				weights[i] = detail::bc7Weights4[indices[i]] / 64.f;
+			}
+			uint8_t r0[4], r1[4], rIndices[16];
+			uint32_t rp0 = 0, rp1 = 0;
+			if (detail::leastSquaresEndpoints(block, 4, weights, e0, e1)
+				&& detail::encodeBC7Mode6Endpoints(block, e0, e1, r0, r1, rp0, rp1, rIndices) < error) {
+				memcpy(q0, r0, 4);
+				memcpy(q1, r1, 4);
+				memcpy(indices, rIndices, 16);
+				p0 = rp0;
+				p1 = rp1;
+			}
+		}
+		//第一个像素的索引最高位隐含为0，否则交换两个端点并反转索引
+		if (indices[0] & 8) {
+			for (int c = 0; c < 4; ++c) {
+				std::swap(q0[c], q1[c]);
+			}
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; ++i) {
+				indices[i] = static_cast<uint8_t>(15 - indices[i]);
+			}
+		}
+		memset(out, 0, 16);
+		detail::BitWriter writer{ out };
+		writer.write(1u << 6, 7);
+		for (int c = 0; c < 4; ++c) {
+			writer.write(q0[c], 7);
+			writer.write(q1[c], 7);
+		}
+		writer.write(p0, 1);
+		writer.write(p1, 1);
+		writer.write(indices[0], 3);
+		for (int i = 1; i < 16; ++i) {
+			writer.write(indices[i], 4);
+		}
+	}
+
+	inline void encodeBlock(Format format, const uint8_t block[64], uint8_t* out) {
+		switch (format) {
+		case Format::BC1: encodeBC1Block(block, out); break;
+		case Format::BC3: encodeBC3Block(block, out); break;
+		case Format::BC7: encodeBC7Block(block, out); break;
+		}
+	}
+
+	//解码一个块到4x4的RGBA8像素，BC7中mode 6以外的块返回false
+	inline bool decodeBlock(Format format, const uint8_t* in, uint8_t block[64]) {
+		if (format == Format::BC1 || format == Format::BC3) {
+			const uint8_t* color = format == Format::BC1 ? in : in + 8;
+			uint16_t c0, c1;
+			uint32_t indices;
+			memcpy(&c0, color, 2);
+			memcpy(&c1, color + 2, 2);
+			memcpy(&indices, color + 4, 4);
+			uint8_t palette[4][4];
+			detail::bc1Palette(c0, c1, format == Format::BC1, palette);
+			for (int i = 0; i < 16; ++i) {
+				memcpy(block + 4 * i, palette[(indices >> (2 * i)) & 3], 4);
+			}
+			if (format == Format::BC3) {
+				uint64_t bits;
+				memcpy(&bits, in, 8);
+				uint8_t alphas[8];
+				detail::alphaPalette(static_cast<uint8_t>(bits), static_cast<uint8_t>(bits >> 8), alphas);
+				for (int i = 0; i < 16; ++i) {
+					block[4 * i + 3] = alphas[(bits >> (16 + 3 * i)) & 7];
+				}
+			}
+			return true;
+		}
+		detail::BitReader reader{ in };
+		if (reader.read(7) != (1u << 6)) {
+			return false;
+		}
+		uint8_t q0[4], q1[4];
+		for (int c = 0; c < 4; ++c) {
+			q0[c] = static_cast<uint8_t>(reader.read(7));
+			q1[c] = static_cast<uint8_t>(reader.read(7));
+		}
+		uint32_t p0 = reader.read(1), p1 = reader.read(1);
+		uint8_t palette[16][4];
+		detail::bc7Mode6Palette(q0, q1, p0, p1, palette);
+		for (int i = 0; i < 16; ++i) {
+			memcpy(block + 4 * i, palette[reader.read(i == 0 ? 3 : 4)], 4);
+		}
+		return true;
+	}
+
+	//压缩一层图像的[blockRowBegin, blockRowEnd)块行，图像边缘不满4x4的块重复边缘像素
+	inline void compressBlockRows(const uint8_t* pixels, uint32_t width, uint32_t height, Format format, uint8_t* out,
+		uint32_t blockRowBegin, uint32_t blockRowEnd) {
+		uint32_t blocksX = (width + 3) / 4;
+		uint32_t bytes = blockBytes(format);
+		uint8_t block[64];
+		for (uint32_t by = blockRowBegin; by < blockRowEnd; ++by) {
+			for (uint32_t bx = 0; bx < blocksX; ++bx) {
+				for (uint32_t y = 0; y < 4; ++y) {
+					uint32_t sy = std::min(by * 4 + y, height - 1);
+					for (uint32_t x = 0; x < 4; ++x) {
+						uint32_t sx = std::min(bx * 4 + x, width - 1);
+						memcpy(block + 4 * (4 * y + x), pixels + (size_t(sy) * width + sx) * 4, 4);
+					}
+				}
+				encodeBlock(format, block, out + (size_t(by) * blocksX + bx) * bytes);
+			}
+		}
+	}
+
+	//压缩按mipgen::levelOffsets布局存放的mipmap链，结果按bcn::levelOffsets布局存放
+	//所有层的块行合在一起按16行分段，jobs不为空时用jobs->parallelFor，否则在当前线程上压缩
+	inline std::vector<uint8_t> compressMipChain(const uint8_t* chain, uint32_t width, uint32_t height, uint32_t levels, Format format,
+		JobSystem* jobs = nullptr) {
+		std::vector<size_t> offsets = levelOffsets(width, height, levels, format);
+		std::vector<uint8_t> compressed(offsets[levels]);
+
+		//(层, 块行)展开成一个序列，按序号切分
+		std::vector<uint32_t> rowStart(levels + 1, 0);
+		std::vector<size_t> sourceOffsets(levels, 0);
+		for (uint32_t i = 0; i < levels; ++i) {
+			uint32_t w = std::max(1u, width >> i), h = std::max(1u, height >> i);
+			rowStart[i + 1] = rowStart[i] + (h + 3) / 4;
+			if (i + 1 < levels) {
+				sourceOffsets[i + 1] = sourceOffsets[i] + size_t(w) * h * 4;
+			}
+		}
+		auto work = [&](uint32_t begin, uint32_t end) {
+			for (uint32_t level = 0; level < levels; ++level) {
+				uint32_t first = std::max(begin, rowStart[level]), last = std::min(end, rowStart[level + 1]);
+				if (first < last) {
+					compressBlockRows(chain + sourceOffsets[level], std::max(1u, width >> level), std::max(1u, height >> level), format,
+						compressed.data() + offsets[level], first - rowStart[level], last - rowStart[level]);
+				}
+			}
+		};
+		uint32_t totalRows = rowStart[levels];
+		if (jobs) {
+			jobs->parallelFor(totalRows, 16, [&](size_t begin, size_t end) {
+				work(static_cast<uint32_t>(begin), static_cast<uint32_t>(end));
+			});
+		} else {
+			work(0, totalRows);
+		}
+		return compressed;
+	}
+
+	//解压一层图像到RGBA8，用于验证编码结果
+	inline bool decompressImage(const uint8_t* blocks, uint32_t width, uint32_t height, Format format, uint8_t* pixels) {
+		uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		uint8_t block[64];
+		for (uint32_t by = 0; by < blocksY; ++by) {
+			for (uint32_t bx = 0; bx < blocksX; ++bx) {
+				if (!decodeBlock(format, blocks + (size_t(by) * blocksX + bx) * blockBytes(format), block)) {
+					return false;
+				}
+				for (uint32_t y = 0; y < 4 && by * 4 + y < height; ++y) {
+					for (uint32_t x = 0; x < 4 && bx * 4 + x < width; ++x) {
+						memcpy(pixels + (size_t(by * 4 + y) * width + bx * 4 + x) * 4, block + 4 * (4 * y + x), 4);
+					}
+				}
+			}
+		}
+		return true;
+	}
+}
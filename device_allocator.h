@@ -0,0 +1,359 @@
+﻿#pragma once
+//device memory子分配器: 每种内存类型按块(默认64MB)调用vkAllocateMemory，块内用buddy算法分配，
+//避免每个资源一次vkAllocateMemory(驱动的分配次数有maxMemoryAllocationCount限制，而且分配本身很慢)
+//线性资源(buffer)和非线性资源(optimal tiling的image)放在不同的块中，不需要处理bufferImageGranularity
+//host visible的块在创建时整体映射一次，DeviceAllocation::mapped直接给出资源对应的地址
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+struct DeviceAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;	//绑定资源时使用的偏移
+	VkDeviceSize size = 0;		//资源需要的大小
+	void* mapped = nullptr;		//host visible内存映射后的地址，已经加上了offset
+	uint32_t pool = UINT32_MAX;	//UINT32_MAX表示独立分配(dedicated)
+	uint32_t block = 0;
+	uint32_t level = 0;			//buddy层级，块大小 >> level 就是实际占用的大小
+	uint32_t memoryType = 0;
+};
+
+class DeviceAllocator {
+public:
+	struct Stats {
+		uint32_t blockCount = 0;		//子分配使用的块数量
+		uint32_t dedicatedCount = 0;	//独立分配的数量
+		uint32_t allocationCount = 0;	//存活的分配数量(包括独立分配)
+		VkDeviceSize bytesAllocated = 0;	//向驱动申请的内存总量
+		VkDeviceSize bytesInUse = 0;		//资源实际需要的内存总量
+		VkDeviceSize bytesReserved = 0;		//buddy分配向上取整到2的幂之后占用的总量，减去bytesInUse就是内部碎片
+		VkDeviceSize bytesFree = 0;			//块中空闲的内存
+		//外部碎片: 1 - 各块最大空闲区间之和 / 空闲内存总量，0表示每个块的空闲内存都是连续的
+		double fragmentation = 0.0;
+	};
+
+	static constexpr VkDeviceSize minAllocationSize = 256;
+
+	void init(VkPhysicalDevice phyDevice, VkDevice device, VkDeviceSize preferredBlockSize = 64ull << 20) {
+		this->device = device;
+		vkGetPhysicalDeviceMemoryProperties(phyDevice, &memProperties);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(phyDevice, &properties);
+		nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+		this->preferredBlockSize = floorPow2(preferredBlockSize);
+	}
+
+	//memoryTypeIndex由findMemoryType选出，linear表示buffer或者linear tiling的image
+	//dedicated为true时不做子分配，大于半个块的请求也总是独立分配
+	DeviceAllocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool linear, bool dedicated = false) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Pool& pool = getPool(memoryTypeIndex, linear);
+		if (dedicated || requirements.size > pool.blockSize / 2 || requirements.alignment > pool.blockSize) {
+			return allocateDedicated(requirements, memoryTypeIndex);
+		}
+
+		//buddy分配的偏移天然按照自身大小对齐，所以只要大小不小于alignment就满足对齐要求
+		VkDeviceSize size = ceilPow2(std::max({ requirements.size, requirements.alignment, minAllocationSize }));
+		uint32_t level = levelOf(pool, size);
+		uint32_t poolIndex = static_cast<uint32_t>(&pool - pools.data());
+		for (uint32_t b = 0; b < pool.blocks.size(); ++b) {
+			VkDeviceSize offset;
+			if (pool.blocks[b].memory != VK_NULL_HANDLE && takeFree(pool, pool.blocks[b], level, offset)) {
+				return makeAllocation(pool, poolIndex, b, level, offset, requirements.size);
+			}
+		}
+		uint32_t b = createBlock(pool);
+		VkDeviceSize offset;
+		takeFree(pool, pool.blocks[b], level, offset);
+		return makeAllocation(pool, poolIndex, b, level, offset, requirements.size);
+	}
+
+	bool isHostCoherent(uint32_t memoryType) const {
+		return (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+	}
+
+	//CPU读取GPU写入的non-coherent内存之前需要invalidate，coherent内存不需要任何操作
+	//范围要按nonCoherentAtomSize对齐: 子分配的偏移按buddy大小(至少256，不小于atom)对齐，向上取整后也不会超出自己的区间；
+	//独立分配直接invalidate整个VkDeviceMemory
+	void invalidate(const DeviceAllocation& allocation) const {
+		if (allocation.mapped == nullptr || isHostCoherent(allocation.memoryType)) {
+			return;
+		}
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = allocation.memory;
+		if (allocation.pool == UINT32_MAX) {
+			range.offset = 0;
+			range.size = VK_WHOLE_SIZE;
+		} else {
+			range.offset = allocation.offset;
+			range.size = (allocation.size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+		}
+		if (vkInvalidateMappedMemoryRanges(device, 1, &range) != VK_SUCCESS) {
+			throw std::runtime_error("failed to invalidate mapped memory");
+		}
+	}
+
+	void free(DeviceAllocation& allocation) {
+		if (allocation.memory == VK_NULL_HANDLE) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (allocation.pool == UINT32_MAX) {
+			//独立分配的内存随vkFreeMemory自动解除映射
+			vkFreeMemory(device, allocation.memory, nullptr);
+			dedicatedCount--;
+			dedicatedBytes -= allocation.size;
+			allocation = DeviceAllocation{};
+			return;
+		}
+
+		Pool& pool = pools[allocation.pool];
+		Block& block = pool.blocks[allocation.block];
+		VkDeviceSize offset = allocation.offset;
+		uint32_t level = allocation.level;
+		block.bytesInUse -= allocation.size;
+		block.bytesReserved -= pool.blockSize >> level;
+		block.allocationCount--;
+		//与伙伴合并: 大小为size的区间，伙伴的偏移是offset ^ size
+		while (level > 0) {
+			VkDeviceSize buddy = offset ^ (pool.blockSize >> level);
+			auto it = block.freeLists[level].find(buddy);
+			if (it == block.freeLists[level].end()) {
+				break;
+			}
+			block.freeLists[level].erase(it);
+			offset = std::min(offset, buddy);
+			level--;
+		}
+		block.freeLists[level].insert(offset);
+
+		//整块空闲时归还给驱动，但每种内存类型保留一个块，避免反复分配释放
+		if (block.allocationCount == 0 && liveBlocks(pool) > 1) {
+			destroyBlock(block);
+		}
+		allocation = DeviceAllocation{};
+	}
+
+	Stats stats() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats s;
+		VkDeviceSize largestFreeSum = 0;
+		for (const Pool& pool : pools) {
+			for (const Block& block : pool.blocks) {
+				if (block.memory == VK_NULL_HANDLE) {
+					continue;
+				}
+				s.blockCount++;
+				s.allocationCount += block.allocationCount;
+				s.bytesAllocated += pool.blockSize;
+				s.bytesInUse += block.bytesInUse;
+				s.bytesReserved += block.bytesReserved;
+				s.bytesFree += pool.blockSize - block.bytesReserved;
+				for (uint32_t level = 0; level < block.freeLists.size(); ++level) {
+					if (!block.freeLists[level].empty()) {
+						largestFreeSum += pool.blockSize >> level;
+						break;
+					}
+				}
+			}
+		}
+		s.dedicatedCount = dedicatedCount;
+		s.allocationCount += dedicatedCount;
+		s.bytesAllocated += dedicatedBytes;
+		s.bytesInUse += dedicatedBytes;
+		s.bytesReserved += dedicatedBytes;
+		s.fragmentation = s.bytesFree == 0 ? 0.0 : 1.0 - double(largestFreeSum) / double(s.bytesFree);
+		return s;
+	}
+
+	//销毁所有块，调用前所有资源都要已经销毁
+	void destroy() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Pool& pool : pools) {
+			for (Block& block : pool.blocks) {
+				if (block.memory != VK_NULL_HANDLE) {
+					destroyBlock(block);
+				}
+			}
+		}
+		pools.clear();
+	}
+
+private:
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = nullptr;
+		std::vector<std::unordered_set<VkDeviceSize>> freeLists;	//每个buddy层级空闲区间的偏移
+		VkDeviceSize bytesInUse = 0;
+		VkDeviceSize bytesReserved = 0;
+		uint32_t allocationCount = 0;
+	};
+
+	struct Pool {
+		uint32_t memoryType = 0;
+		bool linear = false;
+		VkDeviceSize blockSize = 0;
+		uint32_t levelCount = 0;
+		std::vector<Block> blocks;
+	};
+
+	static VkDeviceSize floorPow2(VkDeviceSize v) {
+		VkDeviceSize p = 1;
+		while (p <= v / 2) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	static VkDeviceSize ceilPow2(VkDeviceSize v) {
+		VkDeviceSize p = 1;
+		while (p < v) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	static uint32_t levelOf(const Pool& pool, VkDeviceSize size) {
+		uint32_t level = 0;
+		while ((pool.blockSize >> (level + 1)) >= size && level + 1 < pool.levelCount) {
+			level++;
+		}
+		return level;
+	}
+
+	bool isHostVisible(uint32_t memoryType) const {
+		return (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	Pool& getPool(uint32_t memoryType, bool linear) {
+		for (Pool& pool : pools) {
+			if (pool.memoryType == memoryType && pool.linear == linear) {
+				return pool;
+			}
+		}
+		//小的堆(例如256MB的BAR内存)使用更小的块，避免一个块占掉堆的一大部分
+		VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryType].heapIndex].size;
+		Pool pool;
+		pool.memoryType = memoryType;
+		pool.linear = linear;
+		pool.blockSize = std::max(std::min(preferredBlockSize, floorPow2(heapSize / 8)), minAllocationSize);
+		while ((pool.blockSize >> pool.levelCount) >= minAllocationSize) {
+			pool.levelCount++;
+		}
+		pools.push_back(pool);
+		return pools.back();
+	}
+
+	uint32_t liveBlocks(const Pool& pool) const {
+		uint32_t count = 0;
+		for (const Block& block : pool.blocks) {
+			count += block.memory != VK_NULL_HANDLE;
+		}
+		return count;
+	}
+
+	uint32_t createBlock(Pool& pool) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = pool.blockSize;
+		allocInfo.memoryTypeIndex = pool.memoryType;
+		Block block;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate device memory block");
+		}
+		if (isHostVisible(pool.memoryType) && vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS) {
+			vkFreeMemory(device, block.memory, nullptr);
+			throw std::runtime_error("failed to map device memory block");
+		}
+		block.freeLists.resize(pool.levelCount);
+		block.freeLists[0].insert(0);
+		//重复使用已经释放的块的位置，保证已有分配中的block索引不变
+		for (uint32_t b = 0; b < pool.blocks.size(); ++b) {
+			if (pool.blocks[b].memory == VK_NULL_HANDLE) {
+				pool.blocks[b] = std::move(block);
+				return b;
+			}
+		}
+		pool.blocks.push_back(std::move(block));
+		return static_cast<uint32_t>(pool.blocks.size() - 1);
+	}
+
+	void destroyBlock(Block& block) {
+		//vkFreeMemory会隐式解除映射
+		vkFreeMemory(device, block.memory, nullptr);
+		block = Block{};
+	}
+
+	//在level层取一个空闲区间，没有时从更大的区间拆分
+	bool takeFree(const Pool& pool, Block& block, uint32_t level, VkDeviceSize& offset) {
+		uint32_t from = level + 1;
+		while (from > 0 && block.freeLists[from - 1].empty()) {
+			from--;
+		}
+		if (from == 0) {
+			return false;
+		}
+		from--;
+		offset = *block.freeLists[from].begin();
+		block.freeLists[from].erase(block.freeLists[from].begin());
+		//拆分时保留前半部分，后半部分放入下一层的空闲列表
+		while (from < level) {
+			from++;
+			block.freeLists[from].insert(offset + (pool.blockSize >> from));
+		}
+		return true;
+	}
+
+	DeviceAllocation makeAllocation(const Pool& pool, uint32_t poolIndex, uint32_t b, uint32_t level, VkDeviceSize offset, VkDeviceSize size) {
+		Block& block = pools[poolIndex].blocks[b];
+		block.bytesInUse += size;
+		block.bytesReserved += pool.blockSize >> level;
+		block.allocationCount++;
+		DeviceAllocation allocation;
+		allocation.memory = block.memory;
+		allocation.offset = offset;
+		allocation.size = size;
+		allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+		allocation.pool = poolIndex;
+		allocation.block = b;
+		allocation.level = level;
+		allocation.memoryType = pool.memoryType;
+		return allocation;
+	}
+
+	DeviceAllocation allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = requirements.size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+		DeviceAllocation allocation;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &allocation.memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate dedicated device memory");
+		}
+		if (isHostVisible(memoryTypeIndex) && vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped) != VK_SUCCESS) {
+			vkFreeMemory(device, allocation.memory, nullptr);
+			throw std::runtime_error("failed to map dedicated device memory");
+		}
+		allocation.size = requirements.size;
+		allocation.memoryType = memoryTypeIndex;
+		dedicatedCount++;
+		dedicatedBytes += requirements.size;
+		return allocation;
+	}
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memProperties{};
+	VkDeviceSize preferredBlockSize = 64ull << 20;
+	VkDeviceSize nonCoherentAtomSize = 1;
+	std::vector<Pool> pools;
+	uint32_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,101 @@
+﻿#pragma once
+//缓存文件共用的工具: 内容hash和原子写入(先写临时文件再重命名)
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <fstream>
+#include <filesystem>
+#include <initializer_list>
+
+namespace fileutil {
+
+	//64位FNV-1a，每次处理8个字节，只用来判断文件内容是否改变，不是加密hash
+	inline uint64_t hashBytes(const void* data, size_t size) {
+		const uint64_t prime = 0x100000001b3ull;
+		uint64_t h = 0xcbf29ce484222325ull;
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		size_t n = size / 8;
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t word;
+			memcpy(&word, p + i * 8, 8);
+			h = (h ^ word) * prime;
+		}
+		for (size_t i = n * 8; i < size; ++i) {
+			h = (h ^ p[i]) * prime;
+		}
+		return (h ^ size) * prime;
+	}
+
+	//要写入的一段连续数据
+	struct WriteChunk {
+		const void* data;
+		size_t size;
+	};
+
+	//分多次写入的原子文件: 数据写到path.tmp，commit成功后重命名为path，程序在写入过程中退出时不会留下写了一半的文件
+	//任何一次写入失败、commit失败或者没有commit就析构时删除临时文件，已有的path保持不变
+	class AtomicFileWriter {
+	public:
+		explicit AtomicFileWriter(std::string path)
+			: path(std::move(path)), tmpPath(this->path + ".tmp"), file(tmpPath, std::ios::binary | std::ios::trunc) {}
+		AtomicFileWriter(const AtomicFileWriter&) = delete;
+		AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+		~AtomicFileWriter() {
+			if (!committed) {
+				file.close();
+				std::error_code ec;
+				std::filesystem::remove(tmpPath, ec);
+			}
+		}
+
+		//失败之后的写入都被忽略，commit返回false
+		bool write(const void* data, size_t size) {
+			file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+			return file.good();
+		}
+
+		//写到文件的offset处，用于分区域交替写入或者最后回填头，offset超过当前末尾时中间补0
+		bool writeAt(uint64_t offset, const void* data, size_t size) {
+			file.seekp(static_cast<std::streamoff>(offset));
+			return write(data, size);
+		}
+
+		bool good() const {
+			return file.good();
+		}
+
+		bool commit() {
+			if (committed) {
+				return true;
+			}
+			file.flush();
+			bool written = file.good();
+			file.close();
+			if (!written || file.fail()) {
+				return false;
+			}
+			std::error_code ec;
+			std::filesystem::rename(tmpPath, path, ec);
+			committed = !ec;
+			return committed;
+		}
+
+	private:
+		std::string path;
+		std::string tmpPath;
+		std::ofstream file;
+		bool committed = false;
+	};
+
+	//按顺序把chunks写到path.tmp，成功后重命名为path
+	inline bool atomicWriteFile(const std::string& path, std::initializer_list<WriteChunk> chunks) {
+		AtomicFileWriter writer(path);
+		for (const WriteChunk& chunk : chunks) {
+			writer.write(chunk.data, chunk.size);
+		}
+		return writer.commit();
+	}
+}
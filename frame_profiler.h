@@ -0,0 +1,270 @@
+﻿#pragma once
+//帧性能分析: CPU作用域计时、GPU时间戳查询、滚动的p50/p95/p99统计，以及Chrome trace event格式的导出(chrome://tracing或ui.perfetto.dev打开)
+//GPU时间戳每个并行帧一个query pool，记录指令时写入，等待这一帧的fence之后读取结果，不会让CPU等待GPU
+//GPU和CPU的时钟没有校准，导出时假设GPU最早在提交之后开始执行，用所有帧中(提交时间 - GPU开始时间)的最大值把GPU事件对齐到CPU时间线上
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace profiler {
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	//最近capacity个样本的环形缓冲，percentile在副本上用nth_element求值
+	class RollingStats {
+	public:
+		explicit RollingStats(size_t capacity = 1024) : samples(capacity) {}
+
+		void add(double value) {
+			samples[next] = value;
+			next = (next + 1) % samples.size();
+			count = std::min(count + 1, samples.size());
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		//p在[0, 1]之间，取最近的样本(nearest rank)，没有样本时返回0
+		double percentile(double p) const {
+			if (count == 0) {
+				return 0;
+			}
+			std::vector<double> sorted(samples.begin(), samples.begin() + count);
+			size_t rank = std::min(count - 1, static_cast<size_t>(p * count));
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			return sorted[rank];
+		}
+
+	private:
+		std::vector<double> samples;
+		size_t next = 0;
+		size_t count = 0;
+	};
+
+	//一个完整的事件(Chrome trace的"X"事件)，时间以微秒为单位
+	struct TraceEvent {
+		const char* name;		//必须是字符串常量，事件只保存指针
+		uint32_t thread;		//CPU线程的编号，GPU事件使用GPU_THREAD
+		double startUs;
+		double durationUs;
+	};
+
+	const uint32_t GPU_THREAD = 1000;
+
+	//收集事件并写出trace文件，可以在多个线程上同时记录
+	class Trace {
+	public:
+		explicit Trace(Clock::time_point origin = Clock::now(), size_t maxEvents = 1 << 20) : origin(origin), maxEvents(maxEvents) {}
+
+		void setOrigin(Clock::time_point time) {
+			origin = time;
+		}
+
+		double toUs(Clock::time_point time) const {
+			return std::chrono::duration<double, std::micro>(time - origin).count();
+		}
+
+		//超过maxEvents之后丢弃，避免长时间运行时无限增长
+		void addCpu(const char* name, Clock::time_point start, Clock::time_point end) {
+			TraceEvent event{ name, threadId(), toUs(start), std::chrono::duration<double, std::micro>(end - start).count() };
+			std::lock_guard<std::mutex> lock(mutex);
+			if (events.size() < maxEvents) {
+				events.push_back(event);
+			}
+		}
+
+		//startUs是GPU时钟上的时间，submitUs是这一帧提交时的CPU时间，用来估计两个时钟的偏移
+		void addGpu(const char* name, double startUs, double durationUs, double submitUs) {
+			std::lock_guard<std::mutex> lock(mutex);
+			gpuOffsetUs = std::max(gpuOffsetUs, submitUs - startUs);
+			if (events.size() < maxEvents) {
+				events.push_back({ name, GPU_THREAD, startUs, durationUs });
+			}
+		}
+
+		bool write(const std::string& path) {
+			std::lock_guard<std::mutex> lock(mutex);
+			std::ofstream file(path, std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+			file.precision(3);
+			file << std::fixed;
+			for (auto&& event : events) {
+				double startUs = event.thread == GPU_THREAD ? event.startUs + gpuOffsetUs : event.startUs;
+				file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+					<< ",\"ts\":" << startUs << ",\"dur\":" << event.durationUs << "}";
+			}
+			file << "\n]}\n";
+			return file.good();
+		}
+
+	private:
+		//每个线程第一次记录时分配一个小的编号，trace查看器中按编号分行
+		static uint32_t threadId() {
+			static std::atomic<uint32_t> nextId{ 0 };
+			static thread_local uint32_t id = nextId++;
+			return id;
+		}
+
+		Clock::time_point origin;
+		size_t maxEvents;
+		std::mutex mutex;
+		std::vector<TraceEvent> events;
+		double gpuOffsetUs = -std::numeric_limits<double>::infinity();
+	};
+
+	//作用域计时，析构时把事件加入trace；trace为空时不记录
+	class CpuScope {
+	public:
+		CpuScope(Trace* trace, const char* name) : trace(trace), name(name), start(Clock::now()) {}
+		~CpuScope() {
+			if (trace) {
+				trace->addCpu(name, start, Clock::now());
+			}
+		}
+		CpuScope(const CpuScope&) = delete;
+		CpuScope& operator=(const CpuScope&) = delete;
+
+	private:
+		Trace* trace;
+		const char* name;
+		Clock::time_point start;
+	};
+
+	//GPU时间戳: 每个并行帧一个query pool，每个区域使用一对查询
+	class GpuTimestamps {
+	public:
+		static const uint32_t MAX_REGIONS = 16;
+
+		//队列族的timestampValidBits为0时不支持时间戳，之后的调用都不做任何事
+		void init(VkDevice device, VkPhysicalDevice phyDevice, uint32_t queueFamily, uint32_t framesInFlight) {
+			this->device = device;
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(phyDevice, &properties);
+			uint32_t familyCount = 0;
+			vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &familyCount, nullptr);
+			std::vector<VkQueueFamilyProperties> families(familyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &familyCount, families.data());
+			uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+			if (validBits == 0 || properties.limits.timestampPeriod <= 0.f) {
+				return;
+			}
+			validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+			periodNs = properties.limits.timestampPeriod;
+
+			frames.resize(framesInFlight);
+			for (auto&& frame : frames) {
+				VkQueryPoolCreateInfo createInfo{};
+				createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				createInfo.queryCount = MAX_REGIONS * 2;
+				if (vkCreateQueryPool(device, &createInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create timestamp query pool");
+				}
+			}
+		}
+
+		bool supported() const {
+			return !frames.empty();
+		}
+
+		//在指令缓冲开头、render pass之外调用，重置这一帧的查询
+		void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+			if (!supported()) {
+				return;
+			}
+			vkCmdResetQueryPool(commandBuffer, frames[frame].pool, 0, MAX_REGIONS * 2);
+			frames[frame].regionCount = 0;
+		}
+
+		//返回区域的编号，超过MAX_REGIONS时返回UINT32_MAX，end时忽略
+		uint32_t beginRegion(VkCommandBuffer commandBuffer, uint32_t frame, const char* name) {
+			if (!supported() || frames[frame].regionCount == MAX_REGIONS) {
+				return UINT32_MAX;
+			}
+			Frame& data = frames[frame];
+			uint32_t region = data.regionCount++;
+			data.names[region] = name;
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, data.pool, region * 2);
+			return region;
+		}
+
+		void endRegion(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t region) {
+			if (region == UINT32_MAX) {
+				return;
+			}
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[frame].pool, region * 2 + 1);
+		}
+
+		//提交之后调用，记录提交的CPU时间，之后resolve才会读取这一帧的结果
+		void submitted(uint32_t frame, double submitUs) {
+			if (supported()) {
+				frames[frame].pending = true;
+				frames[frame].submitUs = submitUs;
+			}
+		}
+
+		//这一帧的fence已经发出信号之后调用，读取上次提交的结果，对每个区域调用fn(name, startUs, durationUs, submitUs)
+		template<typename Fn>
+		void resolve(uint32_t frame, Fn&& fn) {
+			if (!supported() || !frames[frame].pending) {
+				return;
+			}
+			Frame& data = frames[frame];
+			data.pending = false;
+			if (data.regionCount == 0) {
+				return;
+			}
+			std::array<uint64_t, MAX_REGIONS * 2> ticks{};
+			VkResult result = vkGetQueryPoolResults(device, data.pool, 0, data.regionCount * 2, sizeof(uint64_t) * data.regionCount * 2,
+				ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+			if (result != VK_SUCCESS) {
+				return;
+			}
+			for (uint32_t region = 0; region < data.regionCount; ++region) {
+				uint64_t begin = ticks[region * 2] & validMask;
+				uint64_t end = ticks[region * 2 + 1] & validMask;
+				uint64_t elapsed = (end - begin) & validMask;	//计数器回绕时按有效位数取模
+				double startUs = double(begin) * periodNs / 1000.0;
+				fn(data.names[region], startUs, double(elapsed) * periodNs / 1000.0, data.submitUs);
+			}
+		}
+
+		void destroy() {
+			for (auto&& frame : frames) {
+				vkDestroyQueryPool(device, frame.pool, nullptr);
+			}
+			frames.clear();
+		}
+
+	private:
+		struct Frame {
+			VkQueryPool pool = VK_NULL_HANDLE;
+			uint32_t regionCount = 0;
+			std::array<const char*, MAX_REGIONS> names{};
+			bool pending = false;		//已经提交，结果还没有读取
+			double submitUs = 0;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		std::vector<Frame> frames;
+		uint64_t validMask = 0;
+		float periodNs = 1.f;		//一个时间戳计数对应的纳秒数，VkPhysicalDeviceLimits::timestampPeriod
+	};
+
+}
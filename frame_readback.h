@@ -0,0 +1,35 @@
+﻿#pragma once
+//无窗口渲染时读回的帧写成文件: 二进制PPM(P6)，没有压缩，不需要额外的库，常见的图像工具都能打开，CI中也容易逐字节比较
+//读回缓冲是紧密排列的4字节像素，BGRA(交换链优先选择的格式)或者RGBA，写出时去掉alpha并转换成RGB
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace readback {
+
+	//pixels有width * height个4字节像素，bgra为true时每个像素是B, G, R, A
+	inline void toRgb(const uint8_t* pixels, uint32_t width, uint32_t height, bool bgra, uint8_t* rgb) {
+		size_t count = size_t(width) * height;
+		int r = bgra ? 2 : 0, b = bgra ? 0 : 2;
+		for (size_t i = 0; i < count; ++i) {
+			rgb[i * 3 + 0] = pixels[i * 4 + r];
+			rgb[i * 3 + 1] = pixels[i * 4 + 1];
+			rgb[i * 3 + 2] = pixels[i * 4 + b];
+		}
+	}
+
+	inline bool writePpm(const std::string& path, const uint8_t* pixels, uint32_t width, uint32_t height, bool bgra) {
+		std::vector<uint8_t> rgb(size_t(width) * height * 3);
+		toRgb(pixels, width, height, bgra, rgb.data());
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			return false;
+		}
+		file << "P6\n" << width << " " << height << "\n255\n";
+		file.write(reinterpret_cast<const char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+		return file.good();
+	}
+
+}
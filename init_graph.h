@@ -0,0 +1,138 @@
+﻿#pragma once
+//初始化的依赖图: 每个阶段声明它依赖哪些阶段，只使用CPU的阶段(解析模型、读取文件等)作为任务在调度器上执行，与设备创建等阶段并行
+//Main阶段按加入的顺序在调用run的线程上执行，执行之前等待它的依赖；glfw和记录上传指令等不能并行的操作都放在Main阶段
+//Any阶段只能依赖Any阶段，它们不依赖设备，所以总是可以在run开始时全部提交
+//每个阶段记录开始、结束的时间和执行它的线程，printTimeline输出启动时间线
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+#include "job_system.h"
+
+class InitGraph {
+public:
+	using Clock = std::chrono::high_resolution_clock;
+	using StageId = size_t;
+
+	enum class Thread {
+		Main,	//调用run的线程
+		Any,	//调度器的任意线程
+	};
+
+	//origin是时间线的零点，一般是程序开始的时间
+	explicit InitGraph(Clock::time_point origin) : origin(origin) {}
+
+	StageId add(std::string name, Thread thread, std::vector<StageId> dependencies, std::function<void()> fn) {
+		StageId id = stages.size();
+		for (StageId dependency : dependencies) {
+			if (dependency >= id) {
+				throw std::runtime_error("init stage " + name + " depends on a stage added after it");
+			}
+			if (thread == Thread::Any && stages[dependency].thread == Thread::Main) {
+				throw std::runtime_error("init stage " + name + " runs on a worker but depends on main thread stage " + stages[dependency].name);
+			}
+		}
+		Stage stage;
+		stage.name = std::move(name);
+		stage.thread = thread;
+		stage.dependencies = std::move(dependencies);
+		stage.fn = std::move(fn);
+		stages.push_back(std::move(stage));
+		return id;
+	}
+
+	//执行所有阶段，任何一个阶段抛出的异常在等待它的地方重新抛出
+	void run(JobSystem& jobs) {
+		for (auto&& stage : stages) {
+			if (stage.thread == Thread::Any) {
+				std::vector<JobSystem::JobHandle> dependencies;
+				for (StageId dependency : stage.dependencies) {
+					dependencies.push_back(stages[dependency].job);
+				}
+				stage.job = jobs.submit([this, &jobs, &stage] { execute(jobs, stage); }, dependencies);
+			}
+		}
+		try {
+			for (auto&& stage : stages) {
+				if (stage.thread == Thread::Main) {
+					for (StageId dependency : stage.dependencies) {
+						jobs.wait(stages[dependency].job);
+					}
+					execute(jobs, stage);
+				}
+			}
+		} catch (...) {
+			//任务引用着图中的阶段，抛出之前等待它们全部结束，它们自己的异常忽略
+			for (auto&& stage : stages) {
+				try {
+					jobs.wait(stage.job);
+				} catch (...) {
+				}
+			}
+			throw;
+		}
+		//没有被Main阶段依赖的Any阶段也要在返回之前完成
+		for (auto&& stage : stages) {
+			jobs.wait(stage.job);
+		}
+	}
+
+	//按开始时间输出每个阶段，最后是初始化结束的时间和所有阶段时间之和(串行执行时需要的时间)
+	void printTimeline(std::ostream& out) const {
+		std::vector<const Stage*> order;
+		for (auto&& stage : stages) {
+			order.push_back(&stage);
+		}
+		std::sort(order.begin(), order.end(), [](const Stage* a, const Stage* b) { return a->start < b->start; });
+
+		double serialMs = 0, endMs = 0;
+		out << "startup timeline (ms since start):" << std::endl;
+		for (const Stage* stage : order) {
+			double startMs = toMs(stage->start), stageEndMs = toMs(stage->end);
+			serialMs += stageEndMs - startMs;
+			endMs = std::max(endMs, stageEndMs);
+			out << "  " << std::fixed << std::setprecision(1) << std::setw(8) << startMs << " " << std::setw(8) << stageEndMs
+				<< "  " << std::setw(7) << stageEndMs - startMs << "  "
+				<< (stage->worker <= 0 ? std::string("main    ") : "worker " + std::to_string(stage->worker)) << "  " << stage->name << std::endl;
+		}
+		out << "  init finished at " << endMs << " ms, stages sum to " << serialMs << " ms" << std::defaultfloat << std::setprecision(6) << std::endl;
+	}
+
+private:
+	struct Stage {
+		std::string name;
+		Thread thread;
+		std::vector<StageId> dependencies;
+		std::function<void()> fn;
+		JobSystem::JobHandle job;	//Any阶段提交后的任务，Main阶段为空
+		Clock::time_point start;
+		Clock::time_point end;
+		int worker = 0;
+	};
+
+	void execute(const JobSystem& jobs, Stage& stage) {
+		stage.worker = jobs.workerIndex();
+		stage.start = Clock::now();
+		try {
+			stage.fn();
+		} catch (...) {
+			stage.end = Clock::now();
+			throw;
+		}
+		stage.end = Clock::now();
+	}
+
+	double toMs(Clock::time_point time) const {
+		return std::chrono::duration<double, std::milli>(time - origin).count();
+	}
+
+	Clock::time_point origin;
+	std::vector<Stage> stages;
+};
@@ -0,0 +1,313 @@
+﻿#pragma once
+//工作窃取的任务调度器: 每个线程一个双端队列，线程从自己队列的尾部取任务(后进先出，缓存更热)，自己的队列为空时从其他线程队列的头部窃取
+//任务可以依赖其他任务，所有依赖完成后才放入队列；依赖的任务抛出异常时，后续任务不再执行，直接带着同一个异常完成
+//调用start的线程是0号线程，wait和parallelFor等待时也会执行队列中的任务；其他外部线程也可以提交和等待，但等待时只阻塞，不执行任务
+//workerIndex()在任务中返回当前线程的编号(0..size()-1)，可以用来索引线程私有的资源(例如vulkan指令池)
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <algorithm>
+#include <initializer_list>
+
+class JobSystem {
+	struct Job;
+public:
+	//提交任务后得到的句柄，用来等待或者作为其他任务的依赖；空句柄表示已经完成
+	using JobHandle = std::shared_ptr<Job>;
+
+	JobSystem() = default;
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+	~JobSystem() {
+		stop();
+	}
+
+	//threadCount包括调用者的线程，为0时使用所有硬件线程
+	void start(uint32_t threadCount = 0) {
+		if (!workers.empty()) {
+			return;
+		}
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		stopping = false;
+		queues = std::vector<Queue>(threadCount);
+		current() = { this, 0 };
+		for (uint32_t i = 1; i < threadCount; ++i) {
+			workers.emplace_back(&JobSystem::workerLoop, this, i);
+		}
+	}
+
+	//执行完队列中的所有任务后结束工作线程
+	//工作线程在队列为空时退出，之后剩下的任务(只有一个线程时是全部任务)由调用者作为0号线程执行
+	void stop() {
+		if (queues.empty()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		workAvailable.notify_all();
+		for (auto&& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+
+		ThreadSlot previous = current();
+		current() = { this, 0 };
+		while (runOne(0)) {
+		}
+		current() = previous;
+	}
+
+	//可以同时执行任务的线程数
+	uint32_t size() const {
+		return static_cast<uint32_t>(queues.size());
+	}
+
+	//当前线程的编号，不属于这个调度器的线程返回-1
+	int workerIndex() const {
+		return currentIndex();
+	}
+
+	//dependencies全部完成之后执行fn
+	JobHandle submit(std::function<void()> fn, std::initializer_list<JobHandle> dependencies = {}) {
+		return submit(std::move(fn), dependencies.begin(), dependencies.size());
+	}
+
+	JobHandle submit(std::function<void()> fn, const std::vector<JobHandle>& dependencies) {
+		return submit(std::move(fn), dependencies.data(), dependencies.size());
+	}
+
+	//等待任务完成，任务抛出的异常在这里重新抛出
+	void wait(const JobHandle& job) {
+		if (!job) {
+			return;
+		}
+		waitUntil([&] { return job->done.load(); });
+		if (job->error) {
+			std::rethrow_exception(job->error);
+		}
+	}
+
+	//等待condition()为true，和wait一样在等待时执行队列中的任务；每个任务结束后重新检查
+	//condition依赖的状态只能由任务改变，并且condition中不能提交任务
+	template<typename Condition>
+	void waitUntil(Condition condition) {
+		bool canHelp = currentIndex() >= 0;
+		while (!condition()) {
+			if (canHelp && runOne(currentIndex())) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			++waiters;
+			jobFinished.wait(lock, [&] { return condition() || (canHelp && queued.load() > 0); });
+			--waiters;
+		}
+	}
+
+	//把[0, count)按grain分段，每段调用一次fn(begin, end)，返回时全部完成；第一段在调用者的线程上执行
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+		if (count == 0) {
+			return;
+		}
+		grain = std::max<size_t>(1, grain);
+		size_t chunks = (count + grain - 1) / grain;
+		bool inlineFirst = currentIndex() >= 0;
+		std::vector<JobHandle> jobs;
+		jobs.reserve(chunks);
+		for (size_t chunk = inlineFirst ? 1 : 0; chunk < chunks; ++chunk) {
+			size_t begin = chunk * grain;
+			size_t end = std::min(count, begin + grain);
+			jobs.push_back(submit([&fn, begin, end] { fn(begin, end); }));
+		}
+		std::exception_ptr error;
+		if (inlineFirst) {
+			try {
+				fn(0, std::min(count, grain));
+			} catch (...) {
+				error = std::current_exception();
+			}
+		}
+		//所有段结束之前不能返回，fn和调用者的局部变量还在被使用
+		for (auto&& job : jobs) {
+			try {
+				wait(job);
+			} catch (...) {
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	struct Job {
+		std::function<void()> fn;
+		std::atomic<uint32_t> pending{ 1 };		//还没有完成的依赖数，加上提交过程本身的1
+		std::atomic<bool> done{ false };
+		std::exception_ptr error;				//fn或者依赖抛出的异常，执行之前由mutex保护，done之后才能由其他线程读
+		std::mutex mutex;
+		std::vector<JobHandle> continuations;	//依赖这个任务的任务
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<JobHandle> jobs;
+	};
+
+	//线程所属的调度器和编号，一个线程可以先后属于不同的调度器，编号只对owner有效
+	struct ThreadSlot {
+		const JobSystem* owner;
+		int index;
+	};
+
+	static ThreadSlot& current() {
+		static thread_local ThreadSlot slot = { nullptr, -1 };
+		return slot;
+	}
+
+	int currentIndex() const {
+		const ThreadSlot& slot = current();
+		return slot.owner == this ? slot.index : -1;
+	}
+
+	JobHandle submit(std::function<void()> fn, const JobHandle* dependencies, size_t dependencyCount) {
+		JobHandle job = std::make_shared<Job>();
+		job->fn = std::move(fn);
+		for (size_t i = 0; i < dependencyCount; ++i) {
+			const JobHandle& dependency = dependencies[i];
+			if (!dependency) {
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(dependency->mutex);
+			if (dependency->done.load()) {
+				inheritError(*job, dependency->error);
+			} else {
+				job->pending.fetch_add(1);
+				dependency->continuations.push_back(job);
+			}
+		}
+		release(job);
+		return job;
+	}
+
+	//依赖失败时任务不再执行，多个依赖可能同时完成，所以需要加锁
+	static void inheritError(Job& job, const std::exception_ptr& error) {
+		if (error) {
+			std::lock_guard<std::mutex> lock(job.mutex);
+			if (!job.error) {
+				job.error = error;
+			}
+		}
+	}
+
+	//一个依赖完成(或者提交结束)，计数归零时放入当前线程的队列，外部线程放入0号队列
+	void release(const JobHandle& job) {
+		if (job->pending.fetch_sub(1) != 1) {
+			return;
+		}
+		int index = std::max(0, currentIndex());
+		{
+			std::lock_guard<std::mutex> lock(queues[index].mutex);
+			queues[index].jobs.push_back(job);
+		}
+		queued.fetch_add(1);
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		workAvailable.notify_one();
+		if (waiters.load() > 0) {
+			jobFinished.notify_all();
+		}
+	}
+
+	//先从自己的队列尾部取，再从其他队列的头部窃取
+	bool runOne(int index) {
+		JobHandle job;
+		{
+			std::lock_guard<std::mutex> lock(queues[index].mutex);
+			if (!queues[index].jobs.empty()) {
+				job = std::move(queues[index].jobs.back());
+				queues[index].jobs.pop_back();
+			}
+		}
+		for (size_t i = 1; !job && i < queues.size(); ++i) {
+			Queue& victim = queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+			}
+		}
+		if (!job) {
+			return false;
+		}
+		queued.fetch_sub(1);
+		execute(job);
+		return true;
+	}
+
+	void execute(const JobHandle& job) {
+		if (!job->error) {
+			try {
+				job->fn();
+			} catch (...) {
+				job->error = std::current_exception();
+			}
+		}
+		job->fn = nullptr;
+
+		std::vector<JobHandle> continuations;
+		{
+			std::lock_guard<std::mutex> lock(job->mutex);
+			job->done.store(true);
+			continuations.swap(job->continuations);
+		}
+		for (auto&& continuation : continuations) {
+			inheritError(*continuation, job->error);
+			release(continuation);
+		}
+		if (waiters.load() > 0) {
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+			jobFinished.notify_all();
+		}
+	}
+
+	void workerLoop(uint32_t index) {
+		current() = { this, static_cast<int>(index) };
+		while (true) {
+			if (runOne(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			workAvailable.wait(lock, [this] { return stopping || queued.load() > 0; });
+			if (stopping && queued.load() == 0) {
+				return;
+			}
+		}
+	}
+
+	std::vector<Queue> queues;			//每个线程一个，0号属于调用start的线程
+	std::vector<std::thread> workers;
+	std::atomic<int64_t> queued{ 0 };	//所有队列中的任务数
+	std::atomic<int> waiters{ 0 };		//在wait中阻塞的线程数
+	std::mutex sleepMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable jobFinished;
+	bool stopping = false;
+};
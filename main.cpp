@@ -11,8 +11,12 @@
 #include <array>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <fstream>
 #include <chrono>
+#include <deque>
+#include <algorithm>
+#include <filesystem>
 
 #define STB_IMAGE_IMPLEMENTATION //stb_image.h默认只定义的了函数的原型，此定义将实现包含进来
 #include "stb_image.h"
@@ -25,15 +29,90 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "mapped_file.h"
+#include "file_util.h"
+#include "mesh_cache.h"
+#include "obj_parallel.h"
+#include "obj_stream.h"
+#include "mesh_optimizer.h"
+#include "vertex_packing.h"
+#include "device_allocator.h"
+#include "staging_ring.h"
+#include "object_cache.h"
+#include "pipeline_cache.h"
+#include "mipmap.h"
+#include "block_compress.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
+#include "job_system.h"
+#include "init_graph.h"
+#include "frame_profiler.h"
+#include "frame_readback.h"
+
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 const std::string shaderRootDir = "D:/VulkanTutorial/code/shaders";
 const std::string textureRootDir = "D:/VulkanTutorial/code/textures";
 const std::string modelRootDir = "D:/VulkanTutorial/code/models";
+//VkPipelineCache的数据，启动时读取，退出时写回
+const std::string pipelineCachePath = shaderRootDir + "/graphics.pipecache";
+//不小于这个大小的obj不在内存中构建完整的网格，而是边解析边通过staging buffer分块上传
+const uint64_t modelStreamingThreshold = 512ull << 20;
+//流式上传时每一块的三角形角点(索引)数量，块内焊接之后的顶点数量不会超过它，焊接用的哈希表也不会更大
+const uint32_t streamingBlockVertices = 1 << 16;
+//不小于这个大小的图像使用独立的vkAllocateMemory，不从allocator的块中子分配
+const VkDeviceSize dedicatedImageSize = 16ull << 20;
+//上传使用的staging环形缓冲的大小，更大的上传会被拆分成多次拷贝
+const VkDeviceSize stagingRingSize = 32ull << 20;
+//环形缓冲中每次预留的对齐，满足vkCmdCopyBufferToImage对bufferOffset的要求(4字节以及texel大小的倍数)
+const VkDeviceSize stagingAlignment = 16;
+
+//上传到GPU的顶点格式
+enum class VertexLayout {
+	Float,			//Vertex，32字节
+	Packed,			//PackedVertex的位置和纹理坐标，12字节
+	PackedNormal,	//PackedVertex，额外带有八面体编码的法线，16字节
+};
+//压缩格式使用shaders/packed_vert.spv和packed_normal_vert.spv，修改shader_packed.vert之后按该文件开头的命令重新编译
+const VertexLayout vertexLayout = VertexLayout::Float;
+
+//纹理使用的块压缩格式，设备不支持(没有textureCompressionBC特性或者格式不能采样)时退回不压缩的RGBA8
+enum class TextureCompression {
+	None,	//R8G8B8A8，32bpp
+	BC1,	//不透明RGB，4bpp
+	BC3,	//RGB + 插值alpha，8bpp
+	BC7,	//RGBA，8bpp，质量最好
+};
+const TextureCompression textureCompression = TextureCompression::BC7;
 
 
 const int MAX_FRAMES_IN_FLIGHT = 3; //三帧并行渲染
 
+//窗口大小改变的压力测试: 不为0时在进入主循环之前连续改变窗口大小这么多次，
+//分别测量每次都重建render pass和管线(之前的做法)与只重建尺寸相关对象时，每次重建交换链的平均停顿
+const uint32_t resizeStormCount = 0;
+
+//记录绘制指令的线程数: 1为在主线程上直接记录到主指令缓冲，大于1时把绘制列表分成这么多段，在任务调度器上并行记录到辅助指令缓冲，0为调度器的线程数
+const uint32_t recordThreadCount = 1;
+//模型的索引拆分成多少次绘制调用，模拟有很多物体的场景，画面不变
+const uint32_t drawCallCount = 1;
+//记录指令的压力测试: 不为0时在进入主循环之前，对每种绘制调用数和线程数的组合画这么多帧，输出每帧记录指令的平均时间
+const uint32_t recordBenchmarkFrames = 0;
+
+//帧统计: 每隔这么多帧输出最近1024帧的帧时间、CPU时间和GPU时间的p50/p95/p99，0为不输出
+const uint32_t frameStatsInterval = 600;
+//不为空时记录每一帧的CPU作用域和GPU时间戳，程序结束时写成Chrome trace文件(chrome://tracing或ui.perfetto.dev打开)
+const std::string frameTracePath = "";
+
+//无窗口模式: 不创建窗口、surface和交换链，渲染到离屏图像并通过host visible的缓冲读回，用于CI和服务器端渲染
+//不要求独立显卡，可以在lavapipe(llvmpipe)这样的CPU实现上运行
+const bool headless = false;
+//无窗口模式渲染的帧数，结束时输出吞吐量和最后一帧像素的hash；动画按每帧1/60秒推进，同一个设备上的输出是确定的
+const uint32_t headlessFrameCount = 300;
+//不为空时把读回的帧写成PPM文件，每隔headlessWriteInterval帧写一次，最后一帧总是写出
+const std::string headlessOutputDir = "";
+const uint32_t headlessWriteInterval = 60;
+
 
 #if NDEBUG
 const bool enableValidationLayers = false;	
@@ -102,9 +181,13 @@ bool checkDeviceExtentionSupport(VkPhysicalDevice phyDevice) {
 //获取创建实例需要的扩展名称，以及数量，包括glfw库的窗口交互扩展，和VK debug扩展
 std::vector<const char*> getRequeiredExtetions() {
 	//接下来，我们需要指定需要的全局扩展。之前提到，vulkan是平台无关的，所以需要一个和窗口系统交互的扩展。glfw库包含了一个可以返回这一扩展的函数，我们可以直接使用它
-	uint32_t glfwCount = 0;
-	const char** glfwExtentions = glfwGetRequiredInstanceExtensions(&glfwCount);
-	std::vector<const char*> exts(glfwExtentions, glfwExtentions + glfwCount);
+	std::vector<const char*> exts;
+	//无窗口模式不创建surface，不需要窗口系统的扩展，也不需要初始化glfw
+	if (!headless) {
+		uint32_t glfwCount = 0;
+		const char** glfwExtentions = glfwGetRequiredInstanceExtensions(&glfwCount);
+		exts.assign(glfwExtentions, glfwExtentions + glfwCount);
+	}
 	
 	//仅仅启用校验层并没有任何用处，我们不能得到任何有用的调试信息。为了获得调试信息，我们需要使用"VK_EXT_debug_utils"扩展，设置回调函数来接受调试信息。
 	if (enableValidationLayers) {
@@ -126,14 +209,30 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	return VK_FALSE; //回调函数返回了一个布尔值，用来表示引发校验层处理的Vulkan API用是否被中断。
 }
 
+//一次vkCmdDrawIndexed绘制的索引范围
+struct DrawRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
 
 
 
 
 class HelloTriangleApplication {
 public:
+	//textureLoader的任务在jobs上执行，初始化中途抛出异常时jobs先析构，所以在成员析构之前停止加载服务
+	~HelloTriangleApplication() {
+		textureLoader.stop();
+	}
+
 	void run() {
-		initWindow();
+		appStartTime = std::chrono::high_resolution_clock::now();
+		frameTrace.setOrigin(appStartTime);
+		//所有线程共用的任务调度器，调用start的主线程是0号线程
+		jobs.start();
+
+		//窗口在初始化的依赖图中创建
 		initVulkan();
 		mainLoop();
 		cleanup();
@@ -145,11 +244,21 @@ private:
 	struct QueueFamilyInices {
 		int graphicsFamily = -1;
 		int presentFamily = -1; //保设备可以在我创建的surface上显示图像
+		int transferFamily = -1; //上传使用的队列族，没有独立的传输队列族时与graphicsFamily相同
 		bool isComplete() {
 			return graphicsFamily >= 0 && presentFamily >= 0;
 		}
 	};
 
+	//上传批次提交后得到的token，用来查询或者等待这个批次(以及之前的批次)完成
+	using UploadToken = uint64_t;
+
+	//等待转移所有权的图像，转移覆盖所有mip层
+	struct UploadImage {
+		VkImage image;
+		uint32_t mipLevels;
+	};
+
 	struct SwapChainSupportDetails {
 		VkSurfaceCapabilitiesKHR capbilities;
 		std::vector<VkSurfaceFormatKHR> formats;
@@ -197,12 +306,79 @@ private:
 			return attributeDescriptions;
 		}
 	};
+
+	//压缩的顶点格式，见vertex_packing.h。OBJ模型不会填充Vertex::color，这里不再保留颜色
+	//location 0: 位置 R16G16B16A16_UNORM(第4个分量不使用，三分量的16位格式很少支持作为顶点格式)，由UniformBufferObjcet::dequantize还原
+	//location 1: 法线 R16G16_SNORM，八面体编码，只在PackedNormal时存在
+	//location 2: 纹理坐标 R16G16_SFLOAT
+	struct PackedVertex {
+		uint16_t position[4];
+		uint16_t texCoord[2];
+		int16_t normal[2];
+
+		//不带法线时顶点在normal之前结束
+		static uint32_t stride(bool withNormal) {
+			return withNormal ? sizeof(PackedVertex) : offsetof(PackedVertex, normal);
+		}
+
+		static VkVertexInputBindingDescription getBindingDescription(bool withNormal) {
+			VkVertexInputBindingDescription bindingDescription{};
+			bindingDescription.binding = 0;
+			bindingDescription.stride = stride(withNormal);
+			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+			return bindingDescription;
+		}
+
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool withNormal) {
+			std::vector<VkVertexInputAttributeDescription> attributeDescriptions(withNormal ? 3 : 2);
+			attributeDescriptions[0].binding = 0;
+			attributeDescriptions[0].location = 0;
+			attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+			attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+
+			attributeDescriptions[1].binding = 0;
+			attributeDescriptions[1].location = 2;
+			attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+			attributeDescriptions[1].offset = offsetof(PackedVertex, texCoord);
+
+			if (withNormal) {
+				attributeDescriptions[2].binding = 0;
+				attributeDescriptions[2].location = 1;
+				attributeDescriptions[2].format = VK_FORMAT_R16G16_SNORM;
+				attributeDescriptions[2].offset = offsetof(PackedVertex, normal);
+			}
+			return attributeDescriptions;
+		}
+	};
+	static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay tightly packed");
 	
 
+	//obj中一个面顶点由 (顶点, 纹理坐标, 法线) 三个索引确定，用它作为顶点去重的key
+	struct ObjIndexKey {
+		int vertexIndex;
+		int texcoordIndex;
+		int normalIndex;
+
+		bool operator==(const ObjIndexKey& other) const {
+			return vertexIndex == other.vertexIndex && texcoordIndex == other.texcoordIndex && normalIndex == other.normalIndex;
+		}
+	};
+
+	struct ObjIndexKeyHash {
+		size_t operator()(const ObjIndexKey& key) const {
+			size_t h = std::hash<int>()(key.vertexIndex);
+			h ^= std::hash<int>()(key.texcoordIndex) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<int>()(key.normalIndex) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
 	struct UniformBufferObjcet {	
 		glm::mat4 model;
 		glm::mat4 view;
 		glm::mat4 projection;
+		//压缩顶点格式的反量化矩阵，把[0, 1]的位置还原到模型空间，使用Vertex时为单位矩阵
+		glm::mat4 dequantize;
 	};
 	
 	static void frameBufferResizeCallback(GLFWwindow* window, int width, int height) {
@@ -221,15 +397,73 @@ private:
 		glfwSetWindowUserPointer(window, this); //可以通过window获取到this指针
 	}
 
+	//顶点格式只由obj文件大小决定，stat一下文件就够了，读取shader不必等整个模型加载完
+	void chooseVertexLayout() {
+		std::error_code ec;
+		uint64_t size = std::filesystem::file_size(modelRootDir + "/viking_room.obj", ec);
+		//超大模型流式上传，只支持Float格式；文件不存在时由loadModel报错
+		if (!ec && size >= modelStreamingThreshold) {
+			activeVertexLayout = VertexLayout::Float;
+		}
+	}
+
 	void loadModel() {
 		std::string modelPath = modelRootDir + "/viking_room.obj";
+		std::string cachePath = modelPath + ".meshcache";
+
+		//用源文件内容的hash判断缓存是否有效，hash一遍文件远比解析文本快
+		uint64_t sourceHash = 0, sourceSize = 0;
+		{
+			MappedFile objFile;
+			if (!objFile.open(modelPath)) {
+				throw std::runtime_error("failed to open model: " + modelPath);
+			}
+			sourceHash = fileutil::hashBytes(objFile.data(), objFile.size());
+			sourceSize = objFile.size();
+		}
+
+		//热启动: 缓存有效时直接使用映射内存中的顶点和索引，不再解析obj
+		//流式加载的缓存只在块内焊接和重排，模型小于流式加载的阈值时重新完整解析
+		meshcache::MeshCacheView cacheView;
+		if (meshCacheFile.open(cachePath) && meshcache::read(meshCacheFile, sourceHash, sourceSize, sizeof(Vertex), cacheView)
+			&& !((cacheView.flags & meshcache::FLAG_STREAMED) && sourceSize < modelStreamingThreshold)) {
+			vertices.clear();
+			vertexIndices.clear();
+			mesh.vertices = static_cast<const Vertex*>(cacheView.vertices);
+			mesh.vertexCount = cacheView.vertexCount;
+			mesh.indices = cacheView.indices;
+			mesh.indexCount = cacheView.indexCount;
+			std::cout << "load model: " << mesh.indexCount << " indices, " << mesh.vertexCount << " vertices from mesh cache" << std::endl;
+			return;
+		}
+		meshCacheFile.close();
 
+		//超大模型: 完整解析需要attrib_t、vertices和staging三份拷贝，改为在设备创建之后流式上传，同时写网格缓存
+		//第一遍(v/vt写入临时文件，统计角点数量)在这里与设备创建并行，第二遍在streamModel中边解析边上传
+		vertices.clear();
+		vertexIndices.clear();
+		if (sourceSize >= modelStreamingThreshold) {
+			streamingAttributes = std::make_unique<objstream::AttributeSpill>(modelPath);
+			std::ifstream file(modelPath, std::ios::binary);
+			std::vector<char> fileBuffer(1 << 20);
+			file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+			std::string err;
+			if (!file.is_open() || !streamingAttributes->write(file, &err)) {
+				throw std::runtime_error("failed to read model " + modelPath + ": " + err);
+			}
+			streamingModelPath = modelPath;
+			streamingSourceHash = sourceHash;
+			streamingSourceSize = sourceSize;
+			std::cout << "load model: " << sourceSize << " bytes, " << streamingAttributes->cornerCount() << " triangle corners, streaming to GPU after device creation" << std::endl;
+			return;
+		}
 
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> matrials;
 		std::string err;
-		if (!tinyobj::LoadObj(&attrib, &shapes, &matrials, &err, modelPath.c_str())) {
+		//在调度器上并行解析，结果与tinyobj::LoadObj相同
+		if (!parallelobj::loadObj(&attrib, &shapes, &matrials, &err, modelPath.c_str(), nullptr, true, &jobs)) {
 			throw std::runtime_error(err);
 		}
 
@@ -240,97 +474,233 @@ private:
 			vertices[i].texCoord = { attrib.texcoords[i * 2], attrib.texcoords[i * 2 + 1] };
 			vertices[i].color = { 1.f, 0.f, 0.f };
 		}*/
-		
-		vertices.clear();
-		vertexIndices.clear();
+
+		//顶点焊接: obj中的同一个(v, vt, vn)三元组在多个面中重复出现，只为每个唯一的三元组生成一个Vertex，索引缓冲才真正起作用
+		size_t indexCount = 0;
+		for (auto&& shape : shapes) {
+			indexCount += shape.mesh.indices.size();
+		}
+		std::unordered_map<ObjIndexKey, uint32_t, ObjIndexKeyHash> uniqueVertices;
+		uniqueVertices.reserve(indexCount);
+		vertexIndices.reserve(indexCount);
+
 		for (auto&& shape : shapes) {
 			for (auto&& index : shape.mesh.indices) {
-				Vertex vertex{};
-				vertex.position = { attrib.vertices[3 * index.vertex_index], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2] };
-				vertex.texCoord = { attrib.texcoords[2 * index.texcoord_index], 1- attrib.texcoords[2 * index.texcoord_index + 1] };
-				vertices.emplace_back(vertex);
-				vertexIndices.emplace_back(vertices.size() - 1);
+				ObjIndexKey key{ index.vertex_index, index.texcoord_index, index.normal_index };
+				auto it = uniqueVertices.find(key);
+				if (it == uniqueVertices.end()) {
+					Vertex vertex{};
+					vertex.position = { attrib.vertices[3 * index.vertex_index], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2] };
+					vertex.texCoord = { attrib.texcoords[2 * index.texcoord_index], 1- attrib.texcoords[2 * index.texcoord_index + 1] };
+					it = uniqueVertices.emplace(key, static_cast<uint32_t>(vertices.size())).first;
+					vertices.emplace_back(vertex);
+				}
+				vertexIndices.emplace_back(it->second);
 			}
 		}
+
+		std::cout << "load model: " << vertexIndices.size() << " indices, " << vertices.size() << " unique vertices, "
+			<< (indexCount - vertices.size()) << " duplicate vertices removed" << std::endl;
+
+		optimizeMesh();
+
+		mesh.vertices = vertices.data();
+		mesh.vertexCount = static_cast<uint32_t>(vertices.size());
+		mesh.indices = vertexIndices.data();
+		mesh.indexCount = static_cast<uint32_t>(vertexIndices.size());
+
+		//写缓存失败不影响本次运行，只是下次启动还需要解析obj
+		if (!meshcache::write(cachePath, sourceHash, sourceSize, sizeof(Vertex), mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount)) {
+			std::cerr << "failed to write mesh cache: " << cachePath << std::endl;
+		}
 	}
 
 
+	//重排三角形和顶点: 顶点缓存 -> overdraw -> 顶点读取，优化后的结果会一起写入网格缓存
+	void optimizeMesh() {
+		if (vertexIndices.empty()) {
+			return;
+		}
+		size_t vertexCount = vertices.size();
+		meshopt::CacheStats before = meshopt::simulateVertexCache(vertexIndices.data(), vertexIndices.size(), vertexCount);
+
+		std::vector<uint32_t> cacheOptimized(vertexIndices.size());
+		std::vector<uint32_t> clusters;
+		meshopt::optimizeVertexCache(cacheOptimized.data(), vertexIndices.data(), vertexIndices.size(), vertexCount, 16, &clusters);
+		meshopt::optimizeOverdraw(vertexIndices.data(), cacheOptimized.data(), cacheOptimized.size(), &vertices[0].position.x, sizeof(Vertex), vertexCount, clusters);
+
+		std::vector<Vertex> fetchOptimized(vertexCount);
+		fetchOptimized.resize(meshopt::optimizeVertexFetch(fetchOptimized.data(), vertexIndices.data(), vertexIndices.size(), vertices.data(), vertexCount));
+		vertices.swap(fetchOptimized);
+
+		meshopt::CacheStats after = meshopt::simulateVertexCache(vertexIndices.data(), vertexIndices.size(), vertices.size());
+		std::cout << "optimize mesh: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+			<< " (simulated 16 entry FIFO cache), " << clusters.size() << " clusters" << std::endl;
+	}
+
+	//初始化分为多个阶段，按依赖关系组成一个图: 只使用CPU的阶段(解析模型、读取shader、压缩顶点)在调度器上与窗口、实例和设备的创建并行
+	//其余阶段按顺序在主线程上执行，glfw需要在主线程上调用，上传指令也只能在一个线程上记录
 	void initVulkan() {
+		using Thread = InitGraph::Thread;
+		InitGraph graph(appStartTime);
 
-		//加载模型`
-		loadModel();
+		//决定顶点格式，只stat模型文件
+		auto layout = graph.add("choose vertex layout", Thread::Any, {}, [this] { chooseVertexLayout(); });
 
-		//创建VkInstance
-		createInstance();
+		//加载模型，不需要vulkan设备
+		auto model = graph.add("load model", Thread::Any, { layout }, [this] { loadModel(); });
 
-		//设置校验层的debug回调函数
-		setupDebugCallback();
+		//读取shader，顶点shader由顶点格式决定，不需要等模型解析
+		auto shaders = graph.add("read shaders", Thread::Any, { layout }, [this] { loadShaders(); });
 
-		//创建窗口surface，surface具体指什么？
-		createWindowSurface();
+		//压缩顶点，只依赖模型
+		auto packing = graph.add("pack vertices", Thread::Any, { model }, [this] {
+			if (streamingModelPath.empty() && activeVertexLayout != VertexLayout::Float) {
+				packedVertices = packVertices(activeVertexLayout == VertexLayout::PackedNormal);
+			}
+		});
 
-		//选择物理设备
-		pickPhysicalDevice();
+		//创建窗口
+		if (!headless) {
+			graph.add("create window", Thread::Main, {}, [this] { initWindow(); });
+		}
 
-		//创建逻辑设备
-		createLogicalDevice();
+		graph.add("create instance", Thread::Main, {}, [this] {
+			//创建VkInstance
+			createInstance();
 
-		//创建交换链
-		createSwapChain();
+			//设置校验层的debug回调函数
+			setupDebugCallback();
 
-		//创建swap chain image view对象
-		createSwapChainImageViews();
+			//创建窗口surface，surface具体指什么？
+			if (!headless) {
+				createWindowSurface();
+			}
+		});
 
-		//创建render pass 对象
-		createRenderPass();
+		graph.add("create device", Thread::Main, {}, [this] {
+			//选择物理设备
+			pickPhysicalDevice();
 
-		////创建descriptor
-		createDescriptorSetLayout();
+			//创建逻辑设备
+			createLogicalDevice();
 
-		//创建渲染图形管线
-		createGraphicsPipeline();
+			//创建设备内存分配器，之后所有buffer和image的内存都从它的块中子分配
+			allocator.init(phyDevice, logiDevice);
 
-		//创建command pool
-		createCommandPool();
+			//采样器和image view按create info共享，相同参数的对象只创建一次
+			samplerCache.init(logiDevice);
+			imageViewCache.init(logiDevice);
+		});
 
-		//创建深度监测相关对象
-		createDepthResources();
-		
-		//为交换链中的所有图像创建帧缓冲
-		createFramebuffers();
+		//从磁盘读取管线cache，之后所有管线的创建都使用它
+		graph.add("load pipeline cache", Thread::Main, {}, [this] { createPipelineCache(); });
 
-		//创建图像缓冲
-		createTextureImage();
+		//纹理的格式确定之后就开始在工作线程上加载，与交换链、管线等对象的创建并行
+		graph.add("start texture loads", Thread::Main, {}, [this] { startTextureLoads(); });
 
+		graph.add("create swapchain", Thread::Main, {}, [this] {
+			//创建交换链，无窗口模式创建离屏图像代替交换链图像
+			if (headless) {
+				createOffscreenTargets();
+			} else {
+				createSwapChain();
+			}
 
-		//创建textureImageview
-		createTextureImageView();
+			//创建swap chain image view对象
+			createSwapChainImageViews();
 
-		//创建采样器对象
-		createTextureSampler();
+			//创建render pass 对象
+			createRenderPass();
 
+			////创建descriptor
+			createDescriptorSetLayout();
+		});
 
-		//创建顶点缓冲
-		createVertexBuffer();
+		//创建渲染图形管线，顶点格式在读取shader之前已经决定
+		graph.add("create pipeline", Thread::Main, { shaders }, [this] { createGraphicsPipeline(); });
 
-		//创建顶点索引缓冲
-		createIndexBuffer();
+		graph.add("create frame resources", Thread::Main, {}, [this] {
+			//创建command pool
+			createCommandPool();
 
-		//创建uniform 缓冲
-		createUniformBuffers();
-		
-		////创建descriptor pool用来分配decriptor sets
-		createDescriptorPool();
+			//创建上传数据使用的staging环形缓冲
+			createStagingRing();
 
-		//创建descriptor set对象
-		createDescriptorSets();
+			//创建深度监测相关对象
+			createDepthResources();
 
-		//分配指令缓冲对象，使用它记录绘制指令
-		createCommandBuffers();
-		
-		//创建信号量和fence对象
-		createSyncObjects();
+			//为交换链中的所有图像创建帧缓冲
+			createFramebuffers();
+		});
+
+		graph.add("upload textures", Thread::Main, {}, [this] {
+			//创建图像缓冲
+			createTextureImage();
+
+			//创建textureImageview
+			createTextureImageView();
+
+			//创建采样器对象
+			createTextureSampler();
+		});
+
+		graph.add("upload model", Thread::Main, { model, packing }, [this] {
+			if (!streamingModelPath.empty()) {
+				//边解析边上传，同时创建顶点缓冲和索引缓冲
+				streamModel(streamingModelPath);
+			} else {
+				//创建顶点缓冲
+				if (activeVertexLayout == VertexLayout::Float) {
+					createVertexBuffer(mesh.vertices, sizeof(Vertex) * VkDeviceSize(mesh.vertexCount));
+				} else {
+					createVertexBuffer(packedVertices.data(), packedVertices.size());
+					std::vector<uint8_t>().swap(packedVertices);
+				}
+
+				//创建顶点索引缓冲
+				createIndexBuffer(mesh.indices, mesh.indexCount);
+			}
+		});
+
+		graph.add("create descriptors", Thread::Main, {}, [this] {
+			//创建uniform 缓冲
+			createUniformBuffers();
 
+			////创建descriptor pool用来分配decriptor sets
+			createDescriptorPool();
+
+			//创建descriptor set对象
+			createDescriptorSets();
+
+			//分配指令缓冲对象，使用它记录绘制指令
+			createCommandBuffers();
+
+			//创建信号量和fence对象
+			createSyncObjects();
+
+			//GPU时间戳的query pool，每个并行帧一个
+			gpuTimestamps.init(logiDevice, phyDevice, indices.graphicsFamily, MAX_FRAMES_IN_FLIGHT);
+		});
+
+		graph.add("flush uploads", Thread::Main, {}, [this] {
+			//提交初始化过程中记录的上传，第一帧的绘制指令在它们之后提交
+			UploadToken initUploads = flushUploads();
+			std::cout << "init uploads: " << initUploads << " batches" << std::endl;
+		});
+
+		graph.run(jobs);
+		graph.printTimeline(std::cout);
+
+		printAllocatorStats();
+	}
+
+	void printAllocatorStats() {
+		DeviceAllocator::Stats stats = allocator.stats();
+		std::cout << "device memory: " << stats.allocationCount << " allocations in " << stats.blockCount << " blocks + "
+			<< stats.dedicatedCount << " dedicated, " << (stats.bytesInUse >> 10) << " KB in use / " << (stats.bytesAllocated >> 10)
+			<< " KB allocated, internal waste " << ((stats.bytesReserved - stats.bytesInUse) >> 10) << " KB, fragmentation "
+			<< stats.fragmentation << std::endl;
 	}
 
 	void createInstance() {
@@ -416,6 +786,10 @@ private:
 		indices = findQueueFamilies(phyDevice);
 		if (!indices.isComplete())
 			return false;
+		//无窗口模式不需要交换链，任何有图形队列的设备都可以，包括lavapipe这样的CPU实现
+		if (headless) {
+			return true;
+		}
 		//物理设备是否支持一定的扩展，例如swap chain
 		if (!checkDeviceExtentionSupport(phyDevice)) {
 			return false;
@@ -454,16 +828,42 @@ private:
 		//获取到的支持两种功能的队列族可以相同也可以不相同，一下逻辑查找的是支持两种功能的队列族，可以显式地指定绘制和呈现队列族是同一个的物理设备来提高性能表现
 		for (int i = 0, n = queueFamilies.size(); i < n; ++i) {
 
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(phyDevice, i, surface, &presentSupport);
+			//无窗口模式没有surface，不需要呈现
+			VkBool32 presentSupport = headless;
+			if (!headless) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(phyDevice, i, surface, &presentSupport);
+			}
 			//物理设备的队列族必须支持在surface上进行显示，并且支持图形绘制指令
 			if (presentSupport && queueFamilies[i].queueCount > 0 && queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-				return QueueFamilyInices{ i, i };
+				QueueFamilyInices result;
+				result.graphicsFamily = i;
+				result.presentFamily = i;
+				result.transferFamily = findTransferFamily(queueFamilies, i);
+				return result;
 			}
 		}
 		return {};
 	}
 
+	//上传使用的队列族: 优先选择只支持传输的队列族(通常对应独立的DMA引擎)，其次是不支持图形的计算队列族(计算队列隐式支持传输)，
+	//都没有时(例如lavapipe只有一个队列族)使用图形队列族
+	int findTransferFamily(const std::vector<VkQueueFamilyProperties>& queueFamilies, int graphicsFamily) {
+		int transferFamily = graphicsFamily;
+		int bestScore = 0;
+		for (int i = 0, n = queueFamilies.size(); i < n; ++i) {
+			VkQueueFlags flags = queueFamilies[i].queueFlags;
+			if (queueFamilies[i].queueCount == 0 || flags & VK_QUEUE_GRAPHICS_BIT || !(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				continue;
+			}
+			int score = flags & VK_QUEUE_COMPUTE_BIT ? 1 : 2;
+			if (score > bestScore) {
+				bestScore = score;
+				transferFamily = i;
+			}
+		}
+		return transferFamily;
+	}
+
 	void pickPhysicalDevice() {
 		//使用VkPhysicalDevice对象来存储我们选择使用的显卡信息。这一对象可以在VkInstance进行清除操作时，自动清除自己，所以我们不需要再cleanup函数中对它进行清除。
 		phyDevice = VK_NULL_HANDLE;
@@ -475,6 +875,14 @@ private:
 		}
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+		//无窗口模式接受任何类型的设备，有独立显卡时优先使用
+		if (headless) {
+			std::stable_partition(devices.begin(), devices.end(), [](VkPhysicalDevice device) {
+				VkPhysicalDeviceProperties properties;
+				vkGetPhysicalDeviceProperties(device, &properties);
+				return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+			});
+		}
 
 		for (auto&& device : devices) {
 			if (isDeviceSuitable(device)) {
@@ -486,6 +894,9 @@ private:
 		if (phyDevice == VK_NULL_HANDLE) {
 			throw std::runtime_error("failed to find suitable GPU");
 		}
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(phyDevice, &properties);
+		std::cout << "device: " << properties.deviceName << std::endl;
 
 
 	}
@@ -495,7 +906,7 @@ private:
 		//VkDeviceQueueCreateInfo描述了针对一个队列族我们所需的队列数量。
 		float queuePriorities = 1.f;
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::set<int>  uniqueQueueIndices{ indices.graphicsFamily, indices.presentFamily };
+		std::set<int>  uniqueQueueIndices{ indices.graphicsFamily, indices.presentFamily, indices.transferFamily };
 		for (auto index : uniqueQueueIndices) {
 			VkDeviceQueueCreateInfo createInfo{};
 			createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
@@ -509,6 +920,11 @@ private:
 		//接下来，我们要指定应用程序使用的设备特性。
 		VkPhysicalDeviceFeatures phyDeviceFeatures{};
 		phyDeviceFeatures.samplerAnisotropy = VK_TRUE;
+		//BC压缩纹理是可选特性，支持时才开启
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(phyDevice, &supportedFeatures);
+		phyDeviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
 		//创建逻辑设备，扩展和全局校验和 VKInstance创建相同
 		VkDeviceCreateInfo deviceCreateInfo{};
 		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -517,8 +933,8 @@ private:
 		deviceCreateInfo.pEnabledFeatures = &phyDeviceFeatures;
 		//设置扩展
 		//TODO暂时不需要其他，只需要校验层即可
-		//添加swap chain 扩展
-		deviceCreateInfo.enabledExtensionCount = deviceExtentions.size();
+		//添加swap chain 扩展，无窗口模式不需要
+		deviceCreateInfo.enabledExtensionCount = headless ? 0 : deviceExtentions.size();
 		deviceCreateInfo.ppEnabledExtensionNames = deviceExtentions.data();
 
 		//全局校验层,们可以对设备和扖扵扬扫扡扮实例使用相同地校验层，不需要额外的扩展支持, 一维validation layer support在创建VKInstance时已经检查过了，当前不需要再进行检查
@@ -536,6 +952,24 @@ private:
 		//创建logiDevice时指定的队列也会被创建，这个函数取到队列的句柄 (logiDevice, 队列族, 队列索引, 返回值)
 		vkGetDeviceQueue(logiDevice, indices.graphicsFamily, 0, &graphicsQueue);
 		vkGetDeviceQueue(logiDevice, indices.presentFamily, 0, &presentQueue);
+		vkGetDeviceQueue(logiDevice, indices.transferFamily, 0, &transferQueue);
+
+		//独立的传输队列可能要求图像拷贝的偏移和大小是某个粒度的倍数，分块上传图像时需要遵守
+		uint32_t queueFamilyCount;
+		vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &queueFamilyCount, queueFamilies.data());
+		transferGranularity = queueFamilies[indices.transferFamily].minImageTransferGranularity;
+		if (dedicatedTransfer()) {
+			std::cout << "upload queue: dedicated transfer family " << indices.transferFamily << std::endl;
+		} else {
+			std::cout << "upload queue: graphics family " << indices.graphicsFamily << std::endl;
+		}
+	}
+
+	//上传是否在独立的传输队列族上执行，是的话资源需要在队列族之间转移所有权
+	bool dedicatedTransfer() const {
+		return indices.transferFamily != indices.graphicsFamily;
 	}
 
 	////创建窗口surface
@@ -669,6 +1103,30 @@ private:
 		vkGetSwapchainImagesKHR(logiDevice, swapChain, &realSwapImageCount, swapChainImages.data());
 	}
 
+	//无窗口模式代替交换链: 每个并行帧一张离屏颜色图像和一个读回缓冲，图像的格式与交换链优先选择的相同
+	//之后的image view、render pass、管线和帧缓冲都与有窗口时一样创建
+	void createOffscreenTargets() {
+		surfaceFormat = { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR }; //B8G8R8A8_UNORM必须支持作为color attachment
+		extent = { WIDTH, HEIGHT };
+		swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+		offscreenImageMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		readbacks.resize(MAX_FRAMES_IN_FLIGHT);
+		VkDeviceSize readbackSize = VkDeviceSize(extent.width) * extent.height * 4;
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			createImage(extent.width, extent.height, 1, surfaceFormat.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImageMemory[i]);
+			//读回缓冲持久映射，拷贝完成(fence发出信号)后CPU直接读取
+			//CPU要读整帧，优先HOST_CACHED: 独显上不带cached的host visible内存是write-combined，CPU读取非常慢
+			//cached类型可能不是coherent的，processReadback读取前会invalidate；没有cached类型时退回coherent内存
+			createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, readbacks[i].buffer, readbacks[i].memory,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+		if (!headlessOutputDir.empty()) {
+			std::error_code ec;
+			std::filesystem::create_directories(headlessOutputDir, ec);
+		}
+	}
+
 	//imageview描述 VkImage 中的哪些部分应该用作图像的哪些方面（例如颜色、深度、模板等），以及如何处理这些部分（例如使用哪种格式、如何进行采样等）
 	void createSwapChainImageViews() {
 		swapChainImageViews.resize(swapChainImages.size());
@@ -677,7 +1135,7 @@ private:
 		}
 	}
 
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT) {
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT, uint32_t mipLevels = 1) {
 		VkImageViewCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		createInfo.image = image;
@@ -695,20 +1153,22 @@ private:
 		createInfo.subresourceRange.baseArrayLayer = 0;
 		createInfo.subresourceRange.layerCount = 1;  //只有一个图层
 		createInfo.subresourceRange.baseMipLevel = 0;
-		createInfo.subresourceRange.levelCount = 1;  //没有细分级别，只有一层mipmap
+		createInfo.subresourceRange.levelCount = mipLevels;  //访问所有的mip层，交换链图像只有一层
 
-		VkImageView imageView{};
-		if (vkCreateImageView(logiDevice, &createInfo, nullptr, &imageView) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create swap chain image views");
-		}
-		return imageView;	
+		//相同的create info返回同一个view，不再使用时调用imageViewCache.release
+		return imageViewCache.acquire(createInfo);
+	}
+
+	//读取管线使用的shader，只访问文件，可以在工作线程上与设备的创建并行；管线重建时继续使用读到的代码
+	void loadShaders() {
+		const char* vertShaderFile = activeVertexLayout == VertexLayout::Float ? "/sampler_vert.spv"
+			: activeVertexLayout == VertexLayout::Packed ? "/packed_vert.spv" : "/packed_normal_vert.spv";
+		vertShaderCode = readFile(shaderRootDir + vertShaderFile);
+		fragShaderCode = readFile(shaderRootDir + "/sampler_frag.spv");
 	}
 
 	//创建渲染管线
 	void createGraphicsPipeline() {
-		auto vertShaderCode = readFile(shaderRootDir + "/sampler_vert.spv");
-		auto fragShaderCode = readFile(shaderRootDir + "/sampler_frag.spv");
-
 		//着色器模块对象试只是对shader 字节码的一个封装，只在管线创建时需要
 		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
 		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -737,7 +1197,15 @@ private:
 		vertInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 		//TODO 绑定顶点数据和顶点属性
 		VkVertexInputBindingDescription bindingDescription = Vertex::getBindingDescription();
-		auto attributeDescription = Vertex::getAttributeDescriptions();
+		std::vector<VkVertexInputAttributeDescription> attributeDescription;
+		if (activeVertexLayout == VertexLayout::Float) {
+			auto floatAttributes = Vertex::getAttributeDescriptions();
+			attributeDescription.assign(floatAttributes.begin(), floatAttributes.end());
+		} else {
+			bool withNormal = activeVertexLayout == VertexLayout::PackedNormal;
+			bindingDescription = PackedVertex::getBindingDescription(withNormal);
+			attributeDescription = PackedVertex::getAttributeDescriptions(withNormal);
+		}
 		vertInputCreateInfo.vertexBindingDescriptionCount = 1;
 		vertInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;	
 		vertInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescription.size());
@@ -755,25 +1223,16 @@ private:
 				会将swapchain中的图像完整的画到frambuffer中指定的区域，那明显就会出现一些拉伸压缩之类的情况，除非指定的viewport和frambuffer和swapchain中的extent大小都相等
 			2. 当画到frambuffer之后(可能已经发生了拉伸或者压缩情况)，然后再scissor选择剪裁出framebuffer的哪一部分
 		*/
-		VkViewport viewport{};
-		viewport.x = 0;
-		viewport.y = 0;
-		viewport.width = extent.width ;
-		viewport.height = extent.height;
-		viewport.minDepth = 0.f;
-		viewport.maxDepth = 1.f;
-		//4. clipp 空间
-		VkRect2D scissor{};
-		scissor.offset = {0, 0};//{ (int32_t)extent.width/2, (int32_t)extent.height/2 };
-		scissor.extent = extent;
+		//4. clipp 空间: viewport和scissor都在createCommandBuffers中按交换链的大小设置
 
 		//5. 视口创建state
 		VkPipelineViewportStateCreateInfo viewportCreateInfo{};
 		viewportCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		//视口和裁剪矩形是动态状态，这里只指定数量，录制指令时由vkCmdSetViewport/vkCmdSetScissor设置，窗口大小改变时不需要重建管线
 		viewportCreateInfo.viewportCount = 1;
-		viewportCreateInfo.pViewports = &viewport;
+		viewportCreateInfo.pViewports = nullptr;
 		viewportCreateInfo.scissorCount = 1;
-		viewportCreateInfo.pScissors = &scissor;
+		viewportCreateInfo.pScissors = nullptr;
 
 		//6. 光栅化state
 		VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{};
@@ -847,7 +1306,7 @@ private:
 		colorBlendCreateInfo.blendConstants[3] = 0.f;
 		//10. 管线的动态状态, 会导致上面设置的状态失效，需要在渲染时重新指定
 		/*只有非常有限的管线状态可以在不重建管线的情况下进行动态修改。这包括视口大小，线宽和混合常量。*/
-		VkDynamicState dynamicState[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_LINE_WIDTH };
+		VkDynamicState dynamicState[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 		VkPipelineDynamicStateCreateInfo dynamicCreateInfo{};
 		dynamicCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 		dynamicCreateInfo.dynamicStateCount = 2;
@@ -879,7 +1338,7 @@ private:
 		pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
 		pipelineCreateInfo.pDepthStencilState = &depthStencilCI;
 		pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
-		pipelineCreateInfo.pDynamicState = nullptr;		//暂时不使用动态状态
+		pipelineCreateInfo.pDynamicState = &dynamicCreateInfo;		//视口和裁剪矩形
 		pipelineCreateInfo.layout = pipelineLayout;
 		pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; //是否从哪个管线中继承
 		pipelineCreateInfo.basePipelineIndex = -1; //自己是否可以被继承
@@ -889,14 +1348,55 @@ private:
 		pipelineCreateInfo.renderPass = renderPass;
 		pipelineCreateInfo.subpass = 0; //引用之前创建的渲染流程对象和图形管线使用的子流程在子流程数组中的索引
 
-		if (vkCreateGraphicsPipelines(logiDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+		//cache中有相同的管线时驱动不需要重新编译shader，窗口大小改变时重建管线也会命中
+		auto start = std::chrono::high_resolution_clock::now();
+		if (vkCreateGraphicsPipelines(logiDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create graphics pipeline");
 		}
+		std::cout << "create pipeline: " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
 
 		vkDestroyShaderModule(logiDevice, vertShaderModule, nullptr);
 		vkDestroyShaderModule(logiDevice, fragShaderModule, nullptr);
 	}
 
+	void createPipelineCache() {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(phyDevice, &properties);
+		std::vector<uint8_t> initialData = pipecache::read(pipelineCachePath, properties);
+		pipelineCacheLoadedHash = initialData.empty() ? 0 : fileutil::hashBytes(initialData.data(), initialData.size());
+
+		VkPipelineCacheCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		createInfo.initialDataSize = initialData.size();
+		createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+		if (vkCreatePipelineCache(logiDevice, &createInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache");
+		}
+		std::cout << "pipeline cache: " << (initialData.empty() ? "cold start" : std::to_string(initialData.size()) + " bytes from " + pipelineCachePath) << std::endl;
+	}
+
+	//把cache的数据写回磁盘(内容没有变化时不写)，然后销毁cache
+	void destroyPipelineCache() {
+		size_t size = 0;
+		std::vector<uint8_t> data;
+		if (vkGetPipelineCacheData(logiDevice, pipelineCache, &size, nullptr) == VK_SUCCESS && size > 0) {
+			data.resize(size);
+			if (vkGetPipelineCacheData(logiDevice, pipelineCache, &size, data.data()) != VK_SUCCESS) {
+				data.clear();
+			}
+			data.resize(size);
+		}
+		if (!data.empty() && fileutil::hashBytes(data.data(), data.size()) != pipelineCacheLoadedHash) {
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(phyDevice, &properties);
+			//写入失败只影响下次启动的速度
+			if (!pipecache::write(pipelineCachePath, properties, data)) {
+				std::cerr << "failed to write pipeline cache: " << pipelineCachePath << std::endl;
+			}
+		}
+		vkDestroyPipelineCache(logiDevice, pipelineCache, nullptr);
+	}
+
 	//创建shader模块
 	VkShaderModule createShaderModule(const std::vector<char>& shaderCode) {
 		VkShaderModuleCreateInfo createInfo{};
@@ -939,6 +1439,9 @@ private:
 		//TODOvk中的纹理和帧缓冲由特定像素格式的VkImage对象来表示。图像的像素数据在内存中的分布取决于我们要对图像进行的操作
 		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;		//attchment进入renderpass之前的layout (状态)
 		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //离开renderpass之后的layoout
+		if (headless) {
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; //离屏图像之后拷贝到读回缓冲
+		}
 
 		//为渲染流程创建 depth attachment描述
 		VkAttachmentDescription depthAttachment{};
@@ -978,10 +1481,22 @@ private:
 		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 		dependency.dstSubpass = 0;
 		//指定需要等待的管线阶段和子流程将进行的操作类型
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; //子流程将会进行颜色附着的读写操作。这样设置后，图像布局变换直到必要时才会进行
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT; //上一帧对深度缓冲的写入
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT; //子流程将会进行颜色附着的读写操作。这样设置后，图像布局变换直到必要时才会进行
+		//深度附着的initialLayout为UNDEFINED，render pass开始时完成深度缓冲的布局转换，不需要单独提交指令
+
+		//无窗口模式: 颜色写入和到TRANSFER_SRC_OPTIMAL的布局转换完成之后，render pass之后的拷贝才能读取离屏图像
+		//隐式的0 -> EXTERNAL依赖只到BOTTOM_OF_PIPE，不带访问掩码，之后的屏障无法与布局转换相连
+		VkSubpassDependency readbackDependency{};
+		readbackDependency.srcSubpass = 0;
+		readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+		readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		std::array<VkSubpassDependency, 2> dependencies{ dependency, readbackDependency };
 
 		VkRenderPassCreateInfo renderPassCreateInfo{};
 		renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -989,12 +1504,13 @@ private:
 		renderPassCreateInfo.pAttachments = attachments.data();
 		renderPassCreateInfo.subpassCount = 1;
 		renderPassCreateInfo.pSubpasses = &subpass;
-		renderPassCreateInfo.dependencyCount = 1;
-		renderPassCreateInfo.pDependencies = &dependency;
+		renderPassCreateInfo.dependencyCount = headless ? 2 : 1;
+		renderPassCreateInfo.pDependencies = dependencies.data();
 
 		if (vkCreateRenderPass(logiDevice, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create render pass");
 		}
+		renderPassFormat = surfaceFormat.format;
 	}
 
 	void createFramebuffers() {
@@ -1030,87 +1546,84 @@ private:
 		if (vkCreateCommandPool(logiDevice, &createInfo, nullptr, &commandPool) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create command pool");
 		}
-	}
 
-	void createCommandBuffers() {
-		commandBuffers.resize(swapChainFrambuffers.size()); //TODO为什么与framebuffer数量相同
-		//从commandpool中分配空间
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandBufferCount = commandBuffers.size();
-		allocInfo.commandPool = commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;//定分配的指令缓冲对象是主要指令缓冲对象还是辅助指令缓冲对象，主指令提交到队列之后可进行执行，辅助指令可以被其他主指令进行引用
-		if (vkAllocateCommandBuffers(logiDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate command bufferes");
+		//上传批次的指令缓冲提交到传输队列，从传输队列族的指令池分配，每个指令缓冲只使用一次
+		createInfo.queueFamilyIndex = indices.transferFamily;
+		createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if (vkCreateCommandPool(logiDevice, &createInfo, nullptr, &uploadCommandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload command pool");
 		}
+	}
 
-		for (int i = 0, n = commandBuffers.size(); i < n; ++i) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT; //这使得可以在上一帧还未结束渲染时，提交下一帧的渲染指令
-			beginInfo.pInheritanceInfo = nullptr;
-
-			//开始指令缓冲的记录操作
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-				throw std::runtime_error("failed to begin command buffer");
-			}
-			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; //指定使用的渲染流程对象renderPass
-			renderPassInfo.framebuffer = swapChainFrambuffers[i]; //指定使用的framebuffer
-			//指定渲染的区域，设置为和使用的attachment大小相同
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = extent;
-			
-			//指定attachment load 即渲染前需要对图像进行清除的颜色
-			VkClearValue clearColor{ 0.f, 0.f, 0.f, 1.f };
-	
-
-			//指定depth attachment渲染前需要对图像进行清除的颜色
-			VkClearValue clearDepth{ 1};
-
-			std::array<VkClearValue, 2> clearValues{ clearColor, clearDepth };
-			
-			renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-
-
-			//记录指令到指令缓冲的函数的函数名都带有一个vkCmd前缀
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE); //第三个参数指定所有要执行的指令都在主要指令缓冲中，没有辅助指令缓冲需要执行。
-			
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline); //VK_PIPELINE_BIND_POINT_GRAPHICS指定管线是图形管线，因为还有计算管线
-			VkBuffer vertexBuffers[] = { vertexBuffer }; //一个绘制命令可能绑定多个顶点缓冲，所以使用VertexBuffer数组，并且offsets数组指定顶点缓冲在顶点缓冲数组中的偏移
-			VkDeviceSize offsets[] = { 0 };
-
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-			vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-			//为每个交换链图像绑定对应的desciptor set
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+	//每个并行的帧有自己的指令池和指令缓冲，drawFrame中等待这一帧的fence之后重置整个指令池，再重新记录这一帧的绘制指令
+	void createCommandBuffers() {
+		frameCommandPools.resize(MAX_FRAMES_IN_FLIGHT);
+		commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
-			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(vertexIndices.size()), 1, 0, 0, 0);
-			//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-			
-			vkCmdEndRenderPass(commandBuffers[i]);
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = indices.graphicsFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; //指令缓冲每帧都重新记录，整个池一起重置，不需要单独重置指令缓冲
 
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			if (vkCreateCommandPool(logiDevice, &poolInfo, nullptr, &frameCommandPools[i]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create frame command pool");
+			}
+			//从commandpool中分配空间
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandBufferCount = 1;
+			allocInfo.commandPool = frameCommandPools[i];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;//定分配的指令缓冲对象是主要指令缓冲对象还是辅助指令缓冲对象，主指令提交到队列之后可进行执行，辅助指令可以被其他主指令进行引用
+			if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &commandBuffers[i]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate command bufferes");
+			}
+		}
 
-			//结束指令记录到指令缓冲操作
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) { 
-				throw std::runtime_error("failed to record command buffer");
+		//并行记录: 指令池不能同时在多个线程上使用，每一帧给调度器的每个线程一个指令池，记录的任务使用执行它的线程的指令池
+		activeRecordThreads = recordThreadCount == 0 ? jobs.size() : recordThreadCount;
+		if (activeRecordThreads > 1 || recordBenchmarkFrames > 0) {
+			recordPools.resize(MAX_FRAMES_IN_FLIGHT);
+			for (auto&& framePools : recordPools) {
+				framePools = std::vector<RecordPool>(jobs.size());
+				for (auto&& recordPool : framePools) {
+					if (vkCreateCommandPool(logiDevice, &poolInfo, nullptr, &recordPool.pool) != VK_SUCCESS) {
+						throw std::runtime_error("failed to create record command pool");
+					}
+				}
 			}
 		}
+
+		drawList = buildDrawList(drawCallCount);
 	}
-	/*void recordCommmand(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+
+	//把模型的索引按三角形平均拆分成drawCount段，每段一次绘制调用
+	std::vector<DrawRange> buildDrawList(uint32_t drawCount) const {
+		uint32_t triangles = mesh.indexCount / 3;
+		drawCount = std::max(1u, std::min(drawCount, triangles));
+		std::vector<DrawRange> draws(drawCount);
+		for (uint32_t i = 0; i < drawCount; ++i) {
+			uint32_t first = static_cast<uint32_t>(uint64_t(triangles) * i / drawCount);
+			uint32_t last = static_cast<uint32_t>(uint64_t(triangles) * (i + 1) / drawCount);
+			draws[i] = { first * 3, (last - first) * 3 };
+		}
+		return draws;
+	}
+
+	//记录一帧的绘制指令，调用之前这一帧的指令池已经重置
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
 		VkCommandBufferBeginInfo beginInfo{};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT; //这使得可以在上一帧还未结束渲染时，提交下一帧的渲染指令
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; //每次记录只提交一次，驱动不需要为重复提交保留状态
 		beginInfo.pInheritanceInfo = nullptr;
 
 		//开始指令缓冲的记录操作
 		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
 			throw std::runtime_error("failed to begin command buffer");
 		}
+		//重置这一帧的时间戳查询，必须在render pass之外
+		gpuTimestamps.beginFrame(commandBuffer, currentFrame);
+		uint32_t renderPassRegion = gpuTimestamps.beginRegion(commandBuffer, currentFrame, "render pass");
 
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1122,36 +1635,127 @@ private:
 
 		//指定attachment load 即渲染前需要对图像进行清除的颜色
 		VkClearValue clearColor{ 0.f, 0.f, 0.f, 1.f };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
 
+		//指定depth attachment渲染前需要对图像进行清除的颜色
+		VkClearValue clearDepth{ 1};
 
-		//记录指令到指令缓冲的函数的函数名都带有一个vkCmd前缀
-		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE); //第三个参数指定所有要执行的指令都在主要指令缓冲中，没有辅助指令缓冲需要执行。
+		std::array<VkClearValue, 2> clearValues{ clearColor, clearDepth };
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline); //VK_PIPELINE_BIND_POINT_GRAPHICS指定管线是图形管线，因为还有计算管线
-		VkBuffer vertexBuffers[] = { vertexBuffer }; //一个绘制明亮可能绑定多个顶点缓冲，所以使用VertexBuffer数组，并且offsets数组指定顶点缓冲在顶点缓冲数组中的偏移
-		VkDeviceSize offsets[] = { 0 };
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
 
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		//为每个交换链图像绑定对应的desciptor set
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex], 0, nullptr);
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(vertexIndices.size()), 1, 0, 0, 0);
-		//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+		//记录指令到指令缓冲的函数的函数名都带有一个vkCmd前缀
+		if (activeRecordThreads <= 1) {
+			vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE); //第三个参数指定所有要执行的指令都在主要指令缓冲中，没有辅助指令缓冲需要执行。
+			recordDraws(commandBuffer, 0, drawList.size());
+		} else {
+			//绘制列表平均分成activeRecordThreads段，每段是一个任务，记录到一个辅助指令缓冲，主指令缓冲按段的顺序执行它们
+			vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			//fence已经发出信号，这一帧上次使用的辅助指令缓冲都执行完了
+			for (auto&& recordPool : recordPools[currentFrame]) {
+				vkResetCommandPool(logiDevice, recordPool.pool, 0);
+				recordPool.used = 0;
+			}
+			size_t grain = (drawList.size() + activeRecordThreads - 1) / activeRecordThreads;
+			secondaryCommandBuffers.resize((drawList.size() + grain - 1) / grain);
+			jobs.parallelFor(drawList.size(), grain, [&](size_t begin, size_t end) {
+				profiler::CpuScope scope(frameTraceOrNull(), "record secondary");
+				//同一个线程可能执行多段，每段从这个线程的指令池取下一个辅助指令缓冲
+				RecordPool& recordPool = recordPools[currentFrame][jobs.workerIndex()];
+				if (recordPool.used == recordPool.buffers.size()) {
+					VkCommandBufferAllocateInfo allocInfo{};
+					allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+					allocInfo.commandBufferCount = 1;
+					allocInfo.commandPool = recordPool.pool;
+					allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY; //辅助指令缓冲不能直接提交，由主指令缓冲通过vkCmdExecuteCommands执行
+					VkCommandBuffer buffer;
+					if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &buffer) != VK_SUCCESS) {
+						throw std::runtime_error("failed to allocate secondary command buffer");
+					}
+					recordPool.buffers.push_back(buffer);
+				}
+				VkCommandBuffer secondary = recordPool.buffers[recordPool.used++];
+
+				VkCommandBufferInheritanceInfo inheritanceInfo{};
+				inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+				inheritanceInfo.renderPass = renderPass;
+				inheritanceInfo.subpass = 0;
+				inheritanceInfo.framebuffer = swapChainFrambuffers[imageIndex];
+
+				VkCommandBufferBeginInfo secondaryBeginInfo{};
+				secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT; //完全在render pass之内执行
+				secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
+				if (vkBeginCommandBuffer(secondary, &secondaryBeginInfo) != VK_SUCCESS) {
+					throw std::runtime_error("failed to begin secondary command buffer");
+				}
+				recordDraws(secondary, begin, end);
+				if (vkEndCommandBuffer(secondary) != VK_SUCCESS) {
+					throw std::runtime_error("failed to record secondary command buffer");
+				}
+				secondaryCommandBuffers[begin / grain] = secondary;
+			});
+			vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+		}
 
 		vkCmdEndRenderPass(commandBuffer);
+		gpuTimestamps.endRegion(commandBuffer, currentFrame, renderPassRegion);
 
+		if (headless) {
+			recordReadback(commandBuffer, imageIndex);
+		}
 
 		//结束指令记录到指令缓冲操作
 		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 			throw std::runtime_error("failed to record command buffer");
 		}
+	}
 
+	//把渲染完的离屏图像拷贝到读回缓冲，render pass结束时图像已经转换为TRANSFER_SRC_OPTIMAL
+	//颜色写入和布局转换到拷贝读取的同步由render pass的0 -> EXTERNAL依赖完成
+	void recordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+		//bufferRowLength为0表示缓冲中的像素紧密排列
+		VkBufferImageCopy region{};
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { extent.width, extent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbacks[imageIndex].buffer, 1, &region);
+
+		//拷贝的写入对主机可见，等待fence之后CPU才能读到
+		VkBufferMemoryBarrier bufferBarrier{};
+		bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		bufferBarrier.buffer = readbacks[imageIndex].buffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+	}
+
+	//记录绘制列表中[begin, end)的绘制调用，辅助指令缓冲不继承主指令缓冲的状态，所以每个指令缓冲都要重新绑定
+	void recordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline); //VK_PIPELINE_BIND_POINT_GRAPHICS指定管线是图形管线，因为还有计算管线
+
+		//动态的视口和裁剪矩形，与当前交换链的大小相同
+		VkViewport viewport{ 0.f, 0.f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.f, 1.f };
+		VkRect2D scissor{ { 0, 0 }, extent };
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		VkBuffer vertexBuffers[] = { vertexBuffer }; //一个绘制命令可能绑定多个顶点缓冲，所以使用VertexBuffer数组，并且offsets数组指定顶点缓冲在顶点缓冲数组中的偏移
+		VkDeviceSize offsets[] = { 0 };
+
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+		//绑定当前帧的desciptor set，它引用的uniform缓冲在updateUniformBuffer(currentFrame)中更新
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+
+		for (size_t i = begin; i < end; ++i) {
+			vkCmdDrawIndexed(commandBuffer, drawList[i].indexCount, 1, drawList[i].firstIndex, 0, 0);
+		}
 	}
-	*/
 
 	void createSyncObjects() {
 		imageAvaliableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1186,14 +1790,24 @@ private:
 	}
 
 	void drawFrame() {
-
-
+		auto frameStart = std::chrono::high_resolution_clock::now();
+		profiler::CpuScope frameScope(frameTraceOrNull(), "drawFrame");
 
 		//0. 等待当前帧的队列是否可用
-		vkWaitForFences(logiDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		{
+			profiler::CpuScope scope(frameTraceOrNull(), "wait fence");
+			vkWaitForFences(logiDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		}
+		//fence发出信号后，这一帧上次提交的时间戳查询都已经写入
+		resolveGpuTimestamps(currentFrame);
+
 		//1. 从交换链中获取一张图像
 		uint32_t imageIndex;//输出可用的交换链图像的索引，使用此索引获取对应的交换链中的image以及对应的指令缓冲
-		VkResult result = vkAcquireNextImageKHR(logiDevice, swapChain, std::numeric_limits<uint64_t>::max(), imageAvaliableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex); //可以使用 semaphore 和 fence进行同步
+		VkResult result;
+		{
+			profiler::CpuScope scope(frameTraceOrNull(), "acquire");
+			result = vkAcquireNextImageKHR(logiDevice, swapChain, std::numeric_limits<uint64_t>::max(), imageAvaliableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex); //可以使用 semaphore 和 fence进行同步
+		}
 		if (result == VK_ERROR_OUT_OF_DATE_KHR ) {
 			recreateSwapChain();
 			return; //此时返回合理，因为没有重置fence的状态，可以下次wait成功
@@ -1203,10 +1817,16 @@ private:
 		}
 
 		vkResetFences(logiDevice, 1, &inFlightFences[currentFrame]);	//需要手动将fence改为未发出信号阶段
+
+		//回收已经完成的上传批次占用的staging空间，渲染期间记录的上传在这一帧的绘制之前提交
+		retireUploads(false);
+		flushUploads();
 		
 		//TODO
 		updateUniformBuffer(currentFrame);
 
+		recordFrame(imageIndex);
+
 		//2. 通过VkSubmitInfo结构体来提交信息给指令队列：
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1220,7 +1840,7 @@ private:
 
 		//指定实际被提交执行的指令缓冲对象
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+		submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
 		//指定在指令缓冲执行结束后发出信号的信号量对象
 		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame]};
@@ -1231,6 +1851,7 @@ private:
 		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
 			throw std::runtime_error("failed to submit command to graphics queue");
 		}
+		gpuTimestamps.submitted(currentFrame, frameTrace.toUs(std::chrono::high_resolution_clock::now()));
 	
 		//4. 渲染的图像返回给交换链进行呈现操作
 		VkPresentInfoKHR presentInfo{};
@@ -1245,7 +1866,10 @@ private:
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr;
 
-		result = vkQueuePresentKHR(presentQueue, & presentInfo);
+		{
+			profiler::CpuScope scope(frameTraceOrNull(), "present");
+			result = vkQueuePresentKHR(presentQueue, & presentInfo);
+		}
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || frameBufferResized) { //VK_SUBOPTIMAL_KHR选择链不完全匹配时也重建交换链
 			frameBufferResized = false;
 			recreateSwapChain();
@@ -1253,7 +1877,134 @@ private:
 		else if (result != VK_SUCCESS) {
 			throw std::runtime_error("failed to present swapchain image");
 		}
+		finishFrame(frameStart);
+	}
+
+	//fence已经发出信号，这一帧上次提交的指令缓冲已经执行完，重置指令池后重新记录
+	void recordFrame(uint32_t imageIndex) {
+		profiler::CpuScope scope(frameTraceOrNull(), "record");
+		auto recordStart = std::chrono::high_resolution_clock::now();
+		vkResetCommandPool(logiDevice, frameCommandPools[currentFrame], 0);
+		recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+		recordTimeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+		++recordedFrames;
+	}
+
+	//提交(和呈现)之后: 第一帧的时间、切换到下一个并行帧、帧统计
+	void finishFrame(std::chrono::high_resolution_clock::time_point frameStart) {
+		if (!firstFramePresented) {
+			firstFramePresented = true;
+			std::cout << "time to first frame: " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - appStartTime).count() << " ms" << std::endl;
+		}
 		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+		//帧时间是两次drawFrame开始之间的间隔，CPU时间是这一次drawFrame本身花费的时间
+		auto frameEnd = std::chrono::high_resolution_clock::now();
+		if (lastFrameStart != std::chrono::high_resolution_clock::time_point()) {
+			frameTimeStats.add(std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count());
+		}
+		lastFrameStart = frameStart;
+		cpuTimeStats.add(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+		if (frameStatsInterval > 0 && ++statsFrameCount % frameStatsInterval == 0) {
+			printFrameStats();
+		}
+	}
+
+	//无窗口模式的一帧: 离屏图像与并行帧一一对应，不需要获取和呈现，提交时也不需要等待或者发出信号量
+	//fence保证这张图像和它的读回缓冲上次的使用已经结束
+	void drawOffscreenFrame() {
+		auto frameStart = std::chrono::high_resolution_clock::now();
+		profiler::CpuScope frameScope(frameTraceOrNull(), "drawFrame");
+
+		{
+			profiler::CpuScope scope(frameTraceOrNull(), "wait fence");
+			vkWaitForFences(logiDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		}
+		resolveGpuTimestamps(currentFrame);
+		//读回缓冲中是这张图像上一次渲染的结果，下面的提交会覆盖它
+		{
+			profiler::CpuScope scope(frameTraceOrNull(), "readback");
+			processReadback(currentFrame);
+		}
+
+		vkResetFences(logiDevice, 1, &inFlightFences[currentFrame]);
+
+		retireUploads(false);
+		flushUploads();
+
+		updateUniformBuffer(currentFrame);
+		recordFrame(currentFrame);
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit command to graphics queue");
+		}
+		gpuTimestamps.submitted(currentFrame, frameTrace.toUs(std::chrono::high_resolution_clock::now()));
+		readbacks[currentFrame].frame = static_cast<int64_t>(headlessFrameIndex++);
+
+		finishFrame(frameStart);
+	}
+
+	//处理读回缓冲中的帧，调用之前需要等待这一帧的fence
+	//最后一帧计算像素的hash；需要写文件时先把像素复制出来，转换格式和写文件在工作线程上进行，不阻塞渲染
+	void processReadback(uint32_t frame) {
+		Readback& pending = readbacks[frame];
+		if (pending.frame < 0) {
+			return;
+		}
+		uint64_t frameNumber = static_cast<uint64_t>(pending.frame);
+		pending.frame = -1;
+		allocator.invalidate(pending.memory);
+		const uint8_t* pixels = static_cast<const uint8_t*>(pending.memory.mapped);
+		size_t size = size_t(extent.width) * extent.height * 4;
+		bool last = frameNumber + 1 == headlessFrameCount;
+		if (last) {
+			lastFrameHash = fileutil::hashBytes(pixels, size);
+		}
+		if (headlessOutputDir.empty() || (!last && frameNumber % std::max(1u, headlessWriteInterval) != 0)) {
+			return;
+		}
+		auto copy = std::make_shared<std::vector<uint8_t>>(pixels, pixels + size);
+		char name[32];
+		snprintf(name, sizeof(name), "/frame_%05llu.ppm", static_cast<unsigned long long>(frameNumber));
+		std::string path = headlessOutputDir + name;
+		uint32_t width = extent.width, height = extent.height;
+		bool bgra = surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM;
+		readbackWrites.push_back(jobs.submit([copy, path, width, height, bgra] {
+			if (!readback::writePpm(path, copy->data(), width, height, bgra)) {
+				throw std::runtime_error("failed to write frame " + path);
+			}
+		}));
+	}
+
+	profiler::Trace* frameTraceOrNull() {
+		return frameTracePath.empty() ? nullptr : &frameTrace;
+	}
+
+	//读取这一帧上次提交的GPU时间戳，调用之前需要等待这一帧的fence
+	void resolveGpuTimestamps(uint32_t frame) {
+		gpuTimestamps.resolve(frame, [this](const char* name, double startUs, double durationUs, double submitUs) {
+			gpuTimeStats.add(durationUs / 1000.0);
+			if (!frameTracePath.empty()) {
+				frameTrace.addGpu(name, startUs, durationUs, submitUs);
+			}
+		});
+	}
+
+	void printFrameStats() {
+		auto print = [](const char* label, const profiler::RollingStats& stats) {
+			std::cout << label << " p50 " << stats.percentile(0.5) << " p95 " << stats.percentile(0.95) << " p99 " << stats.percentile(0.99) << " ms";
+		};
+		std::cout << "frame stats (last " << frameTimeStats.size() << " frames): ";
+		print("frame", frameTimeStats);
+		print(", cpu", cpuTimeStats);
+		if (gpuTimestamps.supported()) {
+			print(", gpu render pass", gpuTimeStats);
+		}
+		std::cout << std::endl;
 	}
 
 	void updateUniformBuffer(uint32_t currentImage) {
@@ -1261,6 +2012,10 @@ private:
 
 		auto currentTime = std::chrono::high_resolution_clock::now();
 		float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+		//无窗口模式按帧数推进动画，每次运行的画面相同，可以比较输出
+		if (headless) {
+			time = headlessFrameIndex / 60.f;
+		}
 		UniformBufferObjcet ubo{};
 		ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 
@@ -1268,6 +2023,7 @@ private:
 
 		ubo.projection = glm::perspective(glm::radians(45.0f), extent.width / (float)extent.height, 0.1f, 10.0f);
 		ubo.projection[1][1] *= -1;
+		ubo.dequantize = vertexDequantize;
 		memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
 		
 		//UniformBufferObjcet ubo{};
@@ -1281,7 +2037,8 @@ private:
 	}
 
 	//窗口大小改变时，交换链需要重新创建，并且依赖于交换链的对象也需要重新创建
-	void recreateSwapChain() {
+	//rebuildPipeline为true时同时重建render pass和管线，只在交换链图像的格式改变时需要(压力测试中用来对比之前的做法)
+	void recreateSwapChain(bool rebuildPipeline = false) {
 		//处理最小化情况，停止渲染
 		int width = 0, height = 0;
 		while (width == 0 || height == 0) {
@@ -1304,18 +2061,17 @@ private:
 		//创建深度缓冲相关资源
 		createDepthResources();
 
-		//创建render pass 对象
-		createRenderPass(); // 渲染流程依赖于交换链图像的格式, 虽然窗口大小改变，格式不会变，为什么还要重建
-
-		//创建渲染图形管线
-		createGraphicsPipeline(); // 视口和裁剪矩形在管线创建时被指定，窗口大小改变，这些设置也需要修改, TODO： 使用dynamic state
-
+		//render pass只依赖于交换链图像的格式，视口和裁剪矩形是管线的动态状态，窗口大小改变时都不需要重建
+		if (rebuildPipeline || surfaceFormat.format != renderPassFormat) {
+			destroyPipelineObjects();
+			createRenderPass();
+			createGraphicsPipeline();
+		}
 
 		//为交换链中的所有图像创建帧缓冲
 		createFramebuffers();
 
-		//分配指令缓冲对象，使用它记录绘制指令
-		createCommandBuffers();
+		//指令缓冲每帧在drawFrame中重新记录，不需要重建
 	}
 
 	/// <summary>
@@ -1323,8 +2079,9 @@ private:
 	/// </summary>
 	/// <param name="typeFilters">buffer需要的内存类型</param>
 	/// <param name="properties">应用指定的内存类型</param>
+	/// <param name="fallback">没有满足properties的类型时退而使用的属性，0表示不退让</param>
 	/// <returns>类型的索引</returns>
-	uint32_t findMemoryType(uint32_t typeFilters, VkMemoryPropertyFlags properties) { //指定
+	uint32_t findMemoryType(uint32_t typeFilters, VkMemoryPropertyFlags properties, VkMemoryPropertyFlags fallback = 0) { //指定
 		VkPhysicalDeviceMemoryProperties memProperties; //memProperties.memoryTypes[i].propertyFlags指顶memory的属性，VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT表示设备内存可以映射，所以CPU能够写
 		vkGetPhysicalDeviceMemoryProperties(phyDevice, &memProperties);
 		for (int i = 0; i < memProperties.memoryTypeCount; ++i) {
@@ -1332,64 +2089,180 @@ private:
 				return i;
 			}
 		}
+		if (fallback != 0) {
+			return findMemoryType(typeFilters, fallback);
+		}
 
 		throw std::runtime_error("failed to find suitable memory type");
 
 	}
 
-	void createVertexBuffer() {
+	//把mesh中的顶点转换为PackedVertex，同时计算反量化矩阵
+	std::vector<uint8_t> packVertices(bool withNormal) {
+		const float* positions = &mesh.vertices[0].position.x;
+		vertexpack::Bounds bounds = vertexpack::computeBounds(positions, sizeof(Vertex), mesh.vertexCount);
+		std::vector<float> normals;
+		if (withNormal) {
+			//Vertex中没有法线，由几何计算平滑法线
+			vertexpack::computeVertexNormals(positions, sizeof(Vertex), mesh.vertexCount, mesh.indices, mesh.indexCount, normals);
+		}
+
+		uint32_t stride = PackedVertex::stride(withNormal);
+		std::vector<uint8_t> packed(VkDeviceSize(stride) * mesh.vertexCount);
+		for (uint32_t i = 0; i < mesh.vertexCount; ++i) {
+			const Vertex& vertex = mesh.vertices[i];
+			PackedVertex p{};
+			for (int k = 0; k < 3; ++k) {
+				p.position[k] = vertexpack::quantizeUnorm16((vertex.position[k] - bounds.min[k]) / bounds.extent(k));
+			}
+			p.texCoord[0] = vertexpack::floatToHalf(vertex.texCoord.x);
+			p.texCoord[1] = vertexpack::floatToHalf(vertex.texCoord.y);
+			if (withNormal) {
+				vertexpack::encodeOctahedral(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2], p.normal);
+			}
+			memcpy(&packed[VkDeviceSize(stride) * i], &p, stride);
+		}
 
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+		vertexDequantize = glm::translate(glm::mat4(1.f), glm::vec3(bounds.min[0], bounds.min[1], bounds.min[2]))
+			* glm::scale(glm::mat4(1.f), glm::vec3(bounds.extent(0), bounds.extent(1), bounds.extent(2)));
+		std::cout << "pack vertices: " << sizeof(Vertex) << " -> " << stride << " bytes per vertex" << std::endl;
+		return packed;
+	}
 
-		//创建stage buffer，用作中转将RAM中的数据传递到GPU local内存(因为这部分内存不允许映射)
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-		//映射内对象使CPU可访问,内存这里创建的内存对象都是GPU中的，CPU想要访问就需要使用内存映射，将GPU内存映射到RAM中
-		//但是GPU驱动不会立即将内存中的数据写到GPU内存中，创建buffer时使用VK_MEMORY_PROPERTY_HOST_COHERENT_BIT要求有保证一致性的内存
-		void* data;
-		vkMapMemory(logiDevice, stagingMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), bufferSize);
-		vkUnmapMemory(logiDevice, stagingMemory);
+	void createVertexBuffer(const void* vertexData, VkDeviceSize bufferSize) {
 
 		//vertexBuffer指定的内存属性位device local，所以对于GPU进行读取的效率更高，而之前的可能VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT内存效率并不高
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-		
-		//从GPU staging buffer 将顶点数据拷贝到 device local区域
-		copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-
-		//释放staging buffer
-		vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
-		vkFreeMemory(logiDevice, stagingMemory, nullptr);
 
+		//通过staging环形缓冲中转，将RAM中的数据传递到GPU local内存(因为这部分内存不允许映射)
+		uploadBuffer(vertexBuffer, vertexData, bufferSize);
 	}
-	void createIndexBuffer() {
-
-		VkDeviceSize bufferSize = sizeof(vertexIndices[0]) * vertexIndices.size();
+	void createIndexBuffer(const uint32_t* indexData, uint32_t indexCount) {
 
-		//创建stage buffer，用作中转将RAM中的数据传递到GPU local内存(因为这部分内存不允许映射)
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-		//映射内对象使CPU可访问,内存这里创建的内存对象都是GPU中的，CPU想要访问就需要使用内存映射，将GPU内存映射到RAM中
-		//但是GPU驱动不会立即将内存中的数据写到GPU内存中，创建buffer时使用VK_MEMORY_PROPERTY_HOST_COHERENT_BIT要求有保证一致性的内存
-		void* data;
-		vkMapMemory(logiDevice, stagingMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertexIndices.data(), bufferSize);
-		vkUnmapMemory(logiDevice, stagingMemory);
+		VkDeviceSize bufferSize = sizeof(uint32_t) * indexCount;
 
 		//vertexBuffer指定的内存属性位device local，所以对于GPU进行读取的效率更高，而之前的可能VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT内存效率并不高
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
 
-		//从GPU staging buffer 将顶点数据拷贝到 device local区域
-		copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+		//与顶点数据在同一个上传批次中提交
+		uploadBuffer(indexBuffer, indexData, bufferSize);
+	}
+
+	//流式加载模型: 第二遍解析obj，回调输出的三角形角点按块收集，块内相同(v, vt)的角点焊接为一个顶点(哈希表每块清空，不超过一块的大小)，
+	//再对这一块做顶点缓存、overdraw和顶点读取的重排，然后写入staging环形缓冲中预留的一段，
+	//记录拷贝到device local缓冲对应位置的命令，不等待拷贝完成就继续解析下一块。
+	//位置和纹理坐标在loadModel中已经写入临时文件并映射(objstream::AttributeSpill)，主存中只有一块的数据，与模型大小无关
+	//块之间的重复顶点不合并；焊接后的顶点数量要到最后才知道，顶点缓冲按每个角点一个顶点的最坏情况分配，只使用前一部分
+	//同样的块追加到网格缓存(带有FLAG_STREAMED)，下次启动映射缓存，大小正好，不再解析obj
+	//超大模型只使用Float顶点格式: 量化需要整个网格的包围盒，PackedNormal还需要整个网格计算法线
+	void streamModel(const std::string& modelPath) {
+		uint64_t cornerCount = streamingAttributes->cornerCount();
+		if (cornerCount == 0 || cornerCount > UINT32_MAX) {
+			throw std::runtime_error("unsupported face count in model: " + modelPath);
+		}
+		uint32_t indexCount = static_cast<uint32_t>(cornerCount);
+
+		createBuffer(sizeof(Vertex) * VkDeviceSize(indexCount), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+		createBuffer(sizeof(uint32_t) * VkDeviceSize(indexCount), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+
+		//每块的角点数取3的倍数，三角形不会跨块，每块可以单独重排
+		const uint32_t blockCorners = streamingBlockVertices / 3 * 3;
+		std::unordered_map<uint64_t, uint32_t> blockMap;
+		blockMap.reserve(blockCorners);
+		std::vector<Vertex> blockVertices, optimizedVertices;
+		std::vector<uint32_t> blockIndices, optimizedIndices, clusters;
+		blockVertices.reserve(blockCorners);
+		blockIndices.reserve(blockCorners);
+		uint32_t vertexBase = 0;	//之前的块写入的顶点数量
+		uint32_t indexBase = 0;		//之前的块写入的索引数量
+		uint32_t blockCount = 0;
+
+		//网格缓存按块追加，索引区和顶点区分开写，不从staging内存(可能是write-combined内存)读回；写入失败时放弃缓存，不影响上传
+		std::string cachePath = modelPath + ".meshcache";
+		meshcache::StreamWriter cacheWriter(cachePath, streamingSourceHash, streamingSourceSize, sizeof(Vertex), indexCount, meshcache::FLAG_STREAMED);
+		bool writeCache = cacheWriter.good();
+
+		//重排之后顶点和索引放在staging环形缓冲的同一段中，拷贝命令记录在当前的上传批次中，只有环形缓冲没有空间时才会等待之前的批次完成
+		auto flush = [&]() {
+			if (blockIndices.empty()) {
+				return;
+			}
+			size_t count = blockIndices.size();
+			size_t vertexCount = blockVertices.size();
+			optimizedIndices.resize(count);
+			meshopt::optimizeVertexCache(optimizedIndices.data(), blockIndices.data(), count, vertexCount, 16, &clusters);
+			meshopt::optimizeOverdraw(blockIndices.data(), optimizedIndices.data(), count, &blockVertices[0].position.x, sizeof(Vertex), vertexCount, clusters);
+			optimizedVertices.resize(vertexCount);
+			vertexCount = meshopt::optimizeVertexFetch(optimizedVertices.data(), blockIndices.data(), count, blockVertices.data(), vertexCount);
+			for (uint32_t& index : blockIndices) {
+				index += vertexBase;
+			}
 
+			VkDeviceSize vertexBytes = sizeof(Vertex) * VkDeviceSize(vertexCount);
+			VkDeviceSize indexBytes = sizeof(uint32_t) * VkDeviceSize(count);
+			VkDeviceSize offset;
+			char* staging = static_cast<char*>(reserveStaging(vertexBytes + indexBytes, offset));
+			memcpy(staging, optimizedVertices.data(), vertexBytes);
+			memcpy(staging + vertexBytes, blockIndices.data(), indexBytes);
+			recordStagingCopy(offset, vertexBuffer, sizeof(Vertex) * VkDeviceSize(vertexBase), vertexBytes);
+			recordStagingCopy(offset + vertexBytes, indexBuffer, sizeof(uint32_t) * VkDeviceSize(indexBase), indexBytes);
+			writeCache = writeCache && cacheWriter.appendVertices(optimizedVertices.data(), static_cast<uint32_t>(vertexCount))
+				&& cacheWriter.appendIndices(blockIndices.data(), static_cast<uint32_t>(count));
+
+			vertexBase += static_cast<uint32_t>(vertexCount);
+			indexBase += static_cast<uint32_t>(count);
+			blockCount++;
+			blockMap.clear();
+			blockVertices.clear();
+			blockIndices.clear();
+		};
+		auto emit = [&](const objstream::Corner& corner) {
+			//第二遍得到的角点比第一遍多，说明文件在两遍之间被修改了
+			if (indexBase + blockIndices.size() >= indexCount) {
+				return false;
+			}
+			auto it = blockMap.find(corner.key);
+			if (it == blockMap.end()) {
+				Vertex vertex{};
+				vertex.position = { corner.position[0], corner.position[1], corner.position[2] };
+				vertex.texCoord = { corner.texcoord[0], 1 - corner.texcoord[1] };
+				it = blockMap.emplace(corner.key, static_cast<uint32_t>(blockVertices.size())).first;
+				blockVertices.push_back(vertex);
+			}
+			blockIndices.push_back(it->second);
+			if (blockIndices.size() == blockCorners) {
+				flush();
+			}
+			return true;
+		};
 
-		//释放staging buffer
-		vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
-		vkFreeMemory(logiDevice, stagingMemory, nullptr);
+		std::ifstream file(modelPath, std::ios::binary);
+		std::vector<char> fileBuffer(1 << 20);
+		file.rdbuf()->pubsetbuf(fileBuffer.data(), fileBuffer.size());
+		objstream::Reader<decltype(emit)> reader(*streamingAttributes, emit);
+		std::string err;
+		bool ok = file.is_open() && reader.read(file, &err);
+		if (!ok) {
+			throw std::runtime_error("failed to stream model " + modelPath + ": " + err);
+		}
+		flush();
+		finishBufferUpload(vertexBuffer);
+		finishBufferUpload(indexBuffer);
+		if (indexBase != indexCount) {
+			throw std::runtime_error("failed to stream model " + modelPath + ": obj changed between the two passes");
+		}
+		if (!writeCache || !cacheWriter.finish()) {
+			std::cerr << "failed to write mesh cache: " << cachePath << std::endl;
+		}
+
+		std::cout << "load model: streamed " << indexCount << " indices, " << vertexBase << " vertices welded per block in " << blockCount << " blocks, from "
+			<< streamingAttributes->positionCount() << " positions and " << streamingAttributes->texcoordCount() << " texcoords" << std::endl;
+		//删除临时文件
+		streamingAttributes.reset();
 
+		mesh = MeshView{};
+		mesh.vertexCount = vertexBase;
+		mesh.indexCount = indexCount;
 	}
 
 	void createUniformBuffers() {
@@ -1401,11 +2274,11 @@ private:
 		for (int i = 0; i < size; ++i) {
 			createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
 			//uniform对象每一帧都会进行改变，所以需要整个程序的生命周期都需要映射
-			vkMapMemory(logiDevice, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+			uniformBuffersMapped[i] = uniformBuffersMemory[i].mapped;
 		}
 	}
 	//创建Buffer： bufferObj，memoryObj，Bind
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory, VkMemoryPropertyFlags fallback = 0) {
 		
 		VkBufferCreateInfo bufferCreateInfo{};
 		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1425,121 +2298,335 @@ private:
 		
 
 		//显卡可以分配不同类型的内存作为缓冲使用。不同类型的内存所允许进行的操作以及操作的效率有所不同
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size; //需要的分配的size 不一定时 createInfo中的size
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		//分配内存
-		if (vkAllocateMemory(logiDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate buffer memory");
-		}
+		//从allocator的块中子分配，需要的size不一定是createInfo中的size
+		bufferMemory = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties, fallback), true);
 
-		//buffer与memory的绑定
-		vkBindBufferMemory(logiDevice, buffer, bufferMemory, 0);
+		//buffer与memory的绑定，子分配的资源绑定在块内的偏移处
+		vkBindBufferMemory(logiDevice, buffer, bufferMemory.memory, bufferMemory.offset);
 	}
 
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-		//GPU操作需要用命令来声明
-		//创建临时命令，使用原来的command pool，TODO：创建专门的command pool可以进行优化
-		//VkCommandBufferAllocateInfo allocInfo{};
-		//allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		//allocInfo.commandPool = commandPool;
-		//allocInfo.commandBufferCount = 1;
-		//allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-
-		//VkCommandBuffer commandBuffer{};
-		//if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
-		//	throw std::runtime_error("failed to allocate command bufferes");
-		//}
-
-		////start recording the command buffer
-		//VkCommandBufferBeginInfo beginInfo{};
-		//beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		//beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; //临时命令，只使用一次
+	//创建持久映射的staging环形缓冲，所有上传都通过它中转
+	void createStagingRing() {
+		createBuffer(stagingRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingRingBuffer, stagingRingMemory);
+		stagingRing.init(stagingRingBuffer, stagingRingMemory.mapped, stagingRingSize);
+	}
 
-		//if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-		//	throw std::runtime_error("failed to begin command buffer");
-		//}
-		//VkBufferCopy copyRegion{};
-		//copyRegion.size = size;
-		//copyRegion.srcOffset = 0;
-		//copyRegion.dstOffset = 0;
-		//vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-		//if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-		//	throw std::runtime_error("failed to record command buffer");
-		//}
-		//
-		//VkSubmitInfo submitInfo{};
-		//submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		//submitInfo.commandBufferCount = 1;
-		//submitInfo.pCommandBuffers = &commandBuffer;
+	//当前上传批次的指令缓冲，没有正在记录的批次时开始一个新的批次
+	VkCommandBuffer uploadCommandBuffer() {
+		if (currentUpload.commandBuffer != VK_NULL_HANDLE) {
+			return currentUpload.commandBuffer;
+		}
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = uploadCommandPool;
+		allocInfo.commandBufferCount = 1;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &currentUpload.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer");
+		}
+
+		//fence在批次完成后重置并重复使用
+		if (!freeUploadFences.empty()) {
+			currentUpload.fence = freeUploadFences.back();
+			freeUploadFences.pop_back();
+		} else {
+			VkFenceCreateInfo fenceCI{};
+			fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(logiDevice, &fenceCI, nullptr, &currentUpload.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create upload fence");
+			}
+		}
+		//使用独立传输队列时，批次完成后通过信号量通知图形队列
+		if (dedicatedTransfer()) {
+			if (!freeUploadSemaphores.empty()) {
+				currentUpload.semaphore = freeUploadSemaphores.back();
+				freeUploadSemaphores.pop_back();
+			} else {
+				VkSemaphoreCreateInfo semaphoreCI{};
+				semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				if (vkCreateSemaphore(logiDevice, &semaphoreCI, nullptr, &currentUpload.semaphore) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create upload semaphore");
+				}
+			}
+		}
+		currentUpload.id = nextUploadId++;
 
-		//if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-		//	throw std::runtime_error("failed to submit command to graphics queue");
-		//}
-		////等待数据transfer结束 也可以使用 vkWaitForFences
-		//vkQueueWaitIdle(graphicsQueue);
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(currentUpload.commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin upload command buffer");
+		}
+		return currentUpload.commandBuffer;
+	}
 
-		//vkFreeCommandBuffers(logiDevice, commandPool, 1, &commandBuffer);
+	//在环形缓冲中预留size字节，返回映射的地址，offset为在环形缓冲中的偏移
+	//空间不足时提交当前批次，并等待最早的批次完成
+	void* reserveStaging(VkDeviceSize size, VkDeviceSize& offset) {
+		if (size > stagingRing.size()) {
+			throw std::runtime_error("staging upload is larger than the ring buffer");
+		}
+		while (!stagingRing.reserve(size, stagingAlignment, offset)) {
+			flushUploads();
+			if (pendingUploads.empty()) {
+				throw std::runtime_error("failed to reserve staging memory");
+			}
+			retireUploads(true);
+		}
+		//预留的区间随当前批次释放，所以使用它的拷贝命令必须记录在这个批次中
+		uploadCommandBuffer();
+		return stagingRing.pointer(offset);
+	}
 
-		VkCommandBuffer commandBuffer = beginSigleTimeCommands();
+	void recordStagingCopy(VkDeviceSize stagingOffset, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size) {
 		VkBufferCopy copyRegion{};
 		copyRegion.size = size;
-		copyRegion.srcOffset = 0;
-		copyRegion.dstOffset = 0;
-		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-		endSigleTimeCommands(commandBuffer);
+		copyRegion.srcOffset = stagingOffset;
+		copyRegion.dstOffset = dstOffset;
+		vkCmdCopyBuffer(uploadCommandBuffer(), stagingRing.handle(), dstBuffer, 1, &copyRegion);
 	}
-	
 
-	VkCommandBuffer beginSigleTimeCommands() {
-		//GPU操作需要用命令来声明
-		//创建临时命令，使用原来的command pool，TODO：创建专门的command pool可以进行优化
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	//通过环形缓冲上传到device local的buffer，较大的数据分成多段拷贝，只记录命令，不等待完成
+	void uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0) {
+		const char* src = static_cast<const char*>(data);
+		VkDeviceSize maxChunk = stagingRing.size() / 4;
+		VkDeviceSize done = 0;
+		while (done < size) {
+			VkDeviceSize chunk = std::min(maxChunk, size - done);
+			VkDeviceSize offset;
+			memcpy(reserveStaging(chunk, offset), src + done, chunk);
+			recordStagingCopy(offset, dstBuffer, dstOffset + done, chunk);
+			done += chunk;
+		}
+		finishBufferUpload(dstBuffer);
+	}
 
-		VkCommandBuffer commandBuffer{};
-		if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate command bufferes");
+	//buffer的所有拷贝都已经记录，使用独立传输队列时在当前批次提交时把它的所有权转移给图形队列族
+	//分多个批次上传的buffer在最后一个批次之前一直属于传输队列族
+	void finishBufferUpload(VkBuffer buffer) {
+		if (dedicatedTransfer()) {
+			uploadCommandBuffer();
+			currentUpload.buffers.push_back(buffer);
 		}
+	}
 
-		//start recording the command buffer
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; //临时命令，只使用一次
+	//上传图像，较大的图像按行分成多段拷贝，上传结束后所有mip层的布局为VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	//pixels按texcache::levelOffsets的布局连续存放所有mip层
+	//blockBytes是每个纹素(块压缩格式为每个4x4块)的字节数，块压缩格式按块行拷贝
+	void uploadImage(VkImage image, VkFormat format, const void* pixels, uint32_t width, uint32_t height, uint32_t blockBytes,
+		uint32_t mipLevels = 1) {
+		recordImageLayoutTransition(uploadCommandBuffer(), image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+
+		const char* src = static_cast<const char*>(pixels);
+		uint32_t blockExtent = formatBlockExtent(format);
+		std::vector<size_t> levelOffsets = texcache::levelOffsets(width, height, mipLevels, blockExtent, blockBytes);
+		for (uint32_t level = 0; level < mipLevels; ++level) {
+			uint32_t levelWidth = mipgen::levelWidth(width, level);
+			uint32_t levelHeight = mipgen::levelHeight(height, level);
+			uint32_t blockRows = (levelHeight + blockExtent - 1) / blockExtent;
+			const char* levelPixels = src + levelOffsets[level];
+			VkDeviceSize rowPitch = VkDeviceSize((levelWidth + blockExtent - 1) / blockExtent) * blockBytes;
+			uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, stagingRing.size() / 4 / rowPitch));
+			//传输队列的minImageTransferGranularity(块压缩格式以块为单位): 分块的起始行必须是粒度的倍数，为0时只能整层一次拷贝
+			if (transferGranularity.height == 0) {
+				rowsPerChunk = blockRows;
+			} else if (transferGranularity.height > 1) {
+				rowsPerChunk = std::max(transferGranularity.height, rowsPerChunk / transferGranularity.height * transferGranularity.height);
+			}
+			for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+				uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+				VkDeviceSize offset;
+				memcpy(reserveStaging(rowPitch * rows, offset), levelPixels + rowPitch * row, rowPitch * rows);
+
+				VkBufferImageCopy region{};
+				region.bufferOffset = offset;
+				region.bufferRowLength = 0;
+				region.bufferImageHeight = 0;
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.baseArrayLayer = 0;
+				region.imageSubresource.layerCount = 1;
+				region.imageSubresource.mipLevel = level;
+				//偏移和大小以纹素为单位，块压缩格式在图像边缘的大小可以不是4的倍数
+				region.imageOffset = { 0, static_cast<int32_t>(row * blockExtent), 0 };
+				region.imageExtent = { levelWidth, std::min(rows * blockExtent, levelHeight - row * blockExtent), 1 };
+				//图像布局为最适合作为 transfer destination的布局
+				vkCmdCopyBufferToImage(uploadCommandBuffer(), stagingRing.handle(), image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			}
+		}
 
-		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-			throw std::runtime_error("failed to begin command buffer");
+		if (dedicatedTransfer()) {
+			//布局转换和所有权转移在提交批次时一起记录
+			uploadCommandBuffer();
+			currentUpload.images.push_back({ image, mipLevels });
+		} else {
+			recordImageLayoutTransition(uploadCommandBuffer(), image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
 		}
-		return commandBuffer;
 	}
 
-	void endSigleTimeCommands(VkCommandBuffer commandBuffer) {
-		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-			throw std::runtime_error("failed to record command buffer");
+	//所有权转移的release(在传输队列上)和acquire(在图形队列上)使用相同的barrier，只是access mask不同
+	void recordOwnershipTransfer(VkCommandBuffer commandBuffer, const std::vector<VkBuffer>& buffers, const std::vector<UploadImage>& images, bool release) {
+		const VkPipelineStageFlags consumerStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		for (VkBuffer buffer : buffers) {
+			VkBufferMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+			barrier.dstAccessMask = release ? 0 : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+			barrier.srcQueueFamilyIndex = indices.transferFamily;
+			barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+			barrier.buffer = buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			bufferBarriers.push_back(barrier);
+		}
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		for (const UploadImage& image : images) {
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+			barrier.dstAccessMask = release ? 0 : VK_ACCESS_SHADER_READ_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcQueueFamilyIndex = indices.transferFamily;
+			barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+			barrier.image = image.image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, image.mipLevels, 0, 1 };
+			imageBarriers.push_back(barrier);
+		}
+		if (bufferBarriers.empty() && imageBarriers.empty()) {
+			return;
+		}
+		//acquire的srcStage与等待信号量的stage相同，和信号量的等待组成依赖链
+		vkCmdPipelineBarrier(commandBuffer, release ? VK_PIPELINE_STAGE_TRANSFER_BIT : consumerStages,
+			release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : consumerStages, 0, 0, nullptr,
+			bufferBarriers.size(), bufferBarriers.data(), imageBarriers.size(), imageBarriers.data());
+	}
+
+	//提交当前批次，不等待完成，返回的token可以用waitUploads等待
+	//没有正在记录的批次时返回最后提交的批次的token
+	//使用独立传输队列时，拷贝提交到传输队列并发出信号量，图形队列上的acquire等待这个信号量，
+	//之后提交到图形队列的绘制会排在acquire之后，而在此之前提交的帧与传输并行执行
+	UploadToken flushUploads() {
+		if (currentUpload.commandBuffer == VK_NULL_HANDLE) {
+			return lastSubmittedUpload;
+		}
+		if (dedicatedTransfer()) {
+			recordOwnershipTransfer(currentUpload.commandBuffer, currentUpload.buffers, currentUpload.images, true);
+		} else {
+			//之后提交到同一队列的绘制指令会把上传的数据作为顶点、索引、uniform和纹理读取
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(currentUpload.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		if (vkEndCommandBuffer(currentUpload.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record upload command buffer");
 		}
 
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.pCommandBuffers = &currentUpload.commandBuffer;
+		if (!dedicatedTransfer()) {
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, currentUpload.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit upload command buffer");
+			}
+		} else {
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &currentUpload.semaphore;
+			if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit upload command buffer");
+			}
 
+			//图形队列上的acquire，fence在它完成时发出信号，此时传输也一定已经完成
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = commandPool;
+			allocInfo.commandBufferCount = 1;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			if (vkAllocateCommandBuffers(logiDevice, &allocInfo, &currentUpload.acquireCommandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate acquire command buffer");
+			}
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			if (vkBeginCommandBuffer(currentUpload.acquireCommandBuffer, &beginInfo) != VK_SUCCESS) {
+				throw std::runtime_error("failed to begin acquire command buffer");
+			}
+			recordOwnershipTransfer(currentUpload.acquireCommandBuffer, currentUpload.buffers, currentUpload.images, false);
+			if (vkEndCommandBuffer(currentUpload.acquireCommandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to record acquire command buffer");
+			}
 
-		VkFence fence{};
-		VkFenceCreateInfo fenceCI{};
-		fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		vkCreateFence(logiDevice, &fenceCI, nullptr, &fence);
+			VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+			VkSubmitInfo acquireInfo{};
+			acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			acquireInfo.waitSemaphoreCount = 1;
+			acquireInfo.pWaitSemaphores = &currentUpload.semaphore;
+			acquireInfo.pWaitDstStageMask = &waitStage;
+			acquireInfo.commandBufferCount = 1;
+			acquireInfo.pCommandBuffers = &currentUpload.acquireCommandBuffer;
+			if (vkQueueSubmit(graphicsQueue, 1, &acquireInfo, currentUpload.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit acquire command buffer");
+			}
+		}
+		stagingRing.close(currentUpload.id);
+		lastSubmittedUpload = currentUpload.id;
+		pendingUploads.push_back(std::move(currentUpload));
+		currentUpload = UploadBatch{};
+		return lastSubmittedUpload;
+	}
 
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+	//等待token对应的批次以及之前的批次完成，token对应的批次还在记录时先提交
+	void waitUploads(UploadToken token) {
+		if (currentUpload.commandBuffer != VK_NULL_HANDLE && currentUpload.id <= token) {
+			flushUploads();
+		}
+		while (!pendingUploads.empty() && pendingUploads.front().id <= token) {
+			retireUploads(true);
+		}
+	}
 
-		vkWaitForFences(logiDevice, 1, &fence, VK_TRUE, UINT64_MAX);
-		vkDestroyFence(logiDevice, fence, nullptr);
+	//回收已经完成的批次，waitOldest为true时先等待最早的批次完成
+	void retireUploads(bool waitOldest) {
+		while (!pendingUploads.empty()) {
+			UploadBatch& batch = pendingUploads.front();
+			if (waitOldest) {
+				vkWaitForFences(logiDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+				waitOldest = false;
+			} else if (vkGetFenceStatus(logiDevice, batch.fence) != VK_SUCCESS) {
+				break;
+			}
+			stagingRing.release(batch.id);
+			vkFreeCommandBuffers(logiDevice, uploadCommandPool, 1, &batch.commandBuffer);
+			if (batch.acquireCommandBuffer != VK_NULL_HANDLE) {
+				vkFreeCommandBuffers(logiDevice, commandPool, 1, &batch.acquireCommandBuffer);
+			}
+			vkResetFences(logiDevice, 1, &batch.fence);
+			freeUploadFences.push_back(batch.fence);
+			//信号量已经被acquire等待过，回到未发出信号的状态，可以直接重复使用
+			if (batch.semaphore != VK_NULL_HANDLE) {
+				freeUploadSemaphores.push_back(batch.semaphore);
+			}
+			pendingUploads.pop_front();
+		}
+	}
 
-		vkFreeCommandBuffers(logiDevice, commandPool, 1, &commandBuffer);
+	void destroyStagingRing() {
+		waitUploads(flushUploads());
+		for (VkFence fence : freeUploadFences) {
+			vkDestroyFence(logiDevice, fence, nullptr);
+		}
+		freeUploadFences.clear();
+		for (VkSemaphore semaphore : freeUploadSemaphores) {
+			vkDestroySemaphore(logiDevice, semaphore, nullptr);
+		}
+		freeUploadSemaphores.clear();
+		vkDestroyBuffer(logiDevice, stagingRingBuffer, nullptr);
+		allocator.free(stagingRingMemory);
 	}
 
 	void createDescriptorSetLayout() {
@@ -1679,40 +2766,54 @@ private:
 
 	void cleanupSwapChain() {
 		//销毁深度缓冲相对象
-		vkDestroyImageView(logiDevice, depthImageView, nullptr);
-		vkFreeMemory(logiDevice, depthImageMemory, nullptr);
+		imageViewCache.release(depthImageView);
+		allocator.free(depthImageMemory);
 		vkDestroyImage(logiDevice, depthImage, nullptr);
 
-		//释放commandBuffers
-		vkFreeCommandBuffers(logiDevice, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-
-
 		//销毁swap chain Frambuffer对象
 		for (auto&& frameBuffer : swapChainFrambuffers) {
 			vkDestroyFramebuffer(logiDevice, frameBuffer, nullptr);
 		}
+		//销毁VkImageView对象
+		for (auto&& imageView : swapChainImageViews) {
+			imageViewCache.release(imageView);
+		}
+		//All child objects created on device must have been destroyed prior to destroying device
+		if (headless) {
+			//离屏图像和读回缓冲是自己创建的，没有交换链
+			for (size_t i = 0; i < swapChainImages.size(); ++i) {
+				allocator.free(offscreenImageMemory[i]);
+				vkDestroyImage(logiDevice, swapChainImages[i], nullptr);
+			}
+			for (auto&& readback : readbacks) {
+				allocator.free(readback.memory);
+				vkDestroyBuffer(logiDevice, readback.buffer, nullptr);
+			}
+			offscreenImageMemory.clear();
+			readbacks.clear();
+		} else {
+			vkDestroySwapchainKHR(logiDevice, swapChain, nullptr);
+		}
+	}
+
+	//render pass和管线不随交换链重建，只在格式改变和程序结束时销毁
+	void destroyPipelineObjects() {
 		//销毁render pass
 		vkDestroyRenderPass(logiDevice, renderPass, nullptr);
 		//销毁pipeline layout 对象
 		vkDestroyPipelineLayout(logiDevice, pipelineLayout, nullptr); //layout 对象在createPipeline中创建
 		//销毁pipeline 对象
 		vkDestroyPipeline(logiDevice, graphicsPipeline, nullptr);
-		//销毁VkImageView对象
-		for (auto&& imageView : swapChainImageViews) {
-			vkDestroyImageView(logiDevice, imageView, nullptr);
-		}
-		//All child objects created on device must have been destroyed prior to destroying device
-		vkDestroySwapchainKHR(logiDevice, swapChain, nullptr);
 	}
 
-	void createImage( uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlagBits properties, VkImage &image, VkDeviceMemory &memory){
+	void createImage( uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlagBits properties, VkImage &image, DeviceAllocation &memory){
 		VkImageCreateInfo imageCI{};
 		imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageCI.imageType = VK_IMAGE_TYPE_2D;
 		imageCI.extent.width = width;
 		imageCI.extent.height = height;
 		imageCI.extent.depth = 1;
-		imageCI.mipLevels = 1;
+		imageCI.mipLevels = mipLevels;
 		imageCI.arrayLayers = 1;
 		imageCI.format = format;
 		imageCI.tiling = tiling; //对方问优化的方式排列
@@ -1729,68 +2830,97 @@ private:
 
 
 		//显卡可以分配不同类型的内存作为缓冲使用。不同类型的内存所允许进行的操作以及操作的效率有所不同
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size; //需要的分配的size 不一定时 createInfo中的size
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+		//大图像(例如高分辨率的纹理和深度缓冲)独立分配，避免占用块中的大段连续空间
+		bool dedicated = memRequirements.size >= dedicatedImageSize;
+		memory = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), tiling == VK_IMAGE_TILING_LINEAR, dedicated);
 
+		//image与memory的绑定
+		vkBindImageMemory(logiDevice, image, memory.memory, memory.offset);
+	}
+
+	//块压缩格式的块宽高，不压缩的格式为1
+	uint32_t formatBlockExtent(VkFormat format) {
+		bcn::Format blockFormat;
+		return blockCompressedFormat(format, blockFormat) ? 4 : 1;
+	}
+
+	bool blockCompressedFormat(VkFormat format, bcn::Format& blockFormat) {
+		switch (format) {
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK: blockFormat = bcn::Format::BC1; return true;
+		case VK_FORMAT_BC3_SRGB_BLOCK: blockFormat = bcn::Format::BC3; return true;
+		case VK_FORMAT_BC7_SRGB_BLOCK: blockFormat = bcn::Format::BC7; return true;
+		default: return false;
+		}
+	}
 
-		//分配内存
-		if (vkAllocateMemory(logiDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate buffer memory");
+	//纹理格式: textureCompression指定的BC格式可以用线性过滤采样时使用它，否则使用RGBA8
+	VkFormat findTextureFormat() {
+		std::vector<VkFormat> candidates;
+		if (textureCompressionBC) {
+			switch (textureCompression) {
+			case TextureCompression::BC1: candidates.push_back(VK_FORMAT_BC1_RGB_SRGB_BLOCK); break;
+			case TextureCompression::BC3: candidates.push_back(VK_FORMAT_BC3_SRGB_BLOCK); break;
+			case TextureCompression::BC7: candidates.push_back(VK_FORMAT_BC7_SRGB_BLOCK); break;
+			case TextureCompression::None: break;
+			}
 		}
+		candidates.push_back(VK_FORMAT_R8G8B8A8_SRGB);
+		return findSupportedFormat(candidates, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+	}
 
-		//buffer与memory的绑定
-		vkBindImageMemory(logiDevice, image, memory, 0);
+	//把纹理交给textureLoader，解码(或者映射烘焙文件)、生成mip层和压缩都作为任务在jobs上完成
+	void startTextureLoads() {
+		textureFormat = findTextureFormat();
+		bcn::Format blockFormat = bcn::Format::BC7;
+		TextureRequest request;
+		request.path = textureRootDir + "/viking_room.png";
+		request.cookedPath = request.path + ".texcache";
+		request.vkFormat = textureFormat;
+		request.srgb = true;
+		request.mipmaps = true;
+		request.compress = blockCompressedFormat(textureFormat, blockFormat);
+		request.blockFormat = blockFormat;
+		textureLoadId = textureLoader.load(std::move(request));
 	}
 
 	//加载图像到vk对象中
+	//textureLoader按完成的顺序返回纹理，每个纹理完成后立即创建图像并记录上传，不等待其余的纹理
 	void createTextureImage() {
-		//需要使用指令缓冲来完成加载
-		int texWidth, texHeight, texChannels;
-		stbi_uc* pixels = stbi_load((textureRootDir + "/viking_room.png").c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha); //强制加载进alpha通道
-		if (!pixels) {
-			throw std::runtime_error("failed to load texture");
+		LoadedTexture texture;
+		while (textureLoader.next(texture)) {
+			if (!texture.error.empty()) {
+				throw std::runtime_error(texture.error);
+			}
+			if (texture.id == textureLoadId) {
+				createLoadedTexture(texture, textureImage, textureImageMemory);
+				textureMipLevels = texture.levelCount;
+			}
+			std::cout << "load texture: " << texture.path << ", " << texture.width << "x" << texture.height << ", " << texture.levelCount << " levels, "
+				<< (texture.fromCache ? "from cooked file, " : "decoded, ") << texture.loadMs << " ms in loader job" << std::endl;
 		}
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
+	}
 
-		//创建textureImage和textureImageMemory，并将两者绑定
-		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-		
-		
+	void createLoadedTexture(const LoadedTexture& texture, VkImage& image, DeviceAllocation& memory) {
 		/*
 		尽管，我们可以在着色器直接访问缓冲中的像素数据，但使用vk的
 		图像对象会更好。VkImage的图像对象允许我们使用二维坐标来快速获取颜
 		色数据。图像对象的像素数据也被叫做纹素。VkImage可以进行快速sampler*/
 
-		//使用staging buffer将主存中的数据最终转移到GPU的local区域
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-		
-		void* data;
-		vkMapMemory(logiDevice, stagingMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, imageSize);
-		vkUnmapMemory(logiDevice, stagingMemory);
-		
-		stbi_image_free(pixels);
-
-		
+		//加载服务总是在CPU上生成完整的mip链(解码后生成并写入烘焙文件，或者直接来自烘焙文件)，所有层都直接上传
+		//不在GPU上用blit重新生成，第一次运行和之后从烘焙文件加载时采样到的mip层完全相同
+		createImage(texture.width, texture.height, texture.levelCount, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory);
 
-		transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		copyBufferToImage(stagingBuffer, textureImage, texWidth, texHeight);
-		transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		
-		vkFreeMemory(logiDevice, stagingMemory, nullptr);
-		vkDestroyBuffer(logiDevice, stagingBuffer, nullptr);
+		//使用staging环形缓冲将主存中的数据最终转移到GPU的local区域，布局转换和拷贝记录在同一个上传批次中
+		uploadImage(image, textureFormat, texture.pixels(), texture.width, texture.height, texture.blockBytes, texture.levelCount);
 	}
 
 	void createTextureImageView() {
-		textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB);
+		textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, textureMipLevels);
 	}
 	//change the image layout
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-		VkCommandBuffer commandBuffer =  beginSigleTimeCommands();
+	//把布局转换的barrier记录到commandBuffer中，不单独提交
+	void recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1) {
 		//pipeline barrire
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1814,7 +2944,7 @@ private:
 
 		barrier.subresourceRange.layerCount = 1;
 		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.levelCount = mipLevels;
 		barrier.subresourceRange.baseMipLevel = 0;
 
 
@@ -1844,32 +2974,8 @@ private:
 		}
 
 		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-		endSigleTimeCommands(commandBuffer);
 	}
 
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-		VkCommandBuffer commandBuffer = beginSigleTimeCommands();
-
-		VkBufferImageCopy region{};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-		region.imageSubresource.mipLevel = 0;
-	
-		region.imageOffset = { 0, 0, 0 };
-		region.imageExtent = { width, height, 1 };
-
-		//图像布局为最适合作为 transfer destination的布局
-		vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		endSigleTimeCommands(commandBuffer);
-	}
-	
 	void createTextureSampler() {
 		VkSamplerCreateInfo samplerCI{};
 		samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1894,11 +3000,10 @@ private:
 		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerCI.mipLodBias = 0.f; //TODO
 		samplerCI.minLod = 0.f; 
-		samplerCI.maxLod = 0.f;
+		samplerCI.maxLod = static_cast<float>(textureMipLevels);
 
-		if (vkCreateSampler(logiDevice, &samplerCI, nullptr, &textureSampler) != VK_SUCCESS) {
-			throw std::runtime_error("unsupported create sampler");
-		}
+		//参数相同的纹理共享同一个采样器
+		textureSampler = samplerCache.acquire(samplerCI);
 
 	}
 
@@ -1934,28 +3039,25 @@ private:
 	void createDepthResources() {
 		VkFormat depthForamt = findDepthFormat();
 		//usage VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT 指定该image作为深度图使用
-		createImage(extent.width, extent.height, depthForamt, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+		createImage(extent.width, extent.height, 1, depthForamt, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
 
 		depthImageView =  createImageView(depthImage, depthForamt, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-		//更改depth image的layout使得它使用与作为深度图
-		transitionImageLayout(depthImage, depthForamt, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		//depth image的布局由render pass转换(initialLayout为UNDEFINED)
 	}
 	void cleanup() {
 
 
 		//销毁texutre相关的对象
-		vkDestroySampler(logiDevice, textureSampler, nullptr);
-		vkDestroyImageView(logiDevice, textureImageView, nullptr);
-		vkFreeMemory(logiDevice, textureImageMemory, nullptr);
+		samplerCache.release(textureSampler);
+		imageViewCache.release(textureImageView);
+		allocator.free(textureImageMemory);
 		vkDestroyImage(logiDevice, textureImage, nullptr);
 
 
 
 		//销毁uniform缓冲对象，释放设备内存，取消映射
 		for (int i = 0, n = swapChainImages.size(); i < n; ++i) {
-			vkUnmapMemory(logiDevice, uniformBuffersMemory[i]);
-			vkFreeMemory(logiDevice, uniformBuffersMemory[i], nullptr);
+			allocator.free(uniformBuffersMemory[i]);
 			vkDestroyBuffer(logiDevice, uniformBuffers[i], nullptr);
 		}
 		//销毁Descirptor pool
@@ -1967,13 +3069,14 @@ private:
 
 		//销毁与交换链相关的所有对象
 		cleanupSwapChain();
+		destroyPipelineObjects();
 
 		//销毁顶点缓冲对象，释放缓冲占用设备内存
-		vkFreeMemory(logiDevice, vertexBufferMemory, nullptr);
+		allocator.free(vertexBufferMemory);
 		vkDestroyBuffer(logiDevice, vertexBuffer, nullptr);
 
 		////销毁顶点索引缓冲对象，释放缓冲占用设备内存
-		vkFreeMemory(logiDevice, indexBufferMemory, nullptr);
+		allocator.free(indexBufferMemory);
 		vkDestroyBuffer(logiDevice, indexBuffer, nullptr);
 
 		//销毁每一帧的信号量对象和fence对象
@@ -1982,16 +3085,42 @@ private:
 			vkDestroySemaphore(logiDevice, renderFinishedSemaphores[i], nullptr);
 			vkDestroyFence(logiDevice, inFlightFences[i], nullptr);
 		}
+		gpuTimestamps.destroy();
 
 
+		//等待上传批次完成，销毁staging环形缓冲
+		destroyStagingRing();
+
 		//销毁commmand pool对象
+		vkDestroyCommandPool(logiDevice, uploadCommandPool, nullptr);
 		vkDestroyCommandPool(logiDevice, commandPool, nullptr);
+		//指令缓冲随指令池一起释放
+		for (auto&& pool : frameCommandPools) {
+			vkDestroyCommandPool(logiDevice, pool, nullptr);
+		}
+		for (auto&& framePools : recordPools) {
+			for (auto&& recordPool : framePools) {
+				vkDestroyCommandPool(logiDevice, recordPool.pool, nullptr);
+			}
+		}
+
+
+		//保存并销毁管线cache
+		destroyPipelineCache();
+
+		//销毁缓存中剩余的采样器和image view
+		samplerCache.destroy();
+		imageViewCache.destroy();
 
+		//所有资源都已经销毁，释放allocator持有的内存块
+		allocator.destroy();
 
 		//逻辑设备对象创建后，应用程序结束前，需要手动清除
 		vkDestroyDevice(logiDevice, nullptr);
 		//销毁surface
-		vkDestroySurfaceKHR(instance, surface, nullptr);
+		if (!headless) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
 		
 		//销毁validation layer对象
 		if (enableValidationLayers) {
@@ -2005,17 +3134,133 @@ private:
 		//销毁instance
 		vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
-
-        glfwTerminate();
+		if (!headless) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
     }
 
 	void mainLoop() {
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
-			drawFrame();
+		//改变窗口大小的压力测试需要窗口
+		if (resizeStormCount > 0 && !headless) {
+			runResizeStorm();
+		}
+		if (recordBenchmarkFrames > 0) {
+			runRecordBenchmark();
+		}
+		if (headless) {
+			runHeadless();
+		} else {
+			while (!glfwWindowShouldClose(window)) {
+				glfwPollEvents();
+				drawFrame();
+			}
 		}
 		vkDeviceWaitIdle(logiDevice);
+		if (recordedFrames > 0) {
+			std::cout << "record commands: " << recordTimeMs * 1000.0 / recordedFrames << " us per frame over " << recordedFrames << " frames" << std::endl;
+		}
+		//设备已经空闲，读取最后几帧的时间戳
+		for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+			resolveGpuTimestamps(frame);
+		}
+		if (frameStatsInterval > 0) {
+			printFrameStats();
+		}
+		if (!frameTracePath.empty()) {
+			if (frameTrace.write(frameTracePath)) {
+				std::cout << "frame trace: " << frameTracePath << std::endl;
+			} else {
+				std::cerr << "failed to write frame trace: " << frameTracePath << std::endl;
+			}
+		}
+	}
+
+	//无窗口模式: 连续渲染headlessFrameCount帧，等待设备空闲后处理最后几帧的读回，输出吞吐量
+	void runHeadless() {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < headlessFrameCount; ++i) {
+			drawOffscreenFrame();
+		}
+		vkDeviceWaitIdle(logiDevice);
+		for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+			processReadback(frame);
+		}
+		//写文件的任务失败时在这里抛出
+		for (auto&& write : readbackWrites) {
+			jobs.wait(write);
+		}
+		readbackWrites.clear();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "headless: " << headlessFrameCount << " frames at " << extent.width << "x" << extent.height << " in " << ms << " ms, "
+			<< (ms > 0 ? headlessFrameCount * 1000.0 / ms : 0.0) << " frames/s" << std::endl;
+		if (headlessFrameCount > 0) {
+			std::cout << "headless: last frame hash " << std::hex << lastFrameHash << std::dec << std::endl;
+		}
+	}
+
+	//在两个尺寸之间连续切换窗口大小，每次切换后重建交换链并画一帧，统计重建交换链的停顿(包括等待GPU空闲)
+	void runResizeStorm() {
+		for (bool rebuildPipeline : { true, false }) {
+			double totalMs = 0, maxMs = 0;
+			for (uint32_t i = 0; i < resizeStormCount; ++i) {
+				int width = i % 2 ? WIDTH : WIDTH * 3 / 4;
+				int height = i % 2 ? HEIGHT : HEIGHT * 3 / 4;
+				glfwSetWindowSize(window, width, height);
+				glfwPollEvents();
+
+				auto start = std::chrono::high_resolution_clock::now();
+				recreateSwapChain(rebuildPipeline);
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				totalMs += ms;
+				maxMs = std::max(maxMs, ms);
+				frameBufferResized = false;
+				drawFrame();
+			}
+			std::cout << "resize storm (" << (rebuildPipeline ? "rebuild render pass + pipeline" : "dynamic viewport/scissor") << "): "
+				<< resizeStormCount << " resizes, " << totalMs / resizeStormCount << " ms average, " << maxMs << " ms max" << std::endl;
+		}
+		glfwSetWindowSize(window, WIDTH, HEIGHT);
+	}
+
+	//对每种绘制调用数，分别用1, 2, 4...个线程记录指令，统计每帧记录指令的CPU时间(包括重置指令池)
+	void runRecordBenchmark() {
+		uint32_t configuredThreads = activeRecordThreads;
+		for (uint32_t drawCount : { 1000u, 10000u, 100000u }) {
+			drawList = buildDrawList(drawCount);
+			std::vector<uint32_t> threadCounts;
+			for (uint32_t threads = 1; threads < jobs.size(); threads *= 2) {
+				threadCounts.push_back(threads);
+			}
+			threadCounts.push_back(jobs.size());
+			for (uint32_t threads : threadCounts) {
+				activeRecordThreads = threads;
+				recordTimeMs = 0;
+				recordedFrames = 0;
+				for (uint32_t i = 0; i < recordBenchmarkFrames; ++i) {
+					if (headless) {
+						drawOffscreenFrame();
+					} else {
+						glfwPollEvents();
+						drawFrame();
+					}
+				}
+				std::cout << "record benchmark: " << drawList.size() << " draws, " << threads << (threads == 1 ? " thread (inline)" : " threads (secondary)") << ": "
+					<< (recordedFrames > 0 ? recordTimeMs * 1000.0 / recordedFrames : 0.0) << " us per frame" << std::endl;
+			}
+		}
+		drawList = buildDrawList(drawCallCount);
+		activeRecordThreads = configuredThreads;
+		recordTimeMs = 0;
+		recordedFrames = 0;
+		//压力测试画的帧不算作无窗口模式的输出，丢弃它们的读回，帧的编号和动画从0开始
+		if (headless) {
+			vkDeviceWaitIdle(logiDevice);
+			for (auto&& readback : readbacks) {
+				readback.frame = -1;
+			}
+			headlessFrameIndex = 0;
+		}
 	}
 
 private:
@@ -2030,8 +3275,18 @@ private:
 
 	//逻辑设备，选择物理设备后，我们还需要一个逻辑设备来作为和物理设备交互的接口
 	VkDevice logiDevice;
+	//buffer和image的设备内存从allocator中子分配
+	DeviceAllocator allocator;
+	//按create info共享的采样器和image view
+	SamplerCache samplerCache;
+	ImageViewCache imageViewCache;
+	//所有管线共享的cache，数据在启动和退出时与pipelineCachePath同步
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	uint64_t pipelineCacheLoadedHash = 0;	//启动时读取的数据的hash，退出时内容没有变化就不写文件
 	//创建逻辑设备时指定的队列会随着逻辑设备一同被创建，为了方便，我们添加了一个成员变量来直接存储逻辑设备的队列句柄
 	VkQueue graphicsQueue;
+	VkQueue transferQueue;
+	VkExtent3D transferGranularity;
 	VkQueue presentQueue;
 
 	//surface
@@ -2045,8 +3300,19 @@ private:
 	VkPresentModeKHR  presentMode;
 	VkExtent2D  extent;
 
-	//获取交换链图像的图像句柄。之后使用这些图像句柄进行渲染操作。
+	//获取交换链图像的图像句柄。之后使用这些图像句柄进行渲染操作。无窗口模式下是离屏图像
 	std::vector<VkImage> swapChainImages;
+	//无窗口模式: 离屏图像的内存，以及每张图像的读回缓冲，frame是缓冲中等待处理的帧的编号，-1表示没有
+	struct Readback {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		DeviceAllocation memory;
+		int64_t frame = -1;
+	};
+	std::vector<DeviceAllocation> offscreenImageMemory;
+	std::vector<Readback> readbacks;
+	std::vector<JobSystem::JobHandle> readbackWrites;	//还没有等待的写文件任务
+	uint64_t headlessFrameIndex = 0;
+	uint64_t lastFrameHash = 0;
 	//imageView描述了访问图像的方式，以及那一部分可以被访问
 	std::vector<VkImageView> swapChainImageViews;
 
@@ -2059,6 +3325,8 @@ private:
 
 	//render pass
 	VkRenderPass renderPass;
+	//创建render pass时交换链图像的格式，重建交换链后格式不同时才需要重建render pass和管线
+	VkFormat renderPassFormat = VK_FORMAT_UNDEFINED;
 
 	//graphics pipeline， pipeline state object，就是配置所有影响渲染/计算管线的状态，在Vulkan中状态的改变一般需要重新创建管线，而在OpenGL中状态是可以随时改变的
 	VkPipeline graphicsPipeline;
@@ -2076,9 +3344,45 @@ private:
 	缓冲对象提交给vk处理接口。*/
 	//指令池对象用于管理指令缓冲对象使用的内存，并负责指令缓冲对象的分配
 	VkCommandPool commandPool;
-
-	//指令缓冲对象，记录绘制指令
+	VkCommandPool uploadCommandPool;
+	//staging环形缓冲和上传批次，每个批次是一个指令缓冲和一个fence
+	//使用独立传输队列时还有图形队列上的acquire指令缓冲、两者之间的信号量，以及需要转移所有权的资源
+	struct UploadBatch {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t id = 0;
+		std::vector<VkBuffer> buffers;
+		std::vector<UploadImage> images;
+	};
+	VkBuffer stagingRingBuffer;
+	DeviceAllocation stagingRingMemory;
+	StagingRing stagingRing;
+	UploadBatch currentUpload;				//正在记录的批次
+	std::deque<UploadBatch> pendingUploads;	//已经提交，还没有确认完成的批次
+	std::vector<VkFence> freeUploadFences;
+	std::vector<VkSemaphore> freeUploadSemaphores;
+	uint64_t nextUploadId = 1;
+	UploadToken lastSubmittedUpload = 0;
+
+	//每个并行帧的指令池和指令缓冲，记录绘制指令
+	std::vector<VkCommandPool> frameCommandPools;
 	std::vector<VkCommandBuffer> commandBuffers;
+	//并行记录时每帧每个调度器线程的指令池，[帧][线程]，used是这一帧已经使用的辅助指令缓冲数
+	struct RecordPool {
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> buffers;
+		size_t used = 0;
+	};
+	std::vector<std::vector<RecordPool>> recordPools;
+	std::vector<VkCommandBuffer> secondaryCommandBuffers;	//当前帧每段的辅助指令缓冲，按段的顺序执行
+	uint32_t activeRecordThreads = 1;
+	//每一帧的绘制调用，都来自同一个顶点/索引缓冲
+	std::vector<DrawRange> drawList;
+	//记录绘制指令花费的CPU时间，程序结束时输出每帧的平均值
+	double recordTimeMs = 0;
+	uint64_t recordedFrames = 0;
 
 	//信号量：用于通知可渲染，可呈现的事件
 	//VkSemaphore imageAvaliableSemaphore;
@@ -2113,21 +3417,40 @@ private:
 		4,5,6,6,7,4
 	};
 
+	//当前使用的模型数据，指向vertices/vertexIndices，或者指向meshCacheFile映射的内存
+	struct MeshView {
+		const Vertex* vertices = nullptr;
+		uint32_t vertexCount = 0;
+		const uint32_t* indices = nullptr;
+		uint32_t indexCount = 0;
+	};
+	MeshView mesh;
+	//模型的二进制缓存文件，在mesh使用期间保持映射
+	MappedFile meshCacheFile;
+	//非空时表示模型太大，在initVulkan中流式上传；hash和大小用来写网格缓存
+	std::string streamingModelPath;
+	std::unique_ptr<objstream::AttributeSpill> streamingAttributes;	//第一遍读取的v/vt，streamModel结束后删除
+	uint64_t streamingSourceHash = 0;
+	uint64_t streamingSourceSize = 0;
+	//实际使用的顶点格式，流式加载时无法预先知道包围盒，总是使用Vertex
+	VertexLayout activeVertexLayout = vertexLayout;
+	glm::mat4 vertexDequantize = glm::mat4(1.f);
+
 	//vk的缓冲是可以存储任意数据的可以被显卡读取的内存。
 	//顶点缓冲句柄
 	VkBuffer vertexBuffer;
 	//顶点缓冲所使用的内存对象
-	VkDeviceMemory vertexBufferMemory;
+	DeviceAllocation vertexBufferMemory;
 
 	//顶点索引缓冲
 	VkBuffer indexBuffer;
 	//顶点索引缓冲所使用的内存对象
-	VkDeviceMemory indexBufferMemory;
+	DeviceAllocation indexBufferMemory;
 
 	//uinform 对象缓冲
 	//为并行渲染的多个帧都创建uniformbuffer，因为一个线程在读uniform对象时，为另一个线程准备数据可能会修改它
 	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VkDeviceMemory> uniformBuffersMemory;
+	std::vector<DeviceAllocation> uniformBuffersMemory;
 	std::vector<void*> uniformBuffersMapped;
 
 
@@ -2138,15 +3461,41 @@ private:
 
 	
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	DeviceAllocation textureImageMemory;
+	uint32_t textureMipLevels = 1;
+	VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	//设备是否开启了textureCompressionBC特性
+	bool textureCompressionBC = false;
+	//纹理加载任务在jobs上执行，initVulkan中创建逻辑设备之后开始加载；jobs声明在后面，这里只保存引用
+	TextureLoader textureLoader{ jobs };
+	uint32_t textureLoadId = 0;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 
 	//深度像相关
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	DeviceAllocation depthImageMemory;
 	VkImageView depthImageView;
 
+	//帧时间统计和trace，GPU时间戳按currentFrame使用各自的query pool
+	profiler::Trace frameTrace;
+	profiler::GpuTimestamps gpuTimestamps;
+	profiler::RollingStats frameTimeStats;
+	profiler::RollingStats cpuTimeStats;
+	profiler::RollingStats gpuTimeStats;
+	std::chrono::high_resolution_clock::time_point lastFrameStart;
+	uint64_t statsFrameCount = 0;
+
+	//程序开始的时间，启动时间线和第一帧的时间都相对于它
+	std::chrono::high_resolution_clock::time_point appStartTime;
+	bool firstFramePresented = false;
+	//初始化时在工作线程上读取的shader代码和压缩后的顶点
+	std::vector<char> vertShaderCode;
+	std::vector<char> fragShaderCode;
+	std::vector<uint8_t> packedVertices;
+
+	//任务调度器放在最后，最先析构: 初始化中途抛出异常时，等待还在执行、访问其他成员的任务结束
+	JobSystem jobs;
 
 };
 
@@ -0,0 +1,149 @@
+﻿#pragma once
+//只读的文件内存映射，用来避免把大文件(模型缓存、纹理缓存等)先read到一块堆内存中再拷贝一次
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX //windows.h中的min/max宏会破坏std::numeric_limits<T>::max()
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path) {
+		open(path);
+	}
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept {
+		*this = std::move(other);
+	}
+	MappedFile& operator=(MappedFile&& other) noexcept {
+		if (this != &other) {
+			close();
+			ptr = other.ptr;
+			length = other.length;
+			opened = other.opened;
+#ifdef _WIN32
+			fileHandle = other.fileHandle;
+			mappingHandle = other.mappingHandle;
+			other.fileHandle = INVALID_HANDLE_VALUE;
+			other.mappingHandle = nullptr;
+#endif
+			other.ptr = nullptr;
+			other.length = 0;
+			other.opened = false;
+		}
+		return *this;
+	}
+
+	//打开并映射整个文件，文件不存在或者映射失败时返回false
+	bool open(const std::string& path) {
+		close();
+#ifdef _WIN32
+		fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize{};
+		if (!GetFileSizeEx(fileHandle, &fileSize)) {
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(fileSize.QuadPart);
+		//空文件不能创建映射对象，但作为一个合法的空文件返回
+		if (length > 0) {
+			mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mappingHandle == nullptr) {
+				close();
+				return false;
+			}
+			ptr = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+			if (ptr == nullptr) {
+				close();
+				return false;
+			}
+		}
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st {};
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		length = static_cast<size_t>(st.st_size);
+		if (length > 0) {
+			void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				length = 0;
+				return false;
+			}
+			//顺序读取的提示，让内核提前预读
+			madvise(p, length, MADV_SEQUENTIAL);
+			ptr = static_cast<const uint8_t*>(p);
+		}
+		::close(fd); //映射建立后文件描述符就不再需要了
+#endif
+		opened = true;
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (ptr) {
+			UnmapViewOfFile(ptr);
+		}
+		if (mappingHandle) {
+			CloseHandle(mappingHandle);
+		}
+		if (fileHandle != INVALID_HANDLE_VALUE) {
+			CloseHandle(fileHandle);
+		}
+		mappingHandle = nullptr;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (ptr) {
+			munmap(const_cast<uint8_t*>(ptr), length);
+		}
+#endif
+		ptr = nullptr;
+		length = 0;
+		opened = false;
+	}
+
+	bool isOpen() const { return opened; }
+	const uint8_t* data() const { return ptr; }
+	size_t size() const { return length; }
+
+private:
+	const uint8_t* ptr = nullptr;
+	size_t length = 0;
+	bool opened = false;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,140 @@
+﻿#pragma once
+//模型的二进制缓存: 直接保存最终上传到GPU的顶点数组和索引数组，热启动时映射文件后直接使用，跳过obj的文本解析
+//文件布局: MeshCacheHeader | indexCount 个 uint32_t 索引 | vertexCount * vertexStride 字节的顶点
+//索引在前: 流式写入时索引数量在开始时就知道，顶点数量要到最后才知道
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "mapped_file.h"
+#include "file_util.h"
+
+namespace meshcache {
+
+	const uint32_t MAGIC = 0x434d4b56; //"VKMC"
+	//顶点布局或者生成顶点的逻辑(例如去重、重排)改变时需要增加版本号，使旧的缓存失效
+	//2: 顶点和索引经过mesh_optimizer.h重排
+	//3: 索引放在顶点之前，reserved改为flags，流式加载的结果带有FLAG_STREAMED
+	const uint32_t VERSION = 3;
+
+	//流式加载的结果只在每块之内焊接和重排，块之间的重复顶点没有合并
+	//模型变小到可以完整解析时(例如修改了流式加载的阈值)，带有这个标记的缓存应当重新生成
+	const uint32_t FLAG_STREAMED = 1;
+
+	struct MeshCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;	//源obj文件内容的hash
+		uint64_t sourceSize;
+		uint32_t vertexStride;	//sizeof(Vertex)，顶点结构改变时缓存同样失效
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t flags;
+	};
+	static_assert(sizeof(MeshCacheHeader) % 8 == 0, "mesh cache header must keep the payload aligned");
+
+	//缓存文件中数据的视图，指针指向映射的内存
+	struct MeshCacheView {
+		const void* vertices = nullptr;
+		uint32_t vertexCount = 0;
+		const uint32_t* indices = nullptr;
+		uint32_t indexCount = 0;
+		uint32_t flags = 0;
+	};
+
+	//检查缓存文件是否和源文件匹配，匹配时填充view
+	inline bool read(const MappedFile& file, uint64_t sourceHash, uint64_t sourceSize, uint32_t vertexStride, MeshCacheView& view) {
+		if (!file.isOpen() || file.size() < sizeof(MeshCacheHeader)) {
+			return false;
+		}
+		MeshCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != MAGIC || header.version != VERSION || header.sourceHash != sourceHash
+			|| header.sourceSize != sourceSize || header.vertexStride != vertexStride) {
+			return false;
+		}
+		uint64_t vertexBytes = static_cast<uint64_t>(header.vertexCount) * header.vertexStride;
+		uint64_t indexBytes = static_cast<uint64_t>(header.indexCount) * sizeof(uint32_t);
+		if (sizeof(MeshCacheHeader) + vertexBytes + indexBytes != file.size()) {
+			return false; //文件被截断，例如上次写入时程序崩溃
+		}
+		view.indices = reinterpret_cast<const uint32_t*>(file.data() + sizeof(MeshCacheHeader));
+		view.indexCount = header.indexCount;
+		view.vertices = file.data() + sizeof(MeshCacheHeader) + indexBytes;
+		view.vertexCount = header.vertexCount;
+		view.flags = header.flags;
+		return true;
+	}
+
+	inline MeshCacheHeader makeHeader(uint64_t sourceHash, uint64_t sourceSize, uint32_t vertexStride, uint32_t vertexCount, uint32_t indexCount, uint32_t flags = 0) {
+		MeshCacheHeader header{};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.sourceHash = sourceHash;
+		header.sourceSize = sourceSize;
+		header.vertexStride = vertexStride;
+		header.vertexCount = vertexCount;
+		header.indexCount = indexCount;
+		header.flags = flags;
+		return header;
+	}
+
+	//先写到临时文件再重命名，保证不会留下写了一半的缓存
+	inline bool write(const std::string& path, uint64_t sourceHash, uint64_t sourceSize, uint32_t vertexStride,
+		const void* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount) {
+		MeshCacheHeader header = makeHeader(sourceHash, sourceSize, vertexStride, vertexCount, indexCount);
+		return fileutil::atomicWriteFile(path, {
+			{ &header, sizeof(header) },
+			{ indices, size_t(indexCount) * sizeof(uint32_t) },
+			{ vertices, size_t(vertexCount) * vertexStride },
+		});
+	}
+
+	//边生成边写缓存，用于流式加载的超大模型，不需要在内存中保留完整的顶点和索引数组
+	//索引数量在开始时确定，索引区的大小固定，所以索引和顶点可以按块交替追加到各自的区域；顶点数量在finish时回填到头中
+	//finish时索引数量不符或者写入失败都不会留下缓存文件
+	class StreamWriter {
+	public:
+		StreamWriter(const std::string& path, uint64_t sourceHash, uint64_t sourceSize, uint32_t vertexStride, uint32_t indexCount, uint32_t flags)
+			: file(path), header(makeHeader(sourceHash, sourceSize, vertexStride, 0, indexCount, flags)) {
+			file.write(&header, sizeof(header));
+		}
+
+		bool appendIndices(const uint32_t* indices, uint32_t count) {
+			if (uint64_t(indicesWritten) + count > header.indexCount) {
+				return false;
+			}
+			uint64_t offset = sizeof(MeshCacheHeader) + uint64_t(indicesWritten) * sizeof(uint32_t);
+			indicesWritten += count;
+			return file.writeAt(offset, indices, size_t(count) * sizeof(uint32_t));
+		}
+
+		bool appendVertices(const void* vertices, uint32_t count) {
+			if (uint64_t(verticesWritten) + count > UINT32_MAX) {
+				return false;
+			}
+			uint64_t offset = sizeof(MeshCacheHeader) + uint64_t(header.indexCount) * sizeof(uint32_t) + uint64_t(verticesWritten) * header.vertexStride;
+			verticesWritten += count;
+			return file.writeAt(offset, vertices, size_t(count) * header.vertexStride);
+		}
+
+		bool good() const {
+			return file.good();
+		}
+
+		bool finish() {
+			if (indicesWritten != header.indexCount) {
+				return false;
+			}
+			header.vertexCount = verticesWritten;
+			return file.writeAt(0, &header, sizeof(header)) && file.commit();
+		}
+
+	private:
+		fileutil::AtomicFileWriter file;
+		MeshCacheHeader header;
+		uint32_t verticesWritten = 0;
+		uint32_t indicesWritten = 0;
+	};
+}
@@ -0,0 +1,287 @@
+﻿#pragma once
+//加载时的网格优化，三个步骤依次进行:
+//1. 顶点缓存优化: Tipsify(Sander et al. 2007)，按扇形遍历三角形，让相邻三角形复用post-transform cache中的顶点
+//2. overdraw优化: 把Tipsify的结果切成若干簇，簇内保持缓存友好的顺序，簇之间按朝外的程度排序，先画外侧的三角形以减少被遮挡像素的着色
+//3. 顶点读取优化: 按索引中第一次出现的顺序重排顶点，让顶点读取尽量连续
+//另外提供一个FIFO缓存的模拟器计算ACMR(每个三角形的平均缓存未命中数)和ATVR(未命中数/顶点数)，不需要GPU就可以衡量优化效果
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace meshopt {
+
+	//ACMR最好为0.5(规则网格)，最差为3；ATVR最好为1，表示每个顶点只被变换一次
+	struct CacheStats {
+		uint32_t misses = 0;
+		float acmr = 0.f;
+		float atvr = 0.f;
+	};
+
+	//模拟大小为cacheSize的FIFO post-transform cache
+	inline CacheStats simulateVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16) {
+		//每个顶点进入缓存的时间，timestamp - time < cacheSize 时仍在缓存中
+		std::vector<uint32_t> insertTime(vertexCount, 0);
+		std::vector<bool> seen(vertexCount, false);
+		uint32_t timestamp = 0;
+		CacheStats stats;
+		for (size_t i = 0; i < indexCount; ++i) {
+			uint32_t v = indices[i];
+			if (!seen[v] || timestamp - insertTime[v] >= cacheSize) {
+				seen[v] = true;
+				insertTime[v] = timestamp++;
+				++stats.misses;
+			}
+		}
+		size_t triangleCount = indexCount / 3;
+		size_t usedVertices = static_cast<size_t>(std::count(seen.begin(), seen.end(), true));
+		stats.acmr = triangleCount ? float(stats.misses) / triangleCount : 0.f;
+		stats.atvr = usedVertices ? float(stats.misses) / usedVertices : 0.f;
+		return stats;
+	}
+
+	//顶点 -> 包含它的三角形，CSR格式
+	struct TriangleAdjacency {
+		std::vector<uint32_t> offsets;	//vertexCount + 1
+		std::vector<uint32_t> triangles;
+
+		TriangleAdjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+			: offsets(vertexCount + 1, 0), triangles(indexCount) {
+			for (size_t i = 0; i < indexCount; ++i) {
+				++offsets[indices[i] + 1];
+			}
+			for (size_t v = 0; v < vertexCount; ++v) {
+				offsets[v + 1] += offsets[v];
+			}
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indexCount; ++i) {
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	//Tipsify顶点缓存优化，destination和indices不能是同一块内存
+	//clusters(可选)返回每次遇到死胡同(需要跳到不相邻的三角形)时的三角形序号，作为overdraw优化的簇边界
+	inline void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+		uint32_t cacheSize = 16, std::vector<uint32_t>* clusters = nullptr) {
+		size_t triangleCount = indexCount / 3;
+		TriangleAdjacency adjacency(indices, indexCount, vertexCount);
+
+		std::vector<uint32_t> liveTriangles(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v) {
+			liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+		}
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEnd;
+		std::vector<uint32_t> candidates;
+		deadEnd.reserve(indexCount);
+
+		uint32_t timestamp = cacheSize + 1;
+		size_t cursor = 0;
+		size_t outputTriangles = 0;
+		if (clusters) {
+			clusters->clear();
+		}
+
+		//从死胡同栈或者按顺序找一个还有未输出三角形的顶点
+		auto skipDeadEnd = [&]() -> int64_t {
+			while (!deadEnd.empty()) {
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0) {
+					return v;
+				}
+			}
+			while (cursor < vertexCount) {
+				if (liveTriangles[cursor] > 0) {
+					return static_cast<int64_t>(cursor);
+				}
+				++cursor;
+			}
+			return -1;
+		};
+
+		int64_t fanning = skipDeadEnd();
+		if (fanning >= 0 && clusters) {
+			clusters->push_back(0);
+		}
+		while (fanning >= 0) {
+			candidates.clear();
+			//输出以fanning为中心的所有剩余三角形
+			for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a) {
+				uint32_t t = adjacency.triangles[a];
+				if (emitted[t]) {
+					continue;
+				}
+				for (int k = 0; k < 3; ++k) {
+					uint32_t v = indices[t * 3 + k];
+					destination[outputTriangles * 3 + k] = v;
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					--liveTriangles[v];
+					if (timestamp - cacheTime[v] > cacheSize) {
+						cacheTime[v] = timestamp++;
+					}
+				}
+				emitted[t] = true;
+				++outputTriangles;
+			}
+
+			//下一个中心: 仍在缓存中、且输出剩余三角形之后不会被挤出缓存的顶点里，在缓存中待得最久的那个
+			int64_t next = -1;
+			int64_t bestPriority = -1;
+			for (uint32_t v : candidates) {
+				if (liveTriangles[v] == 0) {
+					continue;
+				}
+				int64_t priority = 0;
+				if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+					priority = timestamp - cacheTime[v];
+				}
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = v;
+				}
+			}
+			if (next < 0) {
+				next = skipDeadEnd();
+				if (next >= 0 && clusters) {
+					clusters->push_back(static_cast<uint32_t>(outputTriangles));
+				}
+			}
+			fanning = next;
+		}
+	}
+
+	//overdraw优化，indices应当是optimizeVertexCache的输出，clusters是它返回的簇边界
+	//positions指向第一个顶点的位置(3个float)，positionStride为相邻顶点之间的字节数
+	//簇内允许继续切分，只要切分点处的ACMR不超过整体ACMR的threshold倍，簇越小排序的效果越好
+	inline void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+		const float* positions, size_t positionStride, size_t vertexCount,
+		const std::vector<uint32_t>& clusters, uint32_t cacheSize = 16, float threshold = 1.05f) {
+		size_t triangleCount = indexCount / 3;
+		auto position = [&](uint32_t v) {
+			return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + v * positionStride);
+		};
+
+		//在硬边界之间找软边界: 从簇开始模拟缓存，当前缀的ACMR足够低时就可以切开
+		float targetAcmr = simulateVertexCache(indices, indexCount, vertexCount, cacheSize).acmr * threshold;
+		std::vector<uint32_t> splits;
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		uint32_t timestamp = cacheSize + 1;
+		std::vector<uint32_t> hardClusters = clusters.empty() ? std::vector<uint32_t>(1, 0) : clusters;
+		for (size_t c = 0; c < hardClusters.size(); ++c) {
+			uint32_t begin = hardClusters[c];
+			uint32_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : static_cast<uint32_t>(triangleCount);
+			splits.push_back(begin);
+			uint32_t misses = 0;
+			uint32_t start = begin;
+			timestamp += cacheSize + 1; //新的簇从空缓存开始
+			for (uint32_t t = begin; t < end; ++t) {
+				for (int k = 0; k < 3; ++k) {
+					uint32_t v = indices[t * 3 + k];
+					if (timestamp - cacheTime[v] > cacheSize) {
+						cacheTime[v] = timestamp++;
+						++misses;
+					}
+				}
+				//至少保留几个三角形，避免切得太碎
+				uint32_t count = t + 1 - start;
+				if (t + 1 < end && count >= 8 && float(misses) / count <= targetAcmr) {
+					splits.push_back(t + 1);
+					start = t + 1;
+					misses = 0;
+					timestamp += cacheSize + 1;
+				}
+			}
+		}
+
+		//整个网格的中心，以面积加权
+		double meshCenter[3] = {};
+		double totalArea = 0;
+		std::vector<float> triangleNormals(triangleCount * 3);
+		std::vector<float> triangleCenters(triangleCount * 3);
+		std::vector<float> triangleAreas(triangleCount);
+		for (size_t t = 0; t < triangleCount; ++t) {
+			const float* a = position(indices[t * 3]);
+			const float* b = position(indices[t * 3 + 1]);
+			const float* c = position(indices[t * 3 + 2]);
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int k = 0; k < 3; ++k) {
+				triangleNormals[t * 3 + k] = n[k]; //未归一化，长度为面积的两倍，求和时自然按面积加权
+				triangleCenters[t * 3 + k] = (a[k] + b[k] + c[k]) / 3.f;
+				meshCenter[k] += triangleCenters[t * 3 + k] * area;
+			}
+			triangleAreas[t] = area;
+			totalArea += area;
+		}
+		if (totalArea > 0) {
+			for (double& x : meshCenter) x /= totalArea;
+		}
+
+		//簇的排序依据: (簇中心 - 网格中心)·簇的平均法线，值越大簇越朝外，越可能遮挡其他簇
+		struct Cluster {
+			uint32_t begin;
+			uint32_t end;
+			float sortKey;
+		};
+		std::vector<Cluster> sorted;
+		sorted.reserve(splits.size());
+		for (size_t s = 0; s < splits.size(); ++s) {
+			Cluster cluster{ splits[s], s + 1 < splits.size() ? splits[s + 1] : static_cast<uint32_t>(triangleCount), 0.f };
+			double center[3] = {}, normal[3] = {};
+			double area = 0;
+			for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+				for (int k = 0; k < 3; ++k) {
+					center[k] += triangleCenters[t * 3 + k] * triangleAreas[t];
+					normal[k] += triangleNormals[t * 3 + k];
+				}
+				area += triangleAreas[t];
+			}
+			double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (area > 0 && length > 0) {
+				double key = 0;
+				for (int k = 0; k < 3; ++k) {
+					key += (center[k] / area - meshCenter[k]) * (normal[k] / length);
+				}
+				cluster.sortKey = static_cast<float>(key);
+			}
+			sorted.push_back(cluster);
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+			return a.sortKey > b.sortKey;
+		});
+
+		size_t written = 0;
+		for (const Cluster& cluster : sorted) {
+			size_t count = (cluster.end - cluster.begin) * 3;
+			memcpy(destination + written, indices + cluster.begin * 3, count * sizeof(uint32_t));
+			written += count;
+		}
+	}
+
+	//按索引中第一次使用的顺序重排顶点，并改写索引，没有被引用的顶点被丢弃，返回剩余的顶点数量
+	//destination和vertices不能是同一块内存
+	template <typename V>
+	inline size_t optimizeVertexFetch(V* destination, uint32_t* indices, size_t indexCount, const V* vertices, size_t vertexCount) {
+		std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+		uint32_t next = 0;
+		for (size_t i = 0; i < indexCount; ++i) {
+			uint32_t v = indices[i];
+			if (remap[v] == UINT32_MAX) {
+				remap[v] = next;
+				destination[next] = vertices[v];
+				++next;
+			}
+			indices[i] = remap[v];
+		}
+		return next;
+	}
+
+}
@@ -0,0 +1,241 @@
+﻿#pragma once
+//CPU生成RGBA8纹理的mipmap链，结果写入烘焙文件，所有层直接上传，不在GPU上用blit生成
+//每一层由上一层做box滤波得到，sRGB纹理先转换到线性空间平均，再转换回sRGB，alpha总是线性平均
+//偶数尺寸的方向每个目标像素取2个源纹素；奇数尺寸2m+1缩小到m时取3个纹素，按目标像素覆盖的面积加权，不丢弃最后一行/列，也不会偏离中心
+//一层之内按行分段在JobSystem上并行，两个方向都是偶数(或为1)时每行使用SSE2一次处理两个(线性)或一个(sRGB)目标像素，结果与标量实现逐位相同
+//有奇数方向的层使用标量的加权实现
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "job_system.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPGEN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace mipgen {
+
+	//完整mipmap链的层数: floor(log2(max(w, h))) + 1
+	inline uint32_t levelCount(uint32_t width, uint32_t height) {
+		uint32_t size = std::max(width, height);
+		uint32_t levels = 1;
+		while (size > 1) {
+			size >>= 1;
+			++levels;
+		}
+		return levels;
+	}
+
+	inline uint32_t levelWidth(uint32_t width, uint32_t level) { return std::max(1u, width >> level); }
+	inline uint32_t levelHeight(uint32_t height, uint32_t level) { return std::max(1u, height >> level); }
+
+	//各层在连续存储中的字节偏移，最后一个元素是总大小
+	inline std::vector<size_t> levelOffsets(uint32_t width, uint32_t height, uint32_t levels, uint32_t texelSize = 4) {
+		std::vector<size_t> offsets(levels + 1, 0);
+		for (uint32_t i = 0; i < levels; ++i) {
+			offsets[i + 1] = offsets[i] + size_t(levelWidth(width, i)) * levelHeight(height, i) * texelSize;
+		}
+		return offsets;
+	}
+
+	//sRGB与线性之间的转换表，编码时把线性值量化到12位再查表
+	struct SrgbTables {
+		float toLinear[256];
+		uint8_t fromLinear[4096];
+
+		SrgbTables() {
+			for (int i = 0; i < 256; ++i) {
+				float c = i / 255.f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < 4096; ++i) {
+				float l = i / 4095.f;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+				fromLinear[i] = static_cast<uint8_t>(std::min(255.f, std::max(0.f, c * 255.f + 0.5f)));
+			}
+		}
+	};
+
+	inline const SrgbTables& srgbTables() {
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	inline uint8_t encodeSrgb(float linear) {
+		int index = static_cast<int>(std::min(1.f, std::max(0.f, linear)) * 4095.f + 0.5f);
+		return srgbTables().fromLinear[index];
+	}
+
+	//标量实现(两个方向都是偶数或者为1)，生成目标层一行中[xBegin, dstWidth)的像素，row0/row1是对应的两行源像素
+	inline void downsampleRowScalar(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* out, uint32_t xBegin, uint32_t dstWidth, bool srgb) {
+		const float* toLinear = srgbTables().toLinear;
+		for (uint32_t x = xBegin; x < dstWidth; ++x) {
+			uint32_t x0 = std::min(2 * x, srcWidth - 1) * 4;
+			uint32_t x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+			for (int c = 0; c < 4; ++c) {
+				if (srgb && c < 3) {
+					//与SSE2实现相同的加法顺序: (p00 + p01) + (p10 + p11)
+					float sum = (toLinear[row0[x0 + c]] + toLinear[row0[x1 + c]]) + (toLinear[row1[x0 + c]] + toLinear[row1[x1 + c]]);
+					out[4 * x + c] = encodeSrgb(sum * 0.25f);
+				} else {
+					out[4 * x + c] = static_cast<uint8_t>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+				}
+			}
+		}
+	}
+
+	//一个方向上目标像素x使用的源纹素和权重，权重为weight / denominator
+	//奇数尺寸n = 2m + 1缩小到m时，目标像素x在源图像中覆盖[x * n / m, (x + 1) * n / m)，跨过2x, 2x + 1, 2x + 2三个纹素，
+	//覆盖的长度分别为(m - x) / m, 1, (x + 1) / m，归一化后权重的分子为m - x, m, x + 1，分母为n
+	struct Taps {
+		uint32_t index[3];
+		uint32_t weight[3];
+		uint32_t count;
+		uint32_t denominator;
+	};
+
+	inline Taps tapsFor(uint32_t srcSize, uint32_t x) {
+		if (srcSize == 1) {
+			return { { 0, 0, 0 }, { 1, 0, 0 }, 1, 1 };
+		}
+		if (srcSize % 2 == 0) {
+			return { { 2 * x, 2 * x + 1, 0 }, { 1, 1, 0 }, 2, 2 };
+		}
+		uint32_t m = srcSize / 2;
+		return { { 2 * x, 2 * x + 1, 2 * x + 2 }, { m - x, m, x + 1 }, 3, srcSize };
+	}
+
+	//至少一个方向是奇数尺寸时的标量实现，生成目标层的第y行
+	//线性通道用64位整数精确累加再四舍五入，sRGB通道在线性空间用float加权
+	inline void downsampleRowWeighted(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* out, uint32_t y, uint32_t dstWidth, bool srgb) {
+		const float* toLinear = srgbTables().toLinear;
+		Taps ty = tapsFor(srcHeight, y);
+		for (uint32_t x = 0; x < dstWidth; ++x) {
+			Taps tx = tapsFor(srcWidth, x);
+			uint64_t denominator = uint64_t(tx.denominator) * ty.denominator;
+			for (int c = 0; c < 4; ++c) {
+				if (srgb && c < 3) {
+					float sum = 0.f;
+					for (uint32_t j = 0; j < ty.count; ++j) {
+						const uint8_t* row = src + size_t(ty.index[j]) * srcWidth * 4;
+						float wy = float(ty.weight[j]) / float(ty.denominator);
+						for (uint32_t i = 0; i < tx.count; ++i) {
+							sum += wy * (float(tx.weight[i]) / float(tx.denominator)) * toLinear[row[tx.index[i] * 4 + c]];
+						}
+					}
+					out[4 * x + c] = encodeSrgb(sum);
+				} else {
+					uint64_t sum = 0;
+					for (uint32_t j = 0; j < ty.count; ++j) {
+						const uint8_t* row = src + size_t(ty.index[j]) * srcWidth * 4;
+						for (uint32_t i = 0; i < tx.count; ++i) {
+							sum += uint64_t(ty.weight[j]) * tx.weight[i] * row[tx.index[i] * 4 + c];
+						}
+					}
+					out[4 * x + c] = static_cast<uint8_t>((sum + denominator / 2) / denominator);
+				}
+			}
+		}
+	}
+
+#ifdef MIPGEN_SSE2
+	//SSE2实现，x方向需要钳制的像素(源图像宽度为1，或者剩余不足一组)交给标量实现
+	inline void downsampleRowSSE2(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint8_t* out, uint32_t dstWidth, bool srgb) {
+		uint32_t x = 0;
+		if (srcWidth >= 2 && !srgb) {
+			//一次读取4个源像素(16字节)，得到2个目标像素
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i two = _mm_set1_epi16(2);
+			for (; x + 2 <= dstWidth; x += 2) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));	//源像素0和1的列和
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));	//源像素2和3的列和
+				__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + 4 * x), _mm_packus_epi16(sum, zero));
+			}
+		} else if (srcWidth >= 2) {
+			//一个目标像素的RGB放在一个向量中，alpha通道按整数平均
+			const float* toLinear = srgbTables().toLinear;
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (; x < dstWidth; ++x) {
+				const uint8_t* p00 = row0 + 8 * x;
+				const uint8_t* p01 = p00 + 4;
+				const uint8_t* p10 = row1 + 8 * x;
+				const uint8_t* p11 = p10 + 4;
+				__m128 a = _mm_add_ps(_mm_setr_ps(toLinear[p00[0]], toLinear[p00[1]], toLinear[p00[2]], 0.f),
+					_mm_setr_ps(toLinear[p01[0]], toLinear[p01[1]], toLinear[p01[2]], 0.f));
+				__m128 b = _mm_add_ps(_mm_setr_ps(toLinear[p10[0]], toLinear[p10[1]], toLinear[p10[2]], 0.f),
+					_mm_setr_ps(toLinear[p11[0]], toLinear[p11[1]], toLinear[p11[2]], 0.f));
+				alignas(16) float linear[4];
+				_mm_store_ps(linear, _mm_mul_ps(_mm_add_ps(a, b), quarter));
+				out[4 * x + 0] = encodeSrgb(linear[0]);
+				out[4 * x + 1] = encodeSrgb(linear[1]);
+				out[4 * x + 2] = encodeSrgb(linear[2]);
+				out[4 * x + 3] = static_cast<uint8_t>((p00[3] + p01[3] + p10[3] + p11[3] + 2) >> 2);
+			}
+		}
+		downsampleRowScalar(row0, row1, srcWidth, out, x, dstWidth, srgb);
+	}
+#endif
+
+	//由上一层生成目标层的[rowBegin, rowEnd)行
+	inline void downsampleRows(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t dstWidth,
+		bool srgb, uint32_t rowBegin, uint32_t rowEnd, bool useSimd) {
+		if ((srcWidth > 1 && srcWidth % 2 != 0) || (srcHeight > 1 && srcHeight % 2 != 0)) {
+			for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+				downsampleRowWeighted(src, srcWidth, srcHeight, dst + size_t(y) * dstWidth * 4, y, dstWidth, srgb);
+			}
+			return;
+		}
+		//两个方向都是偶数或者为1，尺寸为1的方向钳制到同一个纹素
+		for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+			const uint8_t* row0 = src + size_t(std::min(2 * y, srcHeight - 1)) * srcWidth * 4;
+			const uint8_t* row1 = src + size_t(std::min(2 * y + 1, srcHeight - 1)) * srcWidth * 4;
+			uint8_t* out = dst + size_t(y) * dstWidth * 4;
+#ifdef MIPGEN_SSE2
+			if (useSimd) {
+				downsampleRowSSE2(row0, row1, srcWidth, out, dstWidth, srgb);
+				continue;
+			}
+#endif
+			downsampleRowScalar(row0, row1, srcWidth, out, 0, dstWidth, srgb);
+		}
+	}
+
+	//生成完整的mipmap链，返回按层连续存放的数据(第0层是base的拷贝)，各层的偏移由levelOffsets给出
+	//jobs为空时在当前线程上生成，否则较大的层按行分段用jobs->parallelFor
+	inline std::vector<uint8_t> generateMipChain(const uint8_t* base, uint32_t width, uint32_t height, bool srgb,
+		JobSystem* jobs = nullptr, bool useSimd = true) {
+		uint32_t levels = levelCount(width, height);
+		std::vector<size_t> offsets = levelOffsets(width, height, levels);
+		std::vector<uint8_t> chain(offsets[levels]);
+		memcpy(chain.data(), base, offsets[1]);
+		srgbTables();	//在提交任务之前初始化转换表
+
+		//太小的层不值得拆分
+		const size_t minPixelsPerJob = 1 << 16;
+		for (uint32_t level = 1; level < levels; ++level) {
+			const uint8_t* src = chain.data() + offsets[level - 1];
+			uint8_t* dst = chain.data() + offsets[level];
+			uint32_t srcWidth = levelWidth(width, level - 1), srcHeight = levelHeight(height, level - 1);
+			uint32_t dstWidth = levelWidth(width, level), dstHeight = levelHeight(height, level);
+			size_t rowsPerJob = std::max<size_t>(1, minPixelsPerJob / dstWidth);
+			if (jobs && dstHeight > rowsPerJob) {
+				jobs->parallelFor(dstHeight, rowsPerJob, [&](size_t begin, size_t end) {
+					downsampleRows(src, srcWidth, srcHeight, dst, dstWidth, srgb, static_cast<uint32_t>(begin), static_cast<uint32_t>(end), useSimd);
+				});
+			} else {
+				downsampleRows(src, srcWidth, srcHeight, dst, dstWidth, srgb, 0, dstHeight, useSimd);
+			}
+		}
+		return chain;
+	}
+
+}
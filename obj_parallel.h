@@ -0,0 +1,664 @@
+﻿#pragma once
+//多线程的obj解析器，输出与tinyobj::LoadObj相同的attrib_t/shape_t
+//1. 内存映射整个obj文件，按字节数切成若干块，切分点对齐到下一个'\n'之后
+//2. 每个任务独立解析一块中的 v/vn/vt/f，g/o/usemtl/mtllib/t 这类改变状态的行按出现顺序记录为命令
+//3. 根据每块的顶点数量做前缀和，并行地把各块数据拷贝到attrib中，同时修正负数(相对)索引
+//4. 单线程按顺序回放命令，按照tinyobj的规则把面组装为shape
+//"v"行优先使用obj_simd.h中的向量化解析，结果与标量解析逐位相同
+//注意: 需要在包含本文件之前包含tiny_obj_loader.h
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <sstream>
+#include <algorithm>
+
+#include "mapped_file.h"
+#include "job_system.h"
+#include "obj_simd.h"
+
+namespace parallelobj {
+
+	using tinyobj::real_t;
+
+	//======================与tinyobj逐字符等价的词法函数, 使用显式的行尾指针而不是'\0'========================//
+
+	inline bool isDigit(char c) {
+		return static_cast<unsigned int>(c - '0') < 10u;
+	}
+
+	//strspn(" \t")
+	inline const char* skipSpace(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t')) ++p;
+		return p;
+	}
+
+	//strspn(" \t\r")
+	inline const char* skipSpaceCR(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+		return p;
+	}
+
+	//strcspn(" \t\r")
+	inline const char* findTokenEnd(const char* p, const char* end) {
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+		return p;
+	}
+
+	//strcspn("/ \t\r")
+	inline const char* findTripleEnd(const char* p, const char* end) {
+		while (p < end && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+		return p;
+	}
+
+	//与tinyobj::tryParseDouble的算法完全一致(保证结果逐位相同)，只是所有读取都不会越过s_end
+	inline bool tryParseDouble(const char* s, const char* s_end, double* result) {
+		if (s >= s_end) {
+			return false;
+		}
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		char exp_sign = '+';
+		const char* curr = s;
+		int read = 0;
+
+		if (*curr == '+' || *curr == '-') {
+			sign = *curr;
+			curr++;
+		}
+		else if (!isDigit(*curr)) {
+			return false;
+		}
+
+		//整数部分
+		while (curr != s_end && isDigit(*curr)) {
+			mantissa *= 10;
+			mantissa += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+		}
+		if (read == 0) return false;
+		if (curr == s_end) goto assemble;
+
+		//小数部分
+		if (*curr == '.') {
+			curr++;
+			read = 1;
+			while (curr != s_end && isDigit(*curr)) {
+				static const double pow_lut[] = {
+					1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+				};
+				const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+				mantissa += static_cast<int>(*curr - 0x30) * (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+				read++;
+				curr++;
+			}
+		}
+		else if (*curr != 'e' && *curr != 'E') {
+			goto assemble;
+		}
+
+		if (curr == s_end) goto assemble;
+
+		//指数部分
+		if (*curr == 'e' || *curr == 'E') {
+			curr++;
+			if (curr != s_end && (*curr == '+' || *curr == '-')) {
+				exp_sign = *curr;
+				curr++;
+			}
+			else if (curr == s_end || !isDigit(*curr)) {
+				return false;
+			}
+
+			read = 0;
+			while (curr != s_end && isDigit(*curr)) {
+				exponent *= 10;
+				exponent += static_cast<int>(*curr - 0x30);
+				curr++;
+				read++;
+			}
+			exponent *= (exp_sign == '+' ? 1 : -1);
+			if (read == 0) return false;
+		}
+
+	assemble:
+		*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+		return true;
+	}
+
+	inline real_t parseReal(const char** token, const char* end, double defaultValue = 0.0) {
+		*token = skipSpace(*token, end);
+		const char* tokenEnd = findTokenEnd(*token, end);
+		double val = defaultValue;
+		tryParseDouble(*token, tokenEnd, &val);
+		*token = tokenEnd;
+		return static_cast<real_t>(val);
+	}
+
+	//atoi的语义: 跳过空白，可选的符号，随后的数字
+	inline int parseAtoi(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) ++p;
+		bool negative = false;
+		if (p < end && (*p == '+' || *p == '-')) {
+			negative = *p == '-';
+			++p;
+		}
+		long long value = 0;
+		while (p < end && isDigit(*p)) {
+			value = value * 10 + (*p - '0');
+			++p;
+		}
+		return static_cast<int>(negative ? -value : value);
+	}
+
+	//sscanf("%s")的语义: 跳过空白后读取到下一个空白为止
+	inline std::string scanWord(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) ++p;
+		const char* wordEnd = p;
+		while (wordEnd < end && *wordEnd != ' ' && *wordEnd != '\t' && *wordEnd != '\r' && *wordEnd != '\v' && *wordEnd != '\f') ++wordEnd;
+		return std::string(p, wordEnd);
+	}
+
+	//==================================单个块的解析结果=======================================//
+
+	enum class CommandType {
+		Usemtl,
+		Mtllib,
+		Group,
+		Object,
+		Tag
+	};
+
+	//改变解析状态的行，faceIndex是该行出现时块内已经解析的面数
+	struct Command {
+		Command(CommandType type, size_t faceIndex) : type(type), faceIndex(faceIndex) {}
+
+		CommandType type;
+		size_t faceIndex;
+		std::string name;
+		std::vector<std::string> names;
+		tinyobj::tag_t tag;
+	};
+
+	struct Chunk {
+		std::vector<real_t> v;
+		std::vector<real_t> vn;
+		std::vector<real_t> vt;
+		//每个面顶点3个int: v, vn, vt (已经转为0基准，-1表示不存在)
+		std::vector<int> corners;
+		//第i个面的顶点是corners中 [faceStart[i], faceStart[i+1]) / 3
+		std::vector<uint32_t> faceStart;
+		//使用负数(相对)索引的位置，合并时需要加上之前所有块的顶点数
+		std::vector<size_t> relativeV;
+		std::vector<size_t> relativeVn;
+		std::vector<size_t> relativeVt;
+		std::vector<Command> commands;
+	};
+
+	//fixIndex的块内版本: 相对索引先按块内数量解析，并记录下来等合并时再加上前缀
+	inline int fixIndexLocal(int idx, int localCount, std::vector<size_t>& relatives, size_t position) {
+		if (idx > 0) return idx - 1;
+		if (idx == 0) return 0;
+		relatives.push_back(position);
+		return localCount + idx;
+	}
+
+	//parseTriple的块内版本: i, i/j/k, i//k, i/j
+	inline void parseTriple(const char** token, const char* end, Chunk& chunk) {
+		size_t pos = chunk.corners.size();
+		int vCount = static_cast<int>(chunk.v.size() / 3);
+		int vnCount = static_cast<int>(chunk.vn.size() / 3);
+		int vtCount = static_cast<int>(chunk.vt.size() / 2);
+		int vIdx = fixIndexLocal(parseAtoi(*token, end), vCount, chunk.relativeV, pos);
+		int vnIdx = -1;
+		int vtIdx = -1;
+
+		*token = findTripleEnd(*token, end);
+		if (*token < end && **token == '/') {
+			(*token)++;
+			if (*token < end && **token == '/') {
+				//i//k
+				(*token)++;
+				vnIdx = fixIndexLocal(parseAtoi(*token, end), vnCount, chunk.relativeVn, pos + 1);
+				*token = findTripleEnd(*token, end);
+			}
+			else {
+				//i/j/k 或者 i/j
+				vtIdx = fixIndexLocal(parseAtoi(*token, end), vtCount, chunk.relativeVt, pos + 2);
+				*token = findTripleEnd(*token, end);
+				if (*token < end && **token == '/') {
+					(*token)++;
+					vnIdx = fixIndexLocal(parseAtoi(*token, end), vnCount, chunk.relativeVn, pos + 1);
+					*token = findTripleEnd(*token, end);
+				}
+			}
+		}
+		chunk.corners.push_back(vIdx);
+		chunk.corners.push_back(vnIdx);
+		chunk.corners.push_back(vtIdx);
+	}
+
+	//与tinyobj的 't' 行解析一致(subdivision tag)，这种行很少，直接复制成以'\0'结尾的字符串来处理
+	inline tinyobj::tag_t parseTagLine(const char* begin, const char* end) {
+		std::string line(begin, end);
+		const char* token = line.c_str();
+		const char* lineEnd = line.c_str() + line.size();
+		//tinyobj在这里每次跳过分隔符后可能越过行尾，这里把token限制在字符串范围内
+		auto advance = [&](size_t n) {
+			token = std::min(token + n, lineEnd);
+		};
+		tinyobj::tag_t tag;
+		token += 2;
+		tag.name = scanWord(token, lineEnd);
+		advance(tag.name.size() + 1);
+
+		int numInts = atoi(token), numReals = 0, numStrings = 0;
+		token += strcspn(token, "/ \t\r");
+		if (token[0] == '/') {
+			token++;
+			numReals = atoi(token);
+			token += strcspn(token, "/ \t\r");
+			if (token[0] == '/') {
+				token++;
+				numStrings = atoi(token);
+				advance(strcspn(token, "/ \t\r") + 1);
+			}
+		}
+
+		tag.intValues.resize(static_cast<size_t>(std::max(numInts, 0)));
+		for (auto&& value : tag.intValues) {
+			value = atoi(token);
+			advance(strcspn(token, "/ \t\r") + 1);
+		}
+		tag.floatValues.resize(static_cast<size_t>(std::max(numReals, 0)));
+		for (auto&& value : tag.floatValues) {
+			value = parseReal(&token, lineEnd);
+			advance(strcspn(token, "/ \t\r") + 1);
+		}
+		tag.stringValues.resize(static_cast<size_t>(std::max(numStrings, 0)));
+		for (auto&& value : tag.stringValues) {
+			value = scanWord(token, lineEnd);
+			advance(value.size() + 1);
+		}
+		return tag;
+	}
+
+	//解析[begin, end)中的所有行，行尾可以是 \n, \r\n 或者单独的 \r
+	inline void parseChunk(const char* begin, const char* end, Chunk& chunk) {
+		//按平均每行约30字节预估容量，避免频繁扩容
+		size_t estimatedLines = static_cast<size_t>(end - begin) / 30;
+		chunk.v.reserve(estimatedLines);
+		chunk.corners.reserve(estimatedLines * 3);
+		chunk.faceStart.reserve(estimatedLines / 2 + 1);
+		chunk.faceStart.push_back(0);
+
+		const char* p = begin;
+		while (p < end) {
+			const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+			const char* next;
+			if (lineEnd == nullptr) {
+				lineEnd = end;
+				next = end;
+			}
+			else {
+				next = lineEnd + 1;
+			}
+			const char* cr = static_cast<const char*>(memchr(p, '\r', lineEnd - p));
+			if (cr != nullptr) {
+				//"\r\n" 或者单独的 "\r" 都结束这一行
+				next = (cr + 1 < end && cr[1] == '\n') ? cr + 2 : cr + 1;
+				lineEnd = cr;
+			}
+
+			const char* line = p;
+			p = next;
+
+			const char* token = skipSpace(line, lineEnd);
+			if (token == lineEnd || token[0] == '#') {
+				continue;
+			}
+			size_t len = lineEnd - token;
+			char c0 = token[0];
+			char c1 = len > 1 ? token[1] : '\0';
+			char c2 = len > 2 ? token[2] : '\0';
+
+			if (c0 == 'v' && (c1 == ' ' || c1 == '\t')) {
+				token += 2;
+				double xyz[3];
+				if (simd::parseVertex3(token, lineEnd, end, xyz)) {
+					chunk.v.push_back(static_cast<real_t>(xyz[0]));
+					chunk.v.push_back(static_cast<real_t>(xyz[1]));
+					chunk.v.push_back(static_cast<real_t>(xyz[2]));
+					continue;
+				}
+				real_t x = parseReal(&token, lineEnd);
+				real_t y = parseReal(&token, lineEnd);
+				real_t z = parseReal(&token, lineEnd);
+				chunk.v.push_back(x);
+				chunk.v.push_back(y);
+				chunk.v.push_back(z);
+				continue;
+			}
+			if (c0 == 'v' && c1 == 'n' && (c2 == ' ' || c2 == '\t')) {
+				token += 3;
+				real_t x = parseReal(&token, lineEnd);
+				real_t y = parseReal(&token, lineEnd);
+				real_t z = parseReal(&token, lineEnd);
+				chunk.vn.push_back(x);
+				chunk.vn.push_back(y);
+				chunk.vn.push_back(z);
+				continue;
+			}
+			if (c0 == 'v' && c1 == 't' && (c2 == ' ' || c2 == '\t')) {
+				token += 3;
+				real_t x = parseReal(&token, lineEnd);
+				real_t y = parseReal(&token, lineEnd);
+				chunk.vt.push_back(x);
+				chunk.vt.push_back(y);
+				continue;
+			}
+			if (c0 == 'f' && (c1 == ' ' || c1 == '\t')) {
+				token = skipSpace(token + 2, lineEnd);
+				while (token < lineEnd) {
+					parseTriple(&token, lineEnd, chunk);
+					token = skipSpaceCR(token, lineEnd);
+				}
+				chunk.faceStart.push_back(static_cast<uint32_t>(chunk.corners.size()));
+				continue;
+			}
+
+			size_t faceIndex = chunk.faceStart.size() - 1;
+			if (len > 6 && strncmp(token, "usemtl", 6) == 0 && (token[6] == ' ' || token[6] == '\t')) {
+				Command cmd{ CommandType::Usemtl, faceIndex };
+				cmd.name = scanWord(token + 7, lineEnd);
+				chunk.commands.emplace_back(std::move(cmd));
+				continue;
+			}
+			if (len > 6 && strncmp(token, "mtllib", 6) == 0 && (token[6] == ' ' || token[6] == '\t')) {
+				Command cmd{ CommandType::Mtllib, faceIndex };
+				cmd.name.assign(token + 7, lineEnd);
+				chunk.commands.emplace_back(std::move(cmd));
+				continue;
+			}
+			if (c0 == 'g' && (c1 == ' ' || c1 == '\t')) {
+				Command cmd{ CommandType::Group, faceIndex };
+				while (token < lineEnd) {
+					token = skipSpace(token, lineEnd);
+					const char* nameEnd = findTokenEnd(token, lineEnd);
+					cmd.names.emplace_back(token, nameEnd);
+					token = skipSpaceCR(nameEnd, lineEnd);
+				}
+				chunk.commands.emplace_back(std::move(cmd));
+				continue;
+			}
+			if (c0 == 'o' && (c1 == ' ' || c1 == '\t')) {
+				Command cmd{ CommandType::Object, faceIndex };
+				cmd.name = scanWord(token + 2, lineEnd);
+				chunk.commands.emplace_back(std::move(cmd));
+				continue;
+			}
+			if (c0 == 't' && (c1 == ' ' || c1 == '\t')) {
+				Command cmd{ CommandType::Tag, faceIndex };
+				cmd.tag = parseTagLine(token, lineEnd);
+				chunk.commands.emplace_back(std::move(cmd));
+				continue;
+			}
+			//忽略不认识的行
+		}
+	}
+
+	//==================================合并=======================================//
+
+	struct FaceRange {
+		const Chunk* chunk;
+		size_t begin;
+		size_t end;
+	};
+
+	//与tinyobj::exportFaceGroupToShape一致，faceGroup是若干块中连续的面
+	inline bool exportFaceGroupToShape(tinyobj::shape_t* shape, const std::vector<FaceRange>& faceGroup,
+		const std::vector<tinyobj::tag_t>& tags, int materialId, const std::string& name, bool triangulate) {
+		if (faceGroup.empty()) {
+			return false;
+		}
+
+		size_t indexCount = 0, faceCount = 0;
+		for (auto&& range : faceGroup) {
+			for (size_t f = range.begin; f < range.end; ++f) {
+				size_t n = (range.chunk->faceStart[f + 1] - range.chunk->faceStart[f]) / 3;
+				size_t tris = n >= 3 ? n - 2 : 0;
+				indexCount += triangulate ? tris * 3 : n;
+				faceCount += triangulate ? tris : 1;
+			}
+		}
+		auto& mesh = shape->mesh;
+		mesh.indices.reserve(mesh.indices.size() + indexCount);
+		mesh.num_face_vertices.reserve(mesh.num_face_vertices.size() + faceCount);
+		mesh.material_ids.reserve(mesh.material_ids.size() + faceCount);
+
+		auto corner = [](const int* c) {
+			tinyobj::index_t idx;
+			idx.vertex_index = c[0];
+			idx.normal_index = c[1];
+			idx.texcoord_index = c[2];
+			return idx;
+		};
+
+		for (auto&& range : faceGroup) {
+			const Chunk& chunk = *range.chunk;
+			for (size_t f = range.begin; f < range.end; ++f) {
+				const int* face = chunk.corners.data() + chunk.faceStart[f];
+				size_t npolys = (chunk.faceStart[f + 1] - chunk.faceStart[f]) / 3;
+				if (triangulate) {
+					//多边形转为三角扇
+					for (size_t k = 2; k < npolys; ++k) {
+						mesh.indices.push_back(corner(face));
+						mesh.indices.push_back(corner(face + (k - 1) * 3));
+						mesh.indices.push_back(corner(face + k * 3));
+						mesh.num_face_vertices.push_back(3);
+						mesh.material_ids.push_back(materialId);
+					}
+				}
+				else {
+					for (size_t k = 0; k < npolys; ++k) {
+						mesh.indices.push_back(corner(face + k * 3));
+					}
+					mesh.num_face_vertices.push_back(static_cast<unsigned char>(npolys));
+					mesh.material_ids.push_back(materialId);
+				}
+			}
+		}
+
+		shape->name = name;
+		shape->mesh.tags = tags;
+		return true;
+	}
+
+	//解析内存中的obj文本，jobs不为空时每个线程一块，用jobs->parallelFor解析和合并；否则在当前线程上解析
+	inline bool parseObj(const char* data, size_t size, tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+		std::vector<tinyobj::material_t>* materials, std::string* err, tinyobj::MaterialReader* readMatFn = nullptr,
+		bool triangulate = true, JobSystem* jobs = nullptr) {
+		//太小的文件不值得拆分
+		const size_t minChunkSize = 1 << 20;
+		size_t chunkCount = jobs ? std::max<size_t>(1, std::min<size_t>(jobs->size(), size / minChunkSize)) : 1;
+		auto forEachChunk = [&](const std::function<void(size_t)>& fn) {
+			if (chunkCount == 1) {
+				fn(0);
+				return;
+			}
+			jobs->parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					fn(i);
+				}
+			});
+		};
+
+		//切分点对齐到'\n'之后，保证每一行完整地属于一个块
+		std::vector<const char*> bounds(chunkCount + 1);
+		bounds[0] = data;
+		bounds[chunkCount] = data + size;
+		for (size_t i = 1; i < chunkCount; ++i) {
+			const char* p = std::max(bounds[i - 1], data + size / chunkCount * i);
+			const char* nl = static_cast<const char*>(memchr(p, '\n', data + size - p));
+			bounds[i] = nl ? nl + 1 : data + size;
+		}
+
+		std::vector<Chunk> chunks(chunkCount);
+		forEachChunk([&](size_t i) { parseChunk(bounds[i], bounds[i + 1], chunks[i]); });
+
+		//每一块在全局数组中的起始位置
+		std::vector<size_t> vOffset(chunkCount + 1, 0), vnOffset(chunkCount + 1, 0), vtOffset(chunkCount + 1, 0);
+		for (size_t i = 0; i < chunkCount; ++i) {
+			vOffset[i + 1] = vOffset[i] + chunks[i].v.size();
+			vnOffset[i + 1] = vnOffset[i] + chunks[i].vn.size();
+			vtOffset[i + 1] = vtOffset[i] + chunks[i].vt.size();
+		}
+		attrib->vertices.resize(vOffset[chunkCount]);
+		attrib->normals.resize(vnOffset[chunkCount]);
+		attrib->texcoords.resize(vtOffset[chunkCount]);
+
+		auto mergeChunk = [&](size_t i) {
+			Chunk& chunk = chunks[i];
+			std::copy(chunk.v.begin(), chunk.v.end(), attrib->vertices.begin() + vOffset[i]);
+			std::copy(chunk.vn.begin(), chunk.vn.end(), attrib->normals.begin() + vnOffset[i]);
+			std::copy(chunk.vt.begin(), chunk.vt.end(), attrib->texcoords.begin() + vtOffset[i]);
+			//相对索引加上之前所有块的数量
+			for (size_t pos : chunk.relativeV) chunk.corners[pos] += static_cast<int>(vOffset[i] / 3);
+			for (size_t pos : chunk.relativeVn) chunk.corners[pos] += static_cast<int>(vnOffset[i] / 3);
+			for (size_t pos : chunk.relativeVt) chunk.corners[pos] += static_cast<int>(vtOffset[i] / 2);
+			//属性已经拷贝出去，尽早释放块内存降低峰值
+			std::vector<real_t>().swap(chunk.v);
+			std::vector<real_t>().swap(chunk.vn);
+			std::vector<real_t>().swap(chunk.vt);
+		};
+		forEachChunk(mergeChunk);
+
+		//按顺序回放状态命令，规则与tinyobj::LoadObj相同
+		std::map<std::string, int> materialMap;
+		std::vector<tinyobj::tag_t> tags;
+		std::vector<FaceRange> faceGroup;
+		std::string name;
+		int material = -1;
+		tinyobj::shape_t shape;
+
+		for (auto&& chunk : chunks) {
+			size_t faceCount = chunk.faceStart.size() - 1;
+			size_t pos = 0;
+			auto addFaces = [&](size_t end) {
+				if (end > pos) {
+					faceGroup.push_back({ &chunk, pos, end });
+				}
+				pos = end;
+			};
+			for (auto&& cmd : chunk.commands) {
+				addFaces(cmd.faceIndex);
+				switch (cmd.type) {
+				case CommandType::Usemtl: {
+					int newMaterialId = -1;
+					auto it = materialMap.find(cmd.name);
+					if (it != materialMap.end()) {
+						newMaterialId = it->second;
+					}
+					if (newMaterialId != material) {
+						exportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate);
+						faceGroup.clear();
+						material = newMaterialId;
+					}
+					break;
+				}
+				case CommandType::Mtllib: {
+					if (!readMatFn) {
+						break;
+					}
+					//与tinyobj的SplitString(' ')一致
+					std::vector<std::string> filenames;
+					std::stringstream ss(cmd.name);
+					std::string item;
+					while (std::getline(ss, item, ' ')) {
+						filenames.push_back(item);
+					}
+					if (filenames.empty()) {
+						if (err) {
+							(*err) += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+						}
+						break;
+					}
+					bool found = false;
+					for (auto&& filename : filenames) {
+						std::string errMtl;
+						bool ok = (*readMatFn)(filename.c_str(), materials, &materialMap, &errMtl);
+						if (err && !errMtl.empty()) {
+							(*err) += errMtl;
+						}
+						if (ok) {
+							found = true;
+							break;
+						}
+					}
+					if (!found && err) {
+						(*err) += "WARN: Failed to load material file(s). Use default material.\n";
+					}
+					break;
+				}
+				case CommandType::Group: {
+					if (exportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate)) {
+						shapes->push_back(std::move(shape));
+					}
+					shape = tinyobj::shape_t();
+					faceGroup.clear();
+					//names[0]是 "g" 本身
+					name = cmd.names.size() > 1 ? cmd.names[1] : "";
+					break;
+				}
+				case CommandType::Object: {
+					if (exportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate)) {
+						shapes->push_back(std::move(shape));
+					}
+					faceGroup.clear();
+					shape = tinyobj::shape_t();
+					name = cmd.name;
+					break;
+				}
+				case CommandType::Tag:
+					tags.push_back(cmd.tag);
+					break;
+				}
+			}
+			addFaces(faceCount);
+		}
+
+		bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material, name, triangulate);
+		if (ret || shape.mesh.indices.size()) {
+			shapes->push_back(std::move(shape));
+		}
+		return true;
+	}
+
+	//与tinyobj::LoadObj(filename)的参数和行为相同
+	inline bool loadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+		std::string* err, const char* filename, const char* mtlBasedir = nullptr, bool triangulate = true, JobSystem* jobs = nullptr) {
+		attrib->vertices.clear();
+		attrib->normals.clear();
+		attrib->texcoords.clear();
+		shapes->clear();
+
+		MappedFile file;
+		if (!file.open(filename)) {
+			if (err) {
+				(*err) = std::string("Cannot open file [") + filename + "]\n";
+			}
+			return false;
+		}
+
+		tinyobj::MaterialFileReader matFileReader(mtlBasedir ? mtlBasedir : "");
+		return parseObj(reinterpret_cast<const char*>(file.data()), file.size(), attrib, shapes, materials, err, &matFileReader, triangulate, jobs);
+	}
+}
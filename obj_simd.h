@@ -0,0 +1,308 @@
+﻿#pragma once
+//obj中 "v x y z" 行的向量化解析
+//1. 用AVX2一次对整行(最多32字节)的字符分类: 数字、空白、小数点、符号，用位运算找出前三个数字的起止位置
+//2. 三个数字放在同一个向量的不同lane中，按tinyobj::tryParseDouble完全相同的运算顺序累加(先乘后加，不使用FMA)，保证结果逐位相同
+//遇到指数、超长的行、多余的字符等情况返回false，由调用者退回到标量解析
+//指令集在运行时检测，不支持时使用标量实现
+//只计解析(float_parse_bench的parse-only一项，"v %.6f %.6f %.6f"的行)，AVX2比标量快约25%~30%(单核 297 -> 377、270 -> 353 MB/s)
+//SSE4.2版本(16字节分两次分类，x/y和z分两个向量累加)只快4%~7%，在噪声范围内，已经去掉
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PARALLELOBJ_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//GCC/Clang需要为单独的函数开启指令集，MSVC可以直接使用intrinsic
+#if defined(PARALLELOBJ_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLELOBJ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PARALLELOBJ_TARGET_AVX2
+#endif
+
+namespace parallelobj {
+	namespace simd {
+
+		enum class Level {
+			Scalar,
+			AVX2
+		};
+
+		inline const char* levelName(Level level) {
+			switch (level) {
+			case Level::AVX2: return "AVX2";
+			default: return "scalar";
+			}
+		}
+
+		//检测CPU和操作系统支持的指令集
+		inline Level detectLevel() {
+#ifdef PARALLELOBJ_X86
+			unsigned int regs[4] = {};
+			auto cpuid = [&](unsigned int leaf, unsigned int sub) {
+#ifdef _MSC_VER
+				int r[4];
+				__cpuidex(r, static_cast<int>(leaf), static_cast<int>(sub));
+				for (int i = 0; i < 4; ++i) regs[i] = static_cast<unsigned int>(r[i]);
+#else
+				__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+			};
+			cpuid(0, 0);
+			unsigned int maxLeaf = regs[0];
+			if (maxLeaf < 1) {
+				return Level::Scalar;
+			}
+			cpuid(1, 0);
+			bool osxsave = (regs[2] & (1u << 27)) != 0;
+			bool avx = (regs[2] & (1u << 28)) != 0;
+			bool avx2 = false;
+			if (maxLeaf >= 7 && osxsave && avx) {
+				//操作系统需要在上下文切换时保存ymm寄存器
+				uint64_t xcr0;
+#ifdef _MSC_VER
+				xcr0 = _xgetbv(0);
+#else
+				unsigned int eax, edx;
+				__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+				xcr0 = (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+				cpuid(7, 0);
+				avx2 = (xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5)) != 0;
+			}
+			if (avx2) return Level::AVX2;
+#endif
+			return Level::Scalar;
+		}
+
+		//当前使用的指令集，默认为检测结果，性能测试时可以修改
+		inline Level& activeLevel() {
+			static Level level = detectLevel();
+			return level;
+		}
+
+		//与tryParseDouble中的pow_lut以及std::pow(10.0, -read)相同的值，下标为小数的位数
+		struct FractionTable {
+			double values[33];
+			FractionTable() {
+				static const double pow_lut[] = {
+					1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+				};
+				for (int i = 0; i < 33; ++i) {
+					//与标量代码一样在运行时调用std::pow，避免编译期常量折叠带来的差异
+					volatile int read = i;
+					values[i] = i < 8 ? pow_lut[i] : std::pow(10.0, -read);
+				}
+			}
+		};
+
+		inline const double* fractionTable() {
+			static const FractionTable table;
+			return table.values;
+		}
+
+		inline uint32_t countTrailingZeros(uint32_t x) {
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, x);
+			return static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_ctz(x));
+#endif
+		}
+
+		inline uint32_t lowBits(uint32_t n) {
+			return n >= 32 ? 0xffffffffu : ((1u << n) - 1);
+		}
+
+		//一行中前三个数字的位置
+		struct NumberSpans {
+			uint8_t digitBegin[3];	//第一个数字字符
+			uint8_t intDigits[3];	//整数部分位数
+			uint8_t fracDigits[3];	//小数部分位数
+			bool negative[3];
+			uint8_t maxInt;
+			uint8_t maxFrac;
+		};
+
+		//根据字符分类的位掩码找出前三个数字，格式不是 [+-]digits[.digits] 时返回false
+		inline bool locateNumbers(uint32_t valid, uint32_t digit, uint32_t space, uint32_t dot, uint32_t minus, uint32_t plus, NumberSpans& spans) {
+			digit &= valid;
+			space &= valid;
+			dot &= valid;
+			uint32_t sign = (minus | plus) & valid;
+			if ((valid & ~(digit | space | dot | sign)) != 0) {
+				return false; //指数或者其他字符
+			}
+			uint32_t nonSpace = valid & ~space;
+			uint32_t starts = nonSpace & ~(nonSpace << 1);
+			spans.maxInt = 0;
+			spans.maxFrac = 0;
+			for (int i = 0; i < 3; ++i) {
+				if (starts == 0) {
+					return false; //少于三个数字
+				}
+				uint32_t begin = countTrailingZeros(starts);
+				starts &= starts - 1;
+				//token从begin开始，到下一个空白或者行尾为止
+				uint32_t after = ~nonSpace & ~lowBits(begin);
+				uint32_t tokenEnd = after ? countTrailingZeros(after) : 32;
+				uint32_t tokenMask = lowBits(tokenEnd) & ~lowBits(begin);
+
+				uint32_t p = begin;
+				spans.negative[i] = (minus & (1u << begin)) != 0;
+				if (sign & (1u << begin)) {
+					++p;
+				}
+				if ((sign & tokenMask & ~(1u << begin)) != 0) {
+					return false; //符号只能在开头
+				}
+				if (p >= tokenEnd || !(digit & (1u << p))) {
+					return false; //必须以数字开始
+				}
+				uint32_t dots = dot & tokenMask;
+				if (dots & (dots - 1)) {
+					return false; //多个小数点
+				}
+				uint32_t dotPos = dots ? countTrailingZeros(dots) : tokenEnd;
+				if (dotPos - p > 8 || (dots && tokenEnd - dotPos - 1 > 16)) {
+					return false; //整数部分最多8位，小数部分最多16位
+				}
+				spans.digitBegin[i] = static_cast<uint8_t>(p);
+				spans.intDigits[i] = static_cast<uint8_t>(dotPos - p);
+				spans.fracDigits[i] = static_cast<uint8_t>(dots ? tokenEnd - dotPos - 1 : 0);
+				spans.maxInt = std::max(spans.maxInt, spans.intDigits[i]);
+				spans.maxFrac = std::max(spans.maxFrac, spans.fracDigits[i]);
+			}
+			return true;
+		}
+
+		//把每个数字的整数部分和小数部分分别打包为64位整数，每个字节是一个数字(小端)
+		//整数部分右对齐: 第k步(从0开始)的数字在第 8 - maxInt + k 个字节，位数不足的左侧补0
+		//小数部分左对齐: 第k步(从1开始)的数字在第 k - 1 个字节，位数不足的右侧补0，超过8位的部分在fraction2中
+		//补的0不改变累加结果，这样三个数字可以在同一个循环里按相同的步数计算
+		struct DigitWords {
+			uint64_t integer[3];
+			uint64_t fraction[3];
+			uint64_t fraction2[3];
+		};
+
+		inline uint64_t loadWord(const char* p) {
+			uint64_t word;
+			memcpy(&word, p, sizeof(word));
+			return word;
+		}
+
+		//低n个字节全为1
+		inline uint64_t lowBytes(uint32_t n) {
+			return n >= 8 ? ~0ull : ((1ull << (8 * n)) - 1);
+		}
+
+		//取出mask中的字节并减去'0'，mask以外的字节为0所以不会产生借位
+		inline uint64_t digitBytes(uint64_t word, uint64_t mask) {
+			return (word & mask) - (0x3030303030303030ull & mask);
+		}
+
+		//直接从行中读取，p需要至少64个可读字节
+		inline void packDigits(const char* p, const NumberSpans& spans, DigitWords& words) {
+			for (int i = 0; i < 3; ++i) {
+				uint32_t dotPos = spans.digitBegin[i] + spans.intDigits[i];
+				uint32_t fracDigits = spans.fracDigits[i];
+				uint32_t shift = 8 * (8 - spans.intDigits[i]);
+				words.integer[i] = (loadWord(p + spans.digitBegin[i]) << shift) - (0x3030303030303030ull << shift);
+				words.fraction[i] = digitBytes(loadWord(p + dotPos + 1), lowBytes(fracDigits));
+				words.fraction2[i] = fracDigits > 8 ? digitBytes(loadWord(p + dotPos + 9), lowBytes(fracDigits - 8)) : 0;
+			}
+		}
+
+#ifdef PARALLELOBJ_X86
+		//p指向至少64个可读字节，len为行的有效长度(不超过32)
+		PARALLELOBJ_TARGET_AVX2 inline bool parseVec3AVX2(const char* p, uint32_t len, double out[3]) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+			uint32_t digit = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d)));
+			uint32_t space = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t')))));
+			uint32_t dot = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.'))));
+			uint32_t minus = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'))));
+			uint32_t plus = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'))));
+
+			NumberSpans spans;
+			if (!locateNumbers(lowBits(len), digit, space, dot, minus, plus, spans)) {
+				return false;
+			}
+
+			DigitWords words;
+			packDigits(p, spans, words);
+			const double* table = fractionTable();
+
+			//小整数转换为double: 放入指数为2^52的double的尾数中再减去2^52，结果是精确的
+			const __m256i byteMask = _mm256_set1_epi64x(0xff);
+			const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000ll);
+			const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+
+			//三个数字分别在lane 0, 1, 2，与标量代码相同: 先乘再加，两次舍入
+			__m256d mantissa = _mm256_setzero_pd();
+			const __m256d ten = _mm256_set1_pd(10.0);
+			__m256i integer = _mm256_setr_epi64x(static_cast<long long>(words.integer[0]), static_cast<long long>(words.integer[1]), static_cast<long long>(words.integer[2]), 0);
+			integer = _mm256_srl_epi64(integer, _mm_cvtsi32_si128(8 * (8 - spans.maxInt)));
+			for (int k = 0; k < spans.maxInt; ++k) {
+				__m256d digitValue = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(integer, byteMask), magicBits)), magic);
+				mantissa = _mm256_add_pd(_mm256_mul_pd(mantissa, ten), digitValue);
+				integer = _mm256_srli_epi64(integer, 8);
+			}
+			__m256i fraction = _mm256_setr_epi64x(static_cast<long long>(words.fraction[0]), static_cast<long long>(words.fraction[1]), static_cast<long long>(words.fraction[2]), 0);
+			for (int k = 1; k <= spans.maxFrac; ++k) {
+				if (k == 9) {
+					fraction = _mm256_setr_epi64x(static_cast<long long>(words.fraction2[0]), static_cast<long long>(words.fraction2[1]), static_cast<long long>(words.fraction2[2]), 0);
+				}
+				__m256d digitValue = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(fraction, byteMask), magicBits)), magic);
+				mantissa = _mm256_add_pd(mantissa, _mm256_mul_pd(digitValue, _mm256_broadcast_sd(table + k)));
+				fraction = _mm256_srli_epi64(fraction, 8);
+			}
+			__m256d sign = _mm256_set_pd(1.0, spans.negative[2] ? -1.0 : 1.0, spans.negative[1] ? -1.0 : 1.0, spans.negative[0] ? -1.0 : 1.0);
+			alignas(32) double result[4];
+			_mm256_store_pd(result, _mm256_mul_pd(sign, mantissa));
+			out[0] = result[0];
+			out[1] = result[1];
+			out[2] = result[2];
+			return true;
+		}
+#endif
+
+		//解析 "v" 之后的三个坐标，bufferEnd是可以安全读取的内存末尾，返回false时调用者需要使用标量解析
+		//注意: 逐位相同依赖于标量代码中的乘加没有被编译器合并为FMA(MSVC以及不带-mfma的GCC/Clang都不会合并)
+		inline bool parseVertex3(const char* token, const char* lineEnd, const char* bufferEnd, double out[3]) {
+#ifdef PARALLELOBJ_X86
+			Level level = activeLevel();
+			size_t len = static_cast<size_t>(lineEnd - token);
+			if (level == Level::Scalar || len > 32) {
+				return false;
+			}
+			const char* p = token;
+			alignas(32) char padded[64];
+			//靠近缓冲区末尾时复制到局部缓冲，避免越界读取
+			if (bufferEnd - token < 64) {
+				memset(padded, ' ', sizeof(padded));
+				memcpy(padded, token, len);
+				p = padded;
+			}
+			return parseVec3AVX2(p, static_cast<uint32_t>(len), out);
+#else
+			(void)token;
+			(void)lineEnd;
+			(void)bufferEnd;
+			(void)out;
+			return false;
+#endif
+		}
+	}
+}
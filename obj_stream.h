@@ -0,0 +1,207 @@
+﻿#pragma once
+//基于tinyobj::LoadObjWithCallback的流式obj读取，用于超大模型，主存占用与模型大小无关
+//面索引需要随机访问位置和纹理坐标，所以分两遍读取:
+//1. AttributeSpill: 第一遍把v和vt按float顺序写到两个临时文件，同时统计三角化之后的角点数量，写完后映射这两个文件
+//2. Reader: 第二遍在回调中立即三角化面(与LoadObj相同的扇形三角化)，每个角点通过回调输出
+//位置和纹理坐标只存在于文件映射中，由操作系统按需换入换出；进程自己只保留文件流的缓冲，不构建attrib_t/shape_t
+//注意: 需要在包含本文件之前包含tiny_obj_loader.h
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace objstream {
+
+	//三角形的一个角点，key由(v, vt)组成，key相同的角点可以焊接为同一个顶点
+	struct Corner {
+		uint64_t key;
+		const float* position;	//3个float
+		const float* texcoord;	//2个float，没有纹理坐标时为(0, 0)
+	};
+
+	//第一遍读取的结果，析构时删除临时文件
+	class AttributeSpill {
+	public:
+		//临时文件为basePath.v.tmp和basePath.vt.tmp
+		explicit AttributeSpill(const std::string& basePath)
+			: positionPath(basePath + ".v.tmp"), texcoordPath(basePath + ".vt.tmp") {}
+		AttributeSpill(const AttributeSpill&) = delete;
+		AttributeSpill& operator=(const AttributeSpill&) = delete;
+		~AttributeSpill() {
+			//windows上映射中的文件不能删除，先解除映射
+			positionFile.close();
+			texcoordFile.close();
+			std::error_code ec;
+			std::filesystem::remove(positionPath, ec);
+			std::filesystem::remove(texcoordPath, ec);
+		}
+
+		bool write(std::istream& in, std::string* err) {
+			Output output(positionPath, texcoordPath);
+			tinyobj::callback_t callback;
+			callback.vertex_cb = vertexCallback;
+			callback.texcoord_cb = texcoordCallback;
+			callback.index_cb = indexCallback;
+			std::string loaderErr;
+			bool ok = tinyobj::LoadObjWithCallback(in, callback, &output, nullptr, &loaderErr);
+			output.positions.close();
+			output.texcoords.close();
+			if (!ok || output.positions.fail() || output.texcoords.fail()) {
+				if (err) {
+					*err = loaderErr.empty() ? "failed to write " + positionPath : loaderErr;
+				}
+				return false;
+			}
+			if (!positionFile.open(positionPath) || !texcoordFile.open(texcoordPath)) {
+				if (err) {
+					*err = "failed to map " + positionPath;
+				}
+				return false;
+			}
+			corners = output.corners;
+			return true;
+		}
+
+		uint64_t cornerCount() const { return corners; }
+		size_t positionCount() const { return positionFile.size() / (3 * sizeof(float)); }
+		size_t texcoordCount() const { return texcoordFile.size() / (2 * sizeof(float)); }
+		const float* positions() const { return reinterpret_cast<const float*>(positionFile.data()); }
+		const float* texcoords() const { return reinterpret_cast<const float*>(texcoordFile.data()); }
+
+	private:
+		struct Output {
+			Output(const std::string& positionPath, const std::string& texcoordPath)
+				: positionBuffer(1 << 20), texcoordBuffer(1 << 20) {
+				//缓冲需要在打开文件之前设置
+				positions.rdbuf()->pubsetbuf(positionBuffer.data(), positionBuffer.size());
+				texcoords.rdbuf()->pubsetbuf(texcoordBuffer.data(), texcoordBuffer.size());
+				positions.open(positionPath, std::ios::binary | std::ios::trunc);
+				texcoords.open(texcoordPath, std::ios::binary | std::ios::trunc);
+			}
+			std::vector<char> positionBuffer;
+			std::vector<char> texcoordBuffer;
+			std::ofstream positions;
+			std::ofstream texcoords;
+			uint64_t corners = 0;
+		};
+
+		static void vertexCallback(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t) {
+			const float v[3] = { static_cast<float>(x), static_cast<float>(y), static_cast<float>(z) };
+			static_cast<Output*>(user)->positions.write(reinterpret_cast<const char*>(v), sizeof(v));
+		}
+
+		static void texcoordCallback(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t) {
+			const float vt[2] = { static_cast<float>(x), static_cast<float>(y) };
+			static_cast<Output*>(user)->texcoords.write(reinterpret_cast<const char*>(vt), sizeof(vt));
+		}
+
+		static void indexCallback(void* user, tinyobj::index_t*, int count) {
+			if (count >= 3) {
+				static_cast<Output*>(user)->corners += uint64_t(count - 2) * 3;
+			}
+		}
+
+		std::string positionPath;
+		std::string texcoordPath;
+		MappedFile positionFile;
+		MappedFile texcoordFile;
+		uint64_t corners = 0;
+	};
+
+	//emit(const Corner&)在每个三角形角点上调用一次，同一个三角形的三个角点连续输出
+	//emit返回false时停止输出，read返回false
+	template <typename EmitCorner>
+	class Reader {
+	public:
+		Reader(const AttributeSpill& attributes, EmitCorner& emit) : attributes(attributes), emit(emit) {}
+
+		bool read(std::istream& in, std::string* err) {
+			tinyobj::callback_t callback;
+			callback.vertex_cb = vertexCallback;
+			callback.texcoord_cb = texcoordCallback;
+			callback.index_cb = indexCallback;
+			std::string loaderErr;
+			bool ok = tinyobj::LoadObjWithCallback(in, callback, this, nullptr, &loaderErr);
+			if (ok && error.empty() && (positionsSeen != attributes.positionCount() || texcoordsSeen != attributes.texcoordCount())) {
+				error = "obj changed between the two passes";
+			}
+			if (err) {
+				*err = error.empty() ? loaderErr : error;
+			}
+			return ok && error.empty();
+		}
+
+	private:
+		//第二遍只需要知道已经出现的数量，用来解析相对索引
+		static void vertexCallback(void* user, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t) {
+			static_cast<Reader*>(user)->positionsSeen++;
+		}
+
+		static void texcoordCallback(void* user, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t) {
+			static_cast<Reader*>(user)->texcoordsSeen++;
+		}
+
+		static void indexCallback(void* user, tinyobj::index_t* indices, int count) {
+			auto* self = static_cast<Reader*>(user);
+			if (!self->error.empty()) {
+				return;
+			}
+			for (int k = 2; k < count; ++k) {
+				if (!self->emitCorner(indices[0]) || !self->emitCorner(indices[k - 1]) || !self->emitCorner(indices[k])) {
+					return;
+				}
+			}
+		}
+
+		//回调中的索引是obj中的原始值: 从1开始，负数为相对于已经出现的数量的索引，0表示没有
+		//与LoadObj相同，正数索引可以引用文件中之后才出现的v/vt
+		static bool resolve(int raw, size_t seen, size_t total, size_t& index) {
+			if (raw > 0 && static_cast<size_t>(raw) <= total) {
+				index = static_cast<size_t>(raw - 1);
+				return true;
+			}
+			if (raw < 0 && static_cast<size_t>(-static_cast<int64_t>(raw)) <= seen) {
+				index = seen - static_cast<size_t>(-static_cast<int64_t>(raw));
+				return true;
+			}
+			return false;
+		}
+
+		bool emitCorner(const tinyobj::index_t& index) {
+			size_t v;
+			if (!resolve(index.vertex_index, positionsSeen, attributes.positionCount(), v) || v >= UINT32_MAX) {
+				error = "face references undefined vertex " + std::to_string(index.vertex_index);
+				return false;
+			}
+			static const float noTexcoord[2] = { 0.f, 0.f };
+			Corner corner{ uint64_t(v) << 32, attributes.positions() + 3 * v, noTexcoord };
+			if (index.texcoord_index != 0) {
+				size_t vt;
+				if (!resolve(index.texcoord_index, texcoordsSeen, attributes.texcoordCount(), vt) || vt >= UINT32_MAX) {
+					error = "face references undefined texcoord " + std::to_string(index.texcoord_index);
+					return false;
+				}
+				//低32位为vt + 1，0表示没有纹理坐标
+				corner.key |= vt + 1;
+				corner.texcoord = attributes.texcoords() + 2 * vt;
+			}
+			if (!emit(corner)) {
+				error = "face corner rejected by output";
+				return false;
+			}
+			return true;
+		}
+
+		const AttributeSpill& attributes;
+		EmitCorner& emit;
+		size_t positionsSeen = 0;
+		size_t texcoordsSeen = 0;
+		std::string error;
+	};
+
+}
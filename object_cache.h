@@ -0,0 +1,163 @@
+﻿#pragma once
+//采样器和image view的共享缓存: 按create info的内容查找，内容相同时返回同一个句柄并增加引用计数，引用计数归零时销毁
+//大量材质使用相同的采样器参数，不缓存时每个材质都会创建一个采样器，很容易超过maxSamplerAllocationCount，场景加载时也要花时间创建对象
+//create info先转换成定长的键(浮点数按位比较)，只支持pNext为空的create info
+//image view的键包含VkImage句柄，销毁image之前必须释放它的所有view，否则新的image复用句柄值时会拿到旧的view
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace objcache {
+
+	//键的最大字段数，VkImageViewCreateInfo需要13个
+	const size_t KEY_FIELDS = 16;
+	using Key = std::array<uint64_t, KEY_FIELDS>;
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			uint64_t h = 0xcbf29ce484222325ull;
+			for (uint64_t field : key) {
+				h = (h ^ field) * 0x100000001b3ull;
+			}
+			return static_cast<size_t>(h ^ (h >> 32));
+		}
+	};
+
+	//非分发句柄在32位平台上是uint64_t，在64位平台上是指针
+	template<typename Handle>
+	inline uint64_t handleBits(Handle handle) {
+		uint64_t bits = 0;
+		memcpy(&bits, &handle, sizeof(handle));
+		return bits;
+	}
+
+	inline uint64_t floatBits(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	inline Key makeKey(const VkSamplerCreateInfo& info) {
+		return { info.flags, uint64_t(info.magFilter), uint64_t(info.minFilter), uint64_t(info.mipmapMode),
+			uint64_t(info.addressModeU), uint64_t(info.addressModeV), uint64_t(info.addressModeW), floatBits(info.mipLodBias),
+			info.anisotropyEnable, floatBits(info.maxAnisotropy), info.compareEnable, uint64_t(info.compareOp),
+			floatBits(info.minLod), floatBits(info.maxLod), uint64_t(info.borderColor), info.unnormalizedCoordinates };
+	}
+
+	inline Key makeKey(const VkImageViewCreateInfo& info) {
+		return { info.flags, handleBits(info.image), uint64_t(info.viewType), uint64_t(info.format),
+			uint64_t(info.components.r), uint64_t(info.components.g), uint64_t(info.components.b), uint64_t(info.components.a),
+			info.subresourceRange.aspectMask, info.subresourceRange.baseMipLevel, info.subresourceRange.levelCount,
+			info.subresourceRange.baseArrayLayer, info.subresourceRange.layerCount };
+	}
+
+	inline VkResult createObject(VkDevice device, const VkSamplerCreateInfo& info, VkSampler& handle) {
+		return vkCreateSampler(device, &info, nullptr, &handle);
+	}
+
+	inline VkResult createObject(VkDevice device, const VkImageViewCreateInfo& info, VkImageView& handle) {
+		return vkCreateImageView(device, &info, nullptr, &handle);
+	}
+
+	inline void destroyObject(VkDevice device, VkSampler handle) {
+		vkDestroySampler(device, handle, nullptr);
+	}
+
+	inline void destroyObject(VkDevice device, VkImageView handle) {
+		vkDestroyImageView(device, handle, nullptr);
+	}
+
+	template<typename CreateInfo, typename Handle>
+	class SharedCache {
+	public:
+		struct Stats {
+			uint64_t created = 0;	//实际调用vkCreate*的次数
+			uint64_t reused = 0;	//命中缓存、没有创建新对象的次数
+			size_t alive = 0;		//当前存在的对象数
+		};
+
+		void init(VkDevice device) {
+			this->device = device;
+		}
+
+		//返回与info内容相同的对象，没有时创建，每次acquire都要对应一次release
+		Handle acquire(const CreateInfo& info) {
+			if (info.pNext != nullptr) {
+				throw std::runtime_error("cached create info must not have a pNext chain");
+			}
+			Key key = makeKey(info);
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = entries.find(key);
+			if (found != entries.end()) {
+				++found->second.references;
+				++stats.reused;
+				return found->second.handle;
+			}
+			Handle handle = VK_NULL_HANDLE;
+			if (createObject(device, info, handle) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create cached vulkan object");
+			}
+			entries.emplace(key, Entry{ handle, 1 });
+			keys.emplace(handleBits(handle), key);
+			++stats.created;
+			return handle;
+		}
+
+		//引用计数归零时销毁对象，调用者需要保证GPU已经不再使用它
+		void release(Handle handle) {
+			if (handle == VK_NULL_HANDLE) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			auto key = keys.find(handleBits(handle));
+			if (key == keys.end()) {
+				throw std::runtime_error("released a vulkan object that is not in the cache");
+			}
+			auto entry = entries.find(key->second);
+			if (--entry->second.references == 0) {
+				destroyObject(device, handle);
+				entries.erase(entry);
+				keys.erase(key);
+			}
+		}
+
+		//销毁所有对象，不管引用计数，在销毁逻辑设备之前调用
+		void destroy() {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto&& entry : entries) {
+				destroyObject(device, entry.second.handle);
+			}
+			entries.clear();
+			keys.clear();
+		}
+
+		Stats getStats() {
+			std::lock_guard<std::mutex> lock(mutex);
+			Stats result = stats;
+			result.alive = entries.size();
+			return result;
+		}
+
+	private:
+		struct Entry {
+			Handle handle;
+			uint32_t references;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		std::mutex mutex;
+		std::unordered_map<Key, Entry, KeyHash> entries;
+		std::unordered_map<uint64_t, Key> keys;		//句柄 -> 键，release时使用
+		Stats stats;
+	};
+
+}
+
+using SamplerCache = objcache::SharedCache<VkSamplerCreateInfo, VkSampler>;
+using ImageViewCache = objcache::SharedCache<VkImageViewCreateInfo, VkImageView>;
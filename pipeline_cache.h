@@ -0,0 +1,88 @@
+﻿#pragma once
+//VkPipelineCache的数据保存到磁盘，下次启动时作为初始数据，管线创建时驱动不需要重新编译shader
+//文件布局: PipelineCacheFileHeader | vkGetPipelineCacheData返回的数据
+//驱动不一定检查数据是否损坏，损坏的数据可能导致崩溃，所以读取时先检查自己的头(大小和hash)，
+//再检查数据开头的VkPipelineCacheHeaderVersionOne(vendorID/deviceID/pipelineCacheUUID)与当前设备一致，任何一项不匹配都从空的cache开始
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "file_util.h"
+
+namespace pipecache {
+
+	const uint32_t MAGIC = 0x43504b56; //"VKPC"
+	const uint32_t VERSION = 1;
+
+	struct PipelineCacheFileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t dataSize;		//之后的vkGetPipelineCacheData数据的大小
+		uint64_t dataHash;		//数据的hash，检查文件是否损坏
+		uint32_t vendorID;		//写入时的设备，与数据中的头重复，不解析数据也能判断
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint32_t reserved;
+	};
+	static_assert(sizeof(PipelineCacheFileHeader) % 8 == 0, "pipeline cache header must keep the data aligned");
+
+	//检查数据开头的VkPipelineCacheHeaderVersionOne是否由当前设备产生
+	inline bool matchesDevice(const void* data, size_t size, const VkPhysicalDeviceProperties& properties) {
+		VkPipelineCacheHeaderVersionOne header;
+		if (size < sizeof(header)) {
+			return false;
+		}
+		memcpy(&header, data, sizeof(header));
+		return header.headerSize >= sizeof(header) && header.headerSize <= size
+			&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& header.vendorID == properties.vendorID && header.deviceID == properties.deviceID
+			&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	//读取保存的数据，文件不存在、损坏或者来自其他设备/驱动时返回空
+	inline std::vector<uint8_t> read(const std::string& path, const VkPhysicalDeviceProperties& properties) {
+		MappedFile file;
+		if (!file.open(path) || file.size() < sizeof(PipelineCacheFileHeader)) {
+			return {};
+		}
+		PipelineCacheFileHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		const uint8_t* data = file.data() + sizeof(header);
+		if (header.magic != MAGIC || header.version != VERSION || header.dataSize != file.size() - sizeof(header)
+			|| header.vendorID != properties.vendorID || header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion
+			|| memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			return {};
+		}
+		if (fileutil::hashBytes(data, header.dataSize) != header.dataHash || !matchesDevice(data, header.dataSize, properties)) {
+			return {};
+		}
+		return std::vector<uint8_t>(data, data + header.dataSize);
+	}
+
+	//先写到临时文件再重命名，程序在写入过程中退出时不会留下写了一半的文件
+	inline bool write(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<uint8_t>& data) {
+		if (!matchesDevice(data.data(), data.size(), properties)) {
+			return false;
+		}
+		PipelineCacheFileHeader header{};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.dataSize = data.size();
+		header.dataHash = fileutil::hashBytes(data.data(), data.size());
+		header.vendorID = properties.vendorID;
+		header.deviceID = properties.deviceID;
+		header.driverVersion = properties.driverVersion;
+		memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+		return fileutil::atomicWriteFile(path, {
+			{ &header, sizeof(header) },
+			{ data.data(), data.size() },
+		});
+	}
+}
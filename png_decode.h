@@ -0,0 +1,725 @@
+﻿#pragma once
+//PNG解码的快速路径，覆盖纹理最常用的格式: 8位的灰度/灰度+alpha/RGB/RGBA/调色板，不隔行扫描
+//结果与stbi_load_from_memory(..., STBI_rgb_alpha)逐位相同；其他格式(16位、1/2/4位、隔行扫描、CgBI等)或数据有错误时返回false，由调用者回退到stb_image
+//inflate: 64位的位缓冲一次补充多个字节；litlen码表的一级表为11位，两个短码字面量合并成一项一次解出；LZ77的匹配按8字节拷贝
+//反滤波: Up按16字节处理，3/4字节像素的Sub/Avg用SSE2一次处理一个像素(像素之间有依赖)
+//Paeth每个像素的选择依赖上一个像素，SSE2版本每个像素的指令更多，测试中比标量慢(bpp 3: 0.84x，bpp 4: 0.95x)，所以只用标量
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PNGDEC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace pngdec {
+
+	//码表的每一项: 0-7位是需要消耗的位数，8-11位是类型，12-15位是额外位数，16-31位是值
+	enum EntryType : uint32_t {
+		ENTRY_INVALID = 0,
+		ENTRY_LITERAL = 1,			//值: 字面量(码长码表中是符号)
+		ENTRY_LITERAL_PAIR = 2,		//16-23位和24-31位: 先后两个字面量
+		ENTRY_LENGTH = 3,			//值: 基础长度
+		ENTRY_END = 4,
+		ENTRY_SUBTABLE = 5,			//值: 二级表在表中的偏移，额外位数: 二级表的索引位数
+		ENTRY_DISTANCE = 6,			//值: 基础距离
+	};
+
+	enum class TableKind {
+		LitLen,
+		Distance,
+		CodeLength,
+	};
+
+	const uint32_t LITLEN_BITS = 11;
+	const uint32_t DISTANCE_BITS = 8;
+	const uint32_t CODELENGTH_BITS = 7;
+	const size_t INPUT_PADDING = 16;	//压缩数据之后需要可读的字节数，位缓冲一次读取8字节
+	const size_t OUTPUT_SLACK = 16;		//输出之后需要可写的字节数，匹配按8字节拷贝时会多写
+
+	const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	inline uint32_t makeEntry(uint32_t bits, uint32_t type, uint32_t extra, uint32_t value) {
+		return bits | (type << 8) | (extra << 12) | (value << 16);
+	}
+
+	inline uint32_t entryType(uint32_t entry) { return (entry >> 8) & 0xf; }
+	inline uint32_t entryBits(uint32_t entry) { return entry & 0xff; }
+	inline uint32_t entryExtra(uint32_t entry) { return (entry >> 12) & 0xf; }
+	inline uint32_t entryValue(uint32_t entry) { return entry >> 16; }
+
+	inline uint32_t symbolEntry(TableKind kind, uint32_t symbol, uint32_t bits) {
+		switch (kind) {
+		case TableKind::LitLen:
+			if (symbol < 256) {
+				return makeEntry(bits, ENTRY_LITERAL, 0, symbol);
+			}
+			if (symbol == 256) {
+				return makeEntry(bits, ENTRY_END, 0, 0);
+			}
+			if (symbol < 286) {
+				return makeEntry(bits, ENTRY_LENGTH, lengthExtra[symbol - 257], lengthBase[symbol - 257]);
+			}
+			return ENTRY_INVALID;
+		case TableKind::Distance:
+			return symbol < 30 ? makeEntry(bits, ENTRY_DISTANCE, distanceExtra[symbol], distanceBase[symbol]) : ENTRY_INVALID;
+		default:
+			return makeEntry(bits, ENTRY_LITERAL, 0, symbol);
+		}
+	}
+
+	inline uint32_t reverseBits(uint32_t code, uint32_t length) {
+		uint32_t result = 0;
+		for (uint32_t i = 0; i < length; ++i) {
+			result = (result << 1) | ((code >> i) & 1);
+		}
+		return result;
+	}
+
+	//由各符号的码长(0-15)构造码表，前(1 << primaryBits)项是一级表，码长超过primaryBits的码放在后面的二级表中
+	//码超额(over-subscribed)时返回false，允许不完整的码，没有对应码的项是ENTRY_INVALID
+	//litlen码表中两个码长之和不超过primaryBits的字面量合并成ENTRY_LITERAL_PAIR
+	inline bool buildTable(const uint8_t* lengths, uint32_t count, TableKind kind, uint32_t primaryBits, std::vector<uint32_t>& table) {
+		uint32_t lengthCount[16] = {};
+		for (uint32_t i = 0; i < count; ++i) {
+			++lengthCount[lengths[i]];
+		}
+		lengthCount[0] = 0;
+		int32_t left = 1;
+		uint32_t maxLength = 0;
+		uint32_t nextCode[16] = {};
+		uint32_t code = 0;
+		for (uint32_t length = 1; length < 16; ++length) {
+			left = (left << 1) - static_cast<int32_t>(lengthCount[length]);
+			if (left < 0) {
+				return false;
+			}
+			if (lengthCount[length]) {
+				maxLength = length;
+			}
+			code = (code + lengthCount[length - 1]) << 1;
+			nextCode[length] = code;
+		}
+
+		const uint32_t primarySize = 1u << primaryBits;
+		const uint32_t subBits = maxLength > primaryBits ? maxLength - primaryBits : 0;
+		table.assign(primarySize, ENTRY_INVALID);
+		for (uint32_t symbol = 0; symbol < count; ++symbol) {
+			uint32_t length = lengths[symbol];
+			if (length == 0) {
+				continue;
+			}
+			//码从高位开始存放在数据流中，按位反转后就可以直接用位缓冲的低位查表
+			uint32_t reversed = reverseBits(nextCode[length]++, length);
+			if (length <= primaryBits) {
+				uint32_t entry = symbolEntry(kind, symbol, length);
+				for (uint32_t i = reversed; i < primarySize; i += 1u << length) {
+					table[i] = entry;
+				}
+				continue;
+			}
+			uint32_t prefix = reversed & (primarySize - 1);
+			if (entryType(table[prefix]) != ENTRY_SUBTABLE) {
+				table[prefix] = makeEntry(primaryBits, ENTRY_SUBTABLE, subBits, static_cast<uint32_t>(table.size()));
+				table.resize(table.size() + (size_t(1) << subBits), ENTRY_INVALID);
+			}
+			uint32_t offset = entryValue(table[prefix]);
+			uint32_t rest = length - primaryBits;
+			uint32_t entry = symbolEntry(kind, symbol, rest);
+			for (uint32_t i = reversed >> primaryBits; i < (1u << subBits); i += 1u << rest) {
+				table[offset + i] = entry;
+			}
+		}
+
+		if (kind == TableKind::LitLen) {
+			//从后往前处理，table[i >> bits]总在i之前，读到的还是单个字面量的项
+			for (uint32_t i = primarySize; i-- > 0;) {
+				uint32_t first = table[i];
+				if (entryType(first) != ENTRY_LITERAL || entryBits(first) >= primaryBits) {
+					continue;
+				}
+				uint32_t second = table[i >> entryBits(first)];
+				uint32_t bits = entryBits(first) + entryBits(second);
+				if (entryType(second) == ENTRY_LITERAL && bits <= primaryBits) {
+					table[i] = bits | (ENTRY_LITERAL_PAIR << 8) | (entryValue(first) << 16) | (entryValue(second) << 24);
+				}
+			}
+		}
+		return true;
+	}
+
+	//从低位开始读取的位缓冲，refill之后至少有56位可用，最多读到数据之后INPUT_PADDING字节的位置
+	struct BitReader {
+		const uint8_t* begin;
+		const uint8_t* next;
+		const uint8_t* end;
+		uint64_t buffer = 0;
+		uint32_t count = 0;		//buffer中有效的位数，更高的位是之后的数据，不影响结果
+
+		BitReader(const uint8_t* data, size_t size) : begin(data), next(data), end(data + size) {}
+
+		//读取超过数据末尾8字节时返回false，说明数据被截断
+		bool refill() {
+			if (count < 56) {
+				if (next > end + 8) {
+					return false;
+				}
+				uint64_t bytes;
+				memcpy(&bytes, next, 8);
+				buffer |= bytes << count;
+				next += (63 - count) >> 3;
+				count |= 56;
+			}
+			return true;
+		}
+
+		void consume(uint32_t bits) {
+			buffer >>= bits;
+			count -= bits;
+		}
+
+		uint32_t bits(uint32_t n) {
+			uint32_t value = static_cast<uint32_t>(buffer & ((uint64_t(1) << n) - 1));
+			consume(n);
+			return value;
+		}
+
+		//已经消耗的位数，用来检查是否读到了数据之后的填充
+		size_t consumedBits() const {
+			return size_t(next - begin) * 8 - count;
+		}
+
+		//丢弃到字节边界，之后直接从next按字节读取
+		void alignToByte() {
+			next -= count >> 3;
+			buffer = 0;
+			count = 0;
+		}
+	};
+
+	//查表解出一个符号，需要之前refill过
+	inline uint32_t decodeSymbol(BitReader& reader, const uint32_t* table, uint32_t primaryBits) {
+		uint32_t entry = table[reader.buffer & ((1u << primaryBits) - 1)];
+		if (entryType(entry) == ENTRY_SUBTABLE) {
+			reader.consume(primaryBits);
+			entry = table[entryValue(entry) + (reader.buffer & ((1u << entryExtra(entry)) - 1))];
+		}
+		reader.consume(entryBits(entry));
+		return entry;
+	}
+
+	//解码一个Huffman块，out前面的数据用于LZ77的匹配
+	inline bool inflateBlock(BitReader& reader, const uint32_t* litlen, const uint32_t* distance, uint8_t* outBegin, uint8_t*& out, uint8_t* outEnd) {
+		for (;;) {
+			//litlen(15) + 长度的额外位(5) + 距离(15) + 距离的额外位(13)不超过56位，一次refill足够
+			if (!reader.refill()) {
+				return false;
+			}
+			uint32_t entry = decodeSymbol(reader, litlen, LITLEN_BITS);
+			switch (entryType(entry)) {
+			case ENTRY_LITERAL_PAIR:
+				if (outEnd - out < 2) {
+					return false;
+				}
+				out[0] = static_cast<uint8_t>(entry >> 16);
+				out[1] = static_cast<uint8_t>(entry >> 24);
+				out += 2;
+				break;
+			case ENTRY_LITERAL:
+				if (out == outEnd) {
+					return false;
+				}
+				*out++ = static_cast<uint8_t>(entry >> 16);
+				break;
+			case ENTRY_LENGTH: {
+				size_t length = entryValue(entry) + reader.bits(entryExtra(entry));
+				uint32_t distanceEntry = decodeSymbol(reader, distance, DISTANCE_BITS);
+				if (entryType(distanceEntry) != ENTRY_DISTANCE) {
+					return false;
+				}
+				size_t offset = entryValue(distanceEntry) + reader.bits(entryExtra(distanceEntry));
+				if (offset > size_t(out - outBegin) || length > size_t(outEnd - out)) {
+					return false;
+				}
+				const uint8_t* src = out - offset;
+				if (offset >= 8) {
+					//每次拷贝8字节，最多多写7字节到OUTPUT_SLACK中，之后的数据会覆盖它们
+					uint8_t* dst = out;
+					uint8_t* stop = out + length;
+					do {
+						memcpy(dst, src, 8);
+						dst += 8;
+						src += 8;
+					} while (dst < stop);
+				} else if (offset == 1) {
+					memset(out, *src, length);
+				} else {
+					for (size_t i = 0; i < length; ++i) {
+						out[i] = src[i];
+					}
+				}
+				out += length;
+				break;
+			}
+			case ENTRY_END:
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
+	//解压zlib流(2字节的头 + deflate数据，和stb_image一样不检查adler32)
+	//in之后至少有INPUT_PADDING字节可读，out之后至少有OUTPUT_SLACK字节可写，输出超过outSize时返回false
+	inline bool inflateZlib(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize, size_t& written) {
+		if (inSize < 2 || (in[0] & 15) != 8 || (in[0] * 256 + in[1]) % 31 != 0 || (in[1] & 32)) {
+			return false;
+		}
+		BitReader reader(in + 2, inSize - 2);
+		uint8_t* outBegin = out;
+		uint8_t* outEnd = out + outSize;
+		std::vector<uint32_t> litlen, distance, codeLength;
+		bool fixedBuilt = false;
+		bool last = false;
+		while (!last) {
+			if (!reader.refill()) {
+				return false;
+			}
+			last = reader.bits(1) != 0;
+			uint32_t type = reader.bits(2);
+			if (type == 0) {
+				reader.consume(reader.count & 7);
+				reader.alignToByte();
+				if (reader.end - reader.next < 4) {
+					return false;
+				}
+				size_t length = reader.next[0] | (reader.next[1] << 8);
+				size_t inverted = reader.next[2] | (reader.next[3] << 8);
+				reader.next += 4;
+				if (length != (~inverted & 0xffff) || length > size_t(reader.end - reader.next) || length > size_t(outEnd - out)) {
+					return false;
+				}
+				memcpy(out, reader.next, length);
+				reader.next += length;
+				out += length;
+				continue;
+			}
+			if (type == 1) {
+				if (!fixedBuilt) {
+					uint8_t lengths[288 + 32];
+					memset(lengths, 8, 144);
+					memset(lengths + 144, 9, 112);
+					memset(lengths + 256, 7, 24);
+					memset(lengths + 280, 8, 8);
+					memset(lengths + 288, 5, 32);
+					buildTable(lengths, 288, TableKind::LitLen, LITLEN_BITS, litlen);
+					buildTable(lengths + 288, 32, TableKind::Distance, DISTANCE_BITS, distance);
+					fixedBuilt = true;
+				}
+			} else if (type == 2) {
+				fixedBuilt = false;
+				uint32_t litlenCount = reader.bits(5) + 257;
+				uint32_t distanceCount = reader.bits(5) + 1;
+				uint32_t codeLengthCount = reader.bits(4) + 4;
+				if (litlenCount > 286 || distanceCount > 30) {
+					return false;
+				}
+				static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+				uint8_t codeLengthLengths[19] = {};
+				for (uint32_t i = 0; i < codeLengthCount; ++i) {
+					if (!reader.refill()) {
+						return false;
+					}
+					codeLengthLengths[order[i]] = static_cast<uint8_t>(reader.bits(3));
+				}
+				if (!buildTable(codeLengthLengths, 19, TableKind::CodeLength, CODELENGTH_BITS, codeLength)) {
+					return false;
+				}
+				uint8_t lengths[286 + 30];
+				uint32_t total = litlenCount + distanceCount;
+				uint32_t n = 0;
+				while (n < total) {
+					if (!reader.refill()) {
+						return false;
+					}
+					uint32_t entry = decodeSymbol(reader, codeLength.data(), CODELENGTH_BITS);
+					if (entryType(entry) != ENTRY_LITERAL) {
+						return false;
+					}
+					uint32_t symbol = entryValue(entry);
+					if (symbol < 16) {
+						lengths[n++] = static_cast<uint8_t>(symbol);
+						continue;
+					}
+					uint8_t value = 0;
+					uint32_t repeat;
+					if (symbol == 16) {
+						if (n == 0) {
+							return false;
+						}
+						value = lengths[n - 1];
+						repeat = 3 + reader.bits(2);
+					} else if (symbol == 17) {
+						repeat = 3 + reader.bits(3);
+					} else {
+						repeat = 11 + reader.bits(7);
+					}
+					if (repeat > total - n) {
+						return false;
+					}
+					memset(lengths + n, value, repeat);
+					n += repeat;
+				}
+				if (lengths[256] == 0 || !buildTable(lengths, litlenCount, TableKind::LitLen, LITLEN_BITS, litlen)
+					|| !buildTable(lengths + litlenCount, distanceCount, TableKind::Distance, DISTANCE_BITS, distance)) {
+					return false;
+				}
+			} else {
+				return false;
+			}
+			if (!inflateBlock(reader, litlen.data(), distance.data(), outBegin, out, outEnd)) {
+				return false;
+			}
+		}
+		if (reader.consumedBits() > size_t(reader.end - reader.begin) * 8) {
+			return false;
+		}
+		written = out - outBegin;
+		return true;
+	}
+
+	//与规范中的 p = a + b - c 再比较距离等价，没有难以预测的分支
+	inline uint8_t paeth(int a, int b, int c) {
+		int threshold = c * 3 - (a + b);
+		int lo = a < b ? a : b;
+		int hi = a < b ? b : a;
+		int t0 = hi <= threshold ? lo : c;
+		return static_cast<uint8_t>(threshold <= lo ? hi : t0);
+	}
+
+	//标量实现，prev是上一行反滤波的结果(第一行时全是0)，bpp是一个像素的字节数
+	inline void unfilterRowScalar(uint32_t filter, const uint8_t* src, const uint8_t* prev, uint8_t* dst, size_t rowBytes, uint32_t bpp) {
+		size_t first = std::min<size_t>(bpp, rowBytes);
+		switch (filter) {
+		case 0:
+			memcpy(dst, src, rowBytes);
+			break;
+		case 1:
+			memcpy(dst, src, first);
+			for (size_t i = bpp; i < rowBytes; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + dst[i - bpp]);
+			}
+			break;
+		case 2:
+			for (size_t i = 0; i < rowBytes; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + prev[i]);
+			}
+			break;
+		case 3:
+			for (size_t i = 0; i < first; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + (prev[i] >> 1));
+			}
+			for (size_t i = bpp; i < rowBytes; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + ((dst[i - bpp] + prev[i]) >> 1));
+			}
+			break;
+		case 4:
+			for (size_t i = 0; i < first; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + prev[i]);
+			}
+			for (size_t i = bpp; i < rowBytes; ++i) {
+				dst[i] = static_cast<uint8_t>(src[i] + paeth(dst[i - bpp], prev[i], prev[i - bpp]));
+			}
+			break;
+		}
+	}
+
+#ifdef PNGDEC_SSE2
+	//3字节的像素分成2字节和1字节读写，不读写像素之外的字节；不经过memcpy到栈上的临时变量，避免存储转发失败
+	template<uint32_t BPP>
+	inline __m128i loadPixel(const uint8_t* p) {
+		uint32_t value;
+		if (BPP == 4) {
+			memcpy(&value, p, 4);
+		} else {
+			uint16_t low;
+			memcpy(&low, p, 2);
+			value = low | (uint32_t(p[2]) << 16);
+		}
+		return _mm_cvtsi32_si128(static_cast<int>(value));
+	}
+
+	template<uint32_t BPP>
+	inline void storePixel(uint8_t* p, __m128i v) {
+		uint32_t value = static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+		if (BPP == 4) {
+			memcpy(p, &value, 4);
+		} else {
+			uint16_t low = static_cast<uint16_t>(value);
+			memcpy(p, &low, 2);
+			p[2] = static_cast<uint8_t>(value >> 16);
+		}
+	}
+
+	inline void unfilterUpSSE2(const uint8_t* src, const uint8_t* prev, uint8_t* dst, size_t rowBytes) {
+		size_t i = 0;
+		for (; i + 16 <= rowBytes; i += 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi8(x, b));
+		}
+		for (; i < rowBytes; ++i) {
+			dst[i] = static_cast<uint8_t>(src[i] + prev[i]);
+		}
+	}
+
+	//SSE2实现的Sub/Avg，BPP为3或4
+	template<uint32_t BPP>
+	inline void unfilterRowSSE2(uint32_t filter, const uint8_t* src, const uint8_t* prev, uint8_t* dst, size_t rowBytes) {
+		const __m128i zero = _mm_setzero_si128();
+		switch (filter) {
+		case 1: {
+			__m128i a = zero;
+			for (size_t i = 0; i < rowBytes; i += BPP) {
+				a = _mm_add_epi8(loadPixel<BPP>(src + i), a);
+				storePixel<BPP>(dst + i, a);
+			}
+			break;
+		}
+		case 3: {
+			//_mm_avg_epu8向上取整，减去(a ^ b) & 1得到向下取整的平均值
+			const __m128i one = _mm_set1_epi8(1);
+			__m128i a = zero;
+			for (size_t i = 0; i < rowBytes; i += BPP) {
+				__m128i b = loadPixel<BPP>(prev + i);
+				__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+				a = _mm_add_epi8(loadPixel<BPP>(src + i), average);
+				storePixel<BPP>(dst + i, a);
+			}
+			break;
+		}
+		}
+	}
+#endif
+
+	//filter不合法时返回false
+	inline bool unfilterRow(uint32_t filter, const uint8_t* src, const uint8_t* prev, uint8_t* dst, size_t rowBytes, uint32_t bpp, bool useSimd) {
+		if (filter > 4) {
+			return false;
+		}
+#ifdef PNGDEC_SSE2
+		if (useSimd && filter == 2) {
+			unfilterUpSSE2(src, prev, dst, rowBytes);
+			return true;
+		}
+		bool subOrAverage = filter == 1 || filter == 3;
+		if (useSimd && subOrAverage && bpp == 3) {
+			unfilterRowSSE2<3>(filter, src, prev, dst, rowBytes);
+			return true;
+		}
+		if (useSimd && subOrAverage && bpp == 4) {
+			unfilterRowSSE2<4>(filter, src, prev, dst, rowBytes);
+			return true;
+		}
+#endif
+		unfilterRowScalar(filter, src, prev, dst, rowBytes, bpp);
+		return true;
+	}
+
+	inline uint32_t readBigEndian(const uint8_t* p) {
+		return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+	}
+
+	inline constexpr uint32_t chunkType(char a, char b, char c, char d) {
+		return (uint32_t(uint8_t(a)) << 24) | (uint32_t(uint8_t(b)) << 16) | (uint32_t(uint8_t(c)) << 8) | uint8_t(d);
+	}
+
+	//解码为RGBA8(width * height * 4字节)，成功返回true；不支持的格式或数据有错误时返回false，rgba的内容不确定
+	//检查的规则与stb_image相同，stb_image能解码的支持格式的文件这里也能解码，结果相同
+	inline bool decodeRgba(const uint8_t* data, size_t size, std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height, bool useSimd = true) {
+		static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		if (size < 8 || memcmp(data, signature, 8) != 0) {
+			return false;
+		}
+		bool first = true;
+		uint32_t colorType = 0;
+		uint8_t palette[256 * 4];
+		uint32_t paletteSize = 0;
+		bool hasKey = false;
+		uint8_t key[3] = {};
+		bool hasData = false;
+		std::vector<uint8_t> compressed;
+		size_t pos = 8;
+		for (bool ended = false; !ended;) {
+			if (size - pos < 12) {
+				return false;
+			}
+			uint32_t length = readBigEndian(data + pos);
+			uint32_t type = readBigEndian(data + pos + 4);
+			const uint8_t* chunk = data + pos + 8;
+			if (length > size - pos - 12) {
+				return false;
+			}
+			pos += size_t(length) + 12;
+			if (first && type != chunkType('I', 'H', 'D', 'R')) {
+				return false;
+			}
+			switch (type) {
+			case chunkType('I', 'H', 'D', 'R'): {
+				if (!first || length != 13) {
+					return false;
+				}
+				first = false;
+				width = readBigEndian(chunk);
+				height = readBigEndian(chunk + 4);
+				colorType = chunk[9];
+				//只支持8位、不隔行扫描
+				if (chunk[8] != 8 || chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0) {
+					return false;
+				}
+				if (colorType != 0 && colorType != 2 && colorType != 3 && colorType != 4 && colorType != 6) {
+					return false;
+				}
+				if (width == 0 || height == 0 || width > (1u << 24) || height > (1u << 24)) {
+					return false;
+				}
+				uint32_t channels = colorType == 3 ? 4 : (colorType & 2 ? 3 : 1) + (colorType & 4 ? 1 : 0);
+				if ((1u << 30) / width / channels < height) {
+					return false;
+				}
+				break;
+			}
+			case chunkType('P', 'L', 'T', 'E'):
+				if (length > 256 * 3 || length % 3 != 0) {
+					return false;
+				}
+				paletteSize = length / 3;
+				for (uint32_t i = 0; i < paletteSize; ++i) {
+					palette[i * 4 + 0] = chunk[i * 3 + 0];
+					palette[i * 4 + 1] = chunk[i * 3 + 1];
+					palette[i * 4 + 2] = chunk[i * 3 + 2];
+					palette[i * 4 + 3] = 255;
+				}
+				break;
+			case chunkType('t', 'R', 'N', 'S'):
+				if (hasData) {
+					return false;
+				}
+				if (colorType == 3) {
+					if (paletteSize == 0 || length > paletteSize) {
+						return false;
+					}
+					for (uint32_t i = 0; i < length; ++i) {
+						palette[i * 4 + 3] = chunk[i];
+					}
+				} else if (colorType == 0 || colorType == 2) {
+					//灰度/RGB的透明色，8位图像取16位值的低8位
+					uint32_t channels = colorType == 0 ? 1 : 3;
+					if (length != channels * 2) {
+						return false;
+					}
+					hasKey = true;
+					for (uint32_t i = 0; i < channels; ++i) {
+						key[i] = chunk[i * 2 + 1];
+					}
+				} else {
+					return false;
+				}
+				break;
+			case chunkType('I', 'D', 'A', 'T'):
+				if (colorType == 3 && paletteSize == 0) {
+					return false;
+				}
+				hasData = true;
+				compressed.insert(compressed.end(), chunk, chunk + length);
+				break;
+			case chunkType('I', 'E', 'N', 'D'):
+				ended = true;
+				break;
+			default:
+				//未知的关键块(类型的第一个字母大写)，包括CgBI
+				if ((type & (1u << 29)) == 0) {
+					return false;
+				}
+				break;
+			}
+		}
+		if (!hasData) {
+			return false;
+		}
+
+		const uint32_t bpp = colorType == 3 ? 1 : (colorType & 2 ? 3 : 1) + (colorType & 4 ? 1 : 0);
+		const size_t rowBytes = size_t(width) * bpp;
+		const size_t rawSize = (rowBytes + 1) * height;
+		size_t compressedSize = compressed.size();
+		compressed.resize(compressedSize + INPUT_PADDING, 0);
+		//不需要初始化，inflate会写满rawSize字节
+		std::unique_ptr<uint8_t[]> raw(new uint8_t[rawSize + OUTPUT_SLACK]);
+		size_t written = 0;
+		if (!inflateZlib(compressed.data(), compressedSize, raw.get(), rawSize, written) || written != rawSize) {
+			return false;
+		}
+
+		//RGBA直接反滤波到输出中，其他格式反滤波到交替使用的两行中再扩展为RGBA
+		rgba.resize(size_t(width) * height * 4);
+		std::vector<uint8_t> zeroRow(rowBytes, 0);
+		std::vector<uint8_t> rows(bpp == 4 ? 0 : rowBytes * 2);
+		for (uint32_t y = 0; y < height; ++y) {
+			const uint8_t* src = raw.get() + y * (rowBytes + 1);
+			uint8_t* out = rgba.data() + size_t(y) * width * 4;
+			uint8_t* dst = bpp == 4 ? out : rows.data() + (y & 1) * rowBytes;
+			const uint8_t* prev = y == 0 ? zeroRow.data() : (bpp == 4 ? out - rowBytes : rows.data() + ((y - 1) & 1) * rowBytes);
+			if (!unfilterRow(src[0], src + 1, prev, dst, rowBytes, bpp, useSimd)) {
+				return false;
+			}
+			switch (colorType) {
+			case 0:
+				for (uint32_t x = 0; x < width; ++x) {
+					uint8_t v = dst[x];
+					out[4 * x + 0] = v;
+					out[4 * x + 1] = v;
+					out[4 * x + 2] = v;
+					out[4 * x + 3] = hasKey && v == key[0] ? 0 : 255;
+				}
+				break;
+			case 2:
+				for (uint32_t x = 0; x < width; ++x) {
+					const uint8_t* p = dst + 3 * x;
+					out[4 * x + 0] = p[0];
+					out[4 * x + 1] = p[1];
+					out[4 * x + 2] = p[2];
+					out[4 * x + 3] = hasKey && p[0] == key[0] && p[1] == key[1] && p[2] == key[2] ? 0 : 255;
+				}
+				break;
+			case 3:
+				for (uint32_t x = 0; x < width; ++x) {
+					//stb_image对超出调色板的索引读取的是未初始化的数据，交给它处理
+					if (dst[x] >= paletteSize) {
+						return false;
+					}
+					memcpy(out + 4 * x, palette + dst[x] * 4, 4);
+				}
+				break;
+			case 4:
+				for (uint32_t x = 0; x < width; ++x) {
+					uint8_t v = dst[2 * x];
+					out[4 * x + 0] = v;
+					out[4 * x + 1] = v;
+					out[4 * x + 2] = v;
+					out[4 * x + 3] = dst[2 * x + 1];
+				}
+				break;
+			}
+		}
+		return true;
+	}
+
+}
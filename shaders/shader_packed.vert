@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+// vertex shader for the packed vertex layouts (PackedVertex in main.cpp)
+// glslc shader_packed.vert -o packed_vert.spv
+// glslc -DOCT_NORMAL shader_packed.vert -o packed_normal_vert.spv
+
+layout (binding=0) uniform UniformBufferObject{
+	mat4 model;
+	mat4 view;
+	mat4 projection;
+	mat4 dequantize;
+}ubo;
+
+
+layout (location=0) in vec4 inPosition;	// R16G16B16A16_UNORM, [0, 1] inside the mesh bounds
+#ifdef OCT_NORMAL
+layout (location=1) in vec2 inNormal;	// R16G16_SNORM, octahedral encoded
+#endif
+layout (location=2) in vec2 inTexCoord;	// R16G16_SFLOAT
+
+
+
+layout (location=0) out vec3 fragColor;
+layout (location=1) out vec2 texCoord;
+
+vec3 decodeOctahedral(vec2 e){
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main(){
+	vec4 position = ubo.dequantize * vec4(inPosition.xyz, 1.0);
+	gl_Position = ubo.projection * ubo.view * ubo.model * position;
+#ifdef OCT_NORMAL
+	fragColor = decodeOctahedral(inNormal) * 0.5 + 0.5;
+#else
+	fragColor = vec3(1.0);
+#endif
+	texCoord = inTexCoord;
+}
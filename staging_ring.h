@@ -0,0 +1,101 @@
+﻿#pragma once
+//持久映射的staging环形缓冲: 上传数据依次写入环中，按提交批次记录占用的区间，
+//批次的fence完成之后释放对应区间，环的空间可以被后面的上传重复使用，不需要每次上传都创建/销毁staging buffer
+//这里只做区间的记录，缓冲的创建、命令的录制和fence的查询由调用者负责
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+
+class StagingRing {
+public:
+	void init(VkBuffer buffer, void* mapped, VkDeviceSize capacity) {
+		this->buffer = buffer;
+		this->mapped = static_cast<char*>(mapped);
+		this->capacity = capacity;
+		head = tail = used = openBytes = 0;
+		batches.clear();
+	}
+
+	//在环中预留size字节，offset按alignment对齐，空间不足时返回false，调用者需要等待之前的批次完成后再试
+	//尾部剩余的空间放不下时从头开始，跳过的部分算在当前批次中，随批次一起释放
+	bool reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+		if (used == 0) {
+			head = tail = 0;
+		}
+		VkDeviceSize aligned = (head + alignment - 1) / alignment * alignment;
+		if (used == 0 || head > tail) {
+			//空闲区间是[head, capacity)和[0, tail)
+			if (aligned + size <= capacity) {
+				offset = take(aligned, size);
+				return true;
+			}
+			if (size <= tail) {
+				VkDeviceSize skipped = capacity - head;
+				used += skipped;
+				openBytes += skipped;
+				head = 0;
+				offset = take(0, size);
+				return true;
+			}
+			return false;
+		}
+		//head绕回之后空闲区间是[head, tail)
+		if (aligned + size <= tail) {
+			offset = take(aligned, size);
+			return true;
+		}
+		return false;
+	}
+
+	//把上次close之后预留的区间都归到batch中，batch必须单调递增
+	void close(uint64_t batch) {
+		if (openBytes == 0) {
+			return;
+		}
+		batches.push_back({ batch, head, openBytes });
+		openBytes = 0;
+	}
+
+	//batch以及之前的批次已经在GPU上执行完，释放它们占用的区间
+	void release(uint64_t batch) {
+		while (!batches.empty() && batches.front().id <= batch) {
+			tail = batches.front().end;
+			used -= batches.front().bytes;
+			batches.pop_front();
+		}
+	}
+
+	VkBuffer handle() const { return buffer; }
+	void* pointer(VkDeviceSize offset) const { return mapped + offset; }
+	VkDeviceSize size() const { return capacity; }
+	VkDeviceSize bytesInUse() const { return used; }
+
+private:
+	struct Batch {
+		uint64_t id;
+		VkDeviceSize end;	//批次最后一个区间的结束位置，释放后成为新的tail
+		VkDeviceSize bytes;	//批次占用的字节数，包括对齐和绕回跳过的部分
+	};
+
+	VkDeviceSize take(VkDeviceSize offset, VkDeviceSize size) {
+		VkDeviceSize bytes = offset + size - head;
+		used += bytes;
+		openBytes += bytes;
+		head = offset + size;
+		if (head == capacity) {
+			head = 0;
+		}
+		return offset;
+	}
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	char* mapped = nullptr;
+	VkDeviceSize capacity = 0;
+	VkDeviceSize head = 0;		//下一次预留的起始位置
+	VkDeviceSize tail = 0;		//最早的未释放批次的起始位置
+	VkDeviceSize used = 0;
+	VkDeviceSize openBytes = 0;	//还没有归到批次中的字节数
+	std::deque<Batch> batches;
+};
@@ -0,0 +1,135 @@
+﻿#pragma once
+//烘焙好的纹理文件: 参考KTX2的布局，保存完整的mipmap链，每一层的数据就是vkCmdCopyBufferToImage需要的紧密排列的纹素
+//运行时映射文件后直接拷贝到staging buffer，不需要PNG解码(inflate和反滤波)，也不需要生成mip层
+//文件布局: TextureCacheHeader | levelCount 个 TextureCacheLevel | 各层数据(按levelOffsets连续存放，第0层在前)
+//和KTX2的区别: 没有数据格式描述符和键值对，KTX2按从小到大的顺序存放各层，这里为了和mipgen的布局一致从大到小存放
+//块压缩格式(BC1/BC3/BC7)每层按4x4的块逐行存放，不压缩的格式可以看成1x1的块
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "file_util.h"
+#include "mipmap.h"
+
+namespace texcache {
+
+	const uint32_t MAGIC = 0x43544b56; //"VKTC"
+	//纹理的处理逻辑(例如mip层的滤波方式)改变时需要增加版本号，使旧的文件失效
+	//2: 支持块压缩格式，texelSize改为blockBytes，增加blockExtent
+	//3: 奇数尺寸的mip层使用3个纹素的加权滤波，不再丢弃最后一行/列
+	const uint32_t VERSION = 3;
+
+	struct TextureCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;	//源图像文件内容的hash
+		uint64_t sourceSize;
+		uint32_t vkFormat;		//VkFormat，这里不依赖vulkan头文件
+		uint32_t blockBytes;	//每个块的字节数
+		uint32_t width;			//第0层的尺寸
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t blockExtent;	//块的宽和高，不压缩的格式为1，BC格式为4
+	};
+	static_assert(sizeof(TextureCacheHeader) % 8 == 0, "texture cache header must keep the level index aligned");
+
+	//与KTX2的level index相同，byteOffset从文件开头算起
+	struct TextureCacheLevel {
+		uint64_t byteOffset;
+		uint64_t byteLength;
+	};
+
+	//文件中数据的视图，pixels指向映射的内存，按levelOffsets的布局存放所有层
+	struct TextureCacheView {
+		const void* pixels = nullptr;
+		uint32_t vkFormat = 0;
+		uint32_t blockBytes = 0;
+		uint32_t blockExtent = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t levelCount = 0;
+	};
+
+	//各层在连续存储中的字节偏移，最后一个元素是总大小，尺寸不是块的整数倍时按整块计算
+	//blockExtent为1时与mipgen::levelOffsets相同，为4时与bcn::levelOffsets相同
+	inline std::vector<size_t> levelOffsets(uint32_t width, uint32_t height, uint32_t levels, uint32_t blockExtent, uint32_t blockBytes) {
+		std::vector<size_t> offsets(levels + 1, 0);
+		for (uint32_t i = 0; i < levels; ++i) {
+			size_t blocksWide = (mipgen::levelWidth(width, i) + blockExtent - 1) / blockExtent;
+			size_t blocksHigh = (mipgen::levelHeight(height, i) + blockExtent - 1) / blockExtent;
+			offsets[i + 1] = offsets[i] + blocksWide * blocksHigh * blockBytes;
+		}
+		return offsets;
+	}
+
+	//检查烘焙文件是否和源文件匹配，匹配时填充view
+	inline bool read(const MappedFile& file, uint64_t sourceHash, uint64_t sourceSize, uint32_t vkFormat, TextureCacheView& view) {
+		if (!file.isOpen() || file.size() < sizeof(TextureCacheHeader)) {
+			return false;
+		}
+		TextureCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != MAGIC || header.version != VERSION || header.sourceHash != sourceHash
+			|| header.sourceSize != sourceSize || header.vkFormat != vkFormat) {
+			return false;
+		}
+		if (header.width == 0 || header.height == 0 || header.blockBytes == 0 || header.blockExtent == 0
+			|| header.levelCount == 0 || header.levelCount > mipgen::levelCount(header.width, header.height)) {
+			return false;
+		}
+		uint64_t dataOffset = sizeof(TextureCacheHeader) + uint64_t(header.levelCount) * sizeof(TextureCacheLevel);
+		std::vector<size_t> offsets = levelOffsets(header.width, header.height, header.levelCount, header.blockExtent, header.blockBytes);
+		if (dataOffset + offsets[header.levelCount] != file.size()) {
+			return false; //文件被截断，例如上次写入时程序崩溃
+		}
+		//各层必须按上传时使用的布局存放
+		for (uint32_t i = 0; i < header.levelCount; ++i) {
+			TextureCacheLevel level;
+			memcpy(&level, file.data() + sizeof(TextureCacheHeader) + i * sizeof(TextureCacheLevel), sizeof(level));
+			if (level.byteOffset != dataOffset + offsets[i] || level.byteLength != offsets[i + 1] - offsets[i]) {
+				return false;
+			}
+		}
+		view.pixels = file.data() + dataOffset;
+		view.vkFormat = header.vkFormat;
+		view.blockBytes = header.blockBytes;
+		view.blockExtent = header.blockExtent;
+		view.width = header.width;
+		view.height = header.height;
+		view.levelCount = header.levelCount;
+		return true;
+	}
+
+	//pixels按levelOffsets的布局存放levelCount层，先写到临时文件再重命名，保证不会留下写了一半的文件
+	inline bool write(const std::string& path, uint64_t sourceHash, uint64_t sourceSize, uint32_t vkFormat, uint32_t blockExtent, uint32_t blockBytes,
+		uint32_t width, uint32_t height, uint32_t levelCount, const void* pixels) {
+		TextureCacheHeader header{};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.sourceHash = sourceHash;
+		header.sourceSize = sourceSize;
+		header.vkFormat = vkFormat;
+		header.blockBytes = blockBytes;
+		header.blockExtent = blockExtent;
+		header.width = width;
+		header.height = height;
+		header.levelCount = levelCount;
+
+		uint64_t dataOffset = sizeof(TextureCacheHeader) + uint64_t(levelCount) * sizeof(TextureCacheLevel);
+		std::vector<size_t> offsets = levelOffsets(width, height, levelCount, blockExtent, blockBytes);
+		std::vector<TextureCacheLevel> levels(levelCount);
+		for (uint32_t i = 0; i < levelCount; ++i) {
+			levels[i].byteOffset = dataOffset + offsets[i];
+			levels[i].byteLength = offsets[i + 1] - offsets[i];
+		}
+
+		return fileutil::atomicWriteFile(path, {
+			{ &header, sizeof(header) },
+			{ levels.data(), levels.size() * sizeof(TextureCacheLevel) },
+			{ pixels, offsets[levelCount] },
+		});
+	}
+}
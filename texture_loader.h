@@ -0,0 +1,220 @@
+﻿#pragma once
+//纹理加载服务: 每个纹理作为一个任务在JobSystem上加载，结果按完成的顺序交给调用者上传
+//每个纹理: 映射源文件 -> hash -> 烘焙文件有效时直接映射使用；否则解码(常见的PNG用pngdec，其他格式用stb_image)，生成mip链，按需块压缩，再写烘焙文件
+//任务不调用任何vulkan函数，只产生按texcache::levelOffsets布局的数据，图像的创建和上传仍在调用者的线程上
+//单个纹理内部的mip生成和压缩同样用jobs.parallelFor拆分，纹理少于线程时空闲的线程会窃取这些任务
+//注意: 需要在包含本文件之前包含stb_image.h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <exception>
+
+#include "mapped_file.h"
+#include "file_util.h"
+#include "mipmap.h"
+#include "png_decode.h"
+#include "block_compress.h"
+#include "texture_cache.h"
+#include "job_system.h"
+
+struct TextureRequest {
+	std::string path;
+	std::string cookedPath;		//烘焙文件的路径，为空时不读写烘焙文件
+	uint32_t vkFormat = 0;		//目标VkFormat，只用来和烘焙文件比较
+	bool srgb = true;			//生成mip层时是否在线性空间平均
+	bool mipmaps = true;		//生成完整的mip链，否则只有第0层
+	bool compress = false;		//压缩为blockFormat
+	bcn::Format blockFormat = bcn::Format::BC7;
+};
+
+struct LoadedTexture {
+	uint32_t id = 0;			//TextureLoader::load返回的id
+	std::string path;
+	std::string error;			//非空表示加载失败
+	bool fromCache = false;		//数据来自烘焙文件
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t levelCount = 0;
+	uint32_t blockExtent = 1;
+	uint32_t blockBytes = 4;
+	double loadMs = 0;			//加载任务花费的时间
+	MappedFile cookedFile;		//fromCache时保持映射，数据直接从映射的内存拷贝到staging buffer
+	const void* cookedPixels = nullptr;
+	std::vector<uint8_t> data;	//解码得到的数据
+
+	//按texcache::levelOffsets布局存放的所有层
+	const void* pixels() const {
+		return fromCache ? cookedPixels : static_cast<const void*>(data.data());
+	}
+};
+
+class TextureLoader {
+public:
+	explicit TextureLoader(JobSystem& jobs) : jobs(jobs) {}
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+	~TextureLoader() {
+		stop();
+	}
+
+	//提交加载任务，立即返回请求的id
+	uint32_t load(TextureRequest request) {
+		uint32_t id;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			id = nextId++;
+			++outstanding;
+			++inFlight;
+		}
+		jobs.submit([this, id, request = std::move(request)] { run(id, request); });
+		return id;
+	}
+
+	//等待直到有一个纹理加载完成，按完成的顺序返回；所有请求都已经取走时返回false
+	//在调度器的线程上调用时，等待期间会执行队列中的任务(包括加载任务本身)
+	bool next(LoadedTexture& texture) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (outstanding == 0) {
+				return false;
+			}
+		}
+		jobs.waitUntil([this] {
+			std::lock_guard<std::mutex> lock(mutex);
+			return !done.empty();
+		});
+		std::lock_guard<std::mutex> lock(mutex);
+		texture = std::move(done.front());
+		done.pop_front();
+		--outstanding;
+		return true;
+	}
+
+	//还没有开始的请求直接丢弃，等待正在加载的纹理完成；返回之后可以继续load
+	//所有任务都已经结束时不访问jobs，这样jobs先析构也没有问题
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (inFlight == 0) {
+				return;
+			}
+			stopping = true;
+		}
+		jobs.waitUntil([this] {
+			std::lock_guard<std::mutex> lock(mutex);
+			return inFlight == 0;
+		});
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = false;
+	}
+
+	//在当前线程上加载一个纹理，jobs不为空时生成mip层和压缩用jobs->parallelFor拆分
+	static void loadTexture(const TextureRequest& request, JobSystem* jobs, LoadedTexture& texture) {
+		auto start = std::chrono::high_resolution_clock::now();
+		texture.path = request.path;
+		texture.blockExtent = request.compress ? 4 : 1;
+		texture.blockBytes = request.compress ? bcn::blockBytes(request.blockFormat) : 4;
+
+		MappedFile source;
+		if (!source.open(request.path)) {
+			texture.error = "failed to open texture: " + request.path;
+			return;
+		}
+		uint64_t sourceHash = fileutil::hashBytes(source.data(), source.size());
+
+		texcache::TextureCacheView view;
+		if (!request.cookedPath.empty() && texture.cookedFile.open(request.cookedPath)
+			&& texcache::read(texture.cookedFile, sourceHash, source.size(), request.vkFormat, view)
+			&& view.blockExtent == texture.blockExtent && view.blockBytes == texture.blockBytes
+			&& (request.mipmaps || view.levelCount == 1)) {
+			texture.fromCache = true;
+			texture.cookedPixels = view.pixels;
+			texture.width = view.width;
+			texture.height = view.height;
+			texture.levelCount = view.levelCount;
+			texture.loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			return;
+		}
+		texture.cookedFile.close();
+
+		//pngdec不支持的格式回退到stb_image，两者的结果相同
+		std::vector<uint8_t> decoded;
+		stbi_uc* stbiPixels = nullptr;
+		const uint8_t* pixels = nullptr;
+		uint32_t width, height;
+		if (pngdec::decodeRgba(source.data(), source.size(), decoded, width, height)) {
+			pixels = decoded.data();
+		} else {
+			int stbiWidth, stbiHeight, channels;
+			stbiPixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &stbiWidth, &stbiHeight, &channels, STBI_rgb_alpha);
+			if (!stbiPixels) {
+				texture.error = "failed to decode texture: " + request.path + " (" + stbi_failure_reason() + ")";
+				return;
+			}
+			pixels = stbiPixels;
+			width = stbiWidth;
+			height = stbiHeight;
+		}
+		texture.width = width;
+		texture.height = height;
+		texture.levelCount = request.mipmaps ? mipgen::levelCount(width, height) : 1;
+		if (request.mipmaps) {
+			texture.data = mipgen::generateMipChain(pixels, width, height, request.srgb, jobs);
+		} else if (!stbiPixels) {
+			texture.data = std::move(decoded);
+		} else {
+			texture.data.assign(pixels, pixels + size_t(width) * height * 4);
+		}
+		stbi_image_free(stbiPixels);
+		if (request.compress) {
+			texture.data = bcn::compressMipChain(texture.data.data(), width, height, texture.levelCount, request.blockFormat, jobs);
+		}
+
+		//写烘焙文件失败不影响本次加载，只是下次还需要解码
+		if (!request.cookedPath.empty()) {
+			texcache::write(request.cookedPath, sourceHash, source.size(), request.vkFormat, texture.blockExtent, texture.blockBytes,
+				texture.width, texture.height, texture.levelCount, texture.data.data());
+		}
+		texture.loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+private:
+	//加载任务: stop之后还没有开始的请求不再加载，只从outstanding中去掉
+	void run(uint32_t id, const TextureRequest& request) {
+		bool cancelled;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			cancelled = stopping;
+		}
+		LoadedTexture texture;
+		texture.id = id;
+		if (!cancelled) {
+			//异常也作为加载失败交给调用者，保证inFlight总能归零
+			try {
+				loadTexture(request, &jobs, texture);
+			} catch (const std::exception& e) {
+				texture.path = request.path;
+				texture.error = "failed to load texture: " + request.path + " (" + e.what() + ")";
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (cancelled) {
+			--outstanding;
+		} else {
+			done.push_back(std::move(texture));
+		}
+		--inFlight;
+	}
+
+	JobSystem& jobs;
+	std::mutex mutex;
+	std::deque<LoadedTexture> done;		//已经完成，还没有被next取走
+	uint32_t nextId = 1;
+	size_t outstanding = 0;				//已经加入，还没有被next取走的请求数
+	size_t inFlight = 0;				//已经提交，任务还没有结束的请求数
+	bool stopping = false;
+};
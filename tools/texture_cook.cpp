@@ -0,0 +1,102 @@
+﻿//离线烘焙纹理: 解码图像，生成完整的mipmap链，可选压缩为BC1/BC3/BC7，写成texture_cache.h的格式，运行时直接映射上传
+//用法: texture_cook <input.png> [output] [--unorm] [--bc1 | --bc3 | --bc7]
+//默认输出为 input + ".texcache"，与main.cpp中查找的路径相同；默认按sRGB格式处理，--unorm时按线性格式平均
+//运行时只接受与设备选择的格式相同的文件(main.cpp中textureCompression默认为BC7，对应--bc7)，格式不同时会重新解码并覆盖
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#include "../mapped_file.h"
+#include "../file_util.h"
+#include "../mipmap.h"
+#include "../png_decode.h"
+#include "../block_compress.h"
+#include "../texture_cache.h"
+#include "../job_system.h"
+
+//VkFormat的值，工具不依赖vulkan头文件，{UNORM, SRGB}
+const uint32_t RGBA8_FORMATS[2] = { 37, 43 };	//VK_FORMAT_R8G8B8A8_*
+const uint32_t BC1_FORMATS[2] = { 131, 132 };	//VK_FORMAT_BC1_RGB_*_BLOCK
+const uint32_t BC3_FORMATS[2] = { 137, 138 };	//VK_FORMAT_BC3_*_BLOCK
+const uint32_t BC7_FORMATS[2] = { 145, 146 };	//VK_FORMAT_BC7_*_BLOCK
+
+int main(int argc, char** argv) {
+	std::string inputPath, outputPath;
+	bool srgb = true;
+	bool compress = false;
+	bcn::Format format = bcn::Format::BC7;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--unorm") {
+			srgb = false;
+		} else if (arg == "--bc1" || arg == "--bc3" || arg == "--bc7") {
+			compress = true;
+			format = arg == "--bc1" ? bcn::Format::BC1 : (arg == "--bc3" ? bcn::Format::BC3 : bcn::Format::BC7);
+		} else if (inputPath.empty()) {
+			inputPath = arg;
+		} else {
+			outputPath = arg;
+		}
+	}
+	if (inputPath.empty()) {
+		std::cerr << "usage: texture_cook <input.png> [output] [--unorm] [--bc1 | --bc3 | --bc7]" << std::endl;
+		return 1;
+	}
+	if (outputPath.empty()) {
+		outputPath = inputPath + ".texcache";
+	}
+
+	//mip生成和块压缩用所有硬件线程
+	JobSystem jobs;
+	jobs.start();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	MappedFile source;
+	if (!source.open(inputPath)) {
+		std::cerr << "failed to open " << inputPath << std::endl;
+		return 1;
+	}
+	uint64_t sourceHash = fileutil::hashBytes(source.data(), source.size());
+
+	//pngdec不支持的格式回退到stb_image
+	std::vector<uint8_t> chain;
+	uint32_t width, height;
+	std::vector<uint8_t> decoded;
+	if (pngdec::decodeRgba(source.data(), source.size(), decoded, width, height)) {
+		chain = mipgen::generateMipChain(decoded.data(), width, height, srgb, &jobs);
+	} else {
+		int stbiWidth, stbiHeight, channels;
+		stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &stbiWidth, &stbiHeight, &channels, STBI_rgb_alpha);
+		if (!pixels) {
+			std::cerr << "failed to decode " << inputPath << ": " << stbi_failure_reason() << std::endl;
+			return 1;
+		}
+		width = stbiWidth;
+		height = stbiHeight;
+		chain = mipgen::generateMipChain(pixels, width, height, srgb, &jobs);
+		stbi_image_free(pixels);
+	}
+
+	uint32_t levels = mipgen::levelCount(width, height);
+	uint32_t vkFormat = RGBA8_FORMATS[srgb];
+	uint32_t blockExtent = 1, blockBytes = 4;
+	if (compress) {
+		chain = bcn::compressMipChain(chain.data(), width, height, levels, format, &jobs);
+		const uint32_t* formats = format == bcn::Format::BC1 ? BC1_FORMATS : (format == bcn::Format::BC3 ? BC3_FORMATS : BC7_FORMATS);
+		vkFormat = formats[srgb];
+		blockExtent = 4;
+		blockBytes = bcn::blockBytes(format);
+	}
+	if (!texcache::write(outputPath, sourceHash, source.size(), vkFormat, blockExtent, blockBytes, width, height, levels, chain.data())) {
+		std::cerr << "failed to write " << outputPath << std::endl;
+		return 1;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << inputPath << ": " << width << "x" << height << ", " << levels << " levels, " << chain.size() << " bytes -> "
+		<< outputPath << " (" << ms << " ms)" << std::endl;
+	return 0;
+}
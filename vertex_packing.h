@@ -0,0 +1,132 @@
+﻿#pragma once
+//压缩顶点格式用到的量化和编码函数
+//位置: 相对于包围盒归一化到[0, 1]后存为16位无符号归一化整数(UNORM16)，shader中用反量化矩阵还原
+//纹理坐标: 半精度浮点数
+//法线: 八面体编码(Cigolle et al. 2014)后存为两个16位有符号归一化整数(SNORM16)
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace vertexpack {
+
+	//float转half，舍入到最近的偶数，正确处理非规格化数、无穷大和NaN
+	inline uint16_t floatToHalf(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000;
+		uint32_t magnitude = bits & 0x7fffffff;
+		if (magnitude >= 0x7f800000) {
+			//无穷大或NaN，NaN保留一位尾数
+			return static_cast<uint16_t>(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+		}
+		if (magnitude >= 0x477ff000) {
+			//舍入后超过half的最大值65504
+			return static_cast<uint16_t>(sign | 0x7c00);
+		}
+		if (magnitude < 0x38800000) {
+			//结果是非规格化数或者0: 补上隐含的1后右移，再舍入
+			if (magnitude < 0x33000000) {
+				return static_cast<uint16_t>(sign);
+			}
+			uint32_t exponent = magnitude >> 23;
+			uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+			uint32_t shift = 126 - exponent;
+			uint32_t half = mantissa >> shift;
+			uint32_t remainder = mantissa & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+			if (remainder > halfway || (remainder == halfway && (half & 1))) {
+				++half;
+			}
+			return static_cast<uint16_t>(sign | half);
+		}
+		//规格化数: 调整指数偏移(127 -> 15)，尾数舍入到10位，进位会自然地进入指数
+		uint32_t half = (magnitude - 0x38000000) >> 13;
+		uint32_t remainder = magnitude & 0x1fff;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+			++half;
+		}
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	inline uint16_t quantizeUnorm16(float value) {
+		value = std::min(std::max(value, 0.f), 1.f);
+		return static_cast<uint16_t>(value * 65535.f + 0.5f);
+	}
+
+	inline int16_t quantizeSnorm16(float value) {
+		value = std::min(std::max(value, -1.f), 1.f);
+		return static_cast<int16_t>(std::lround(value * 32767.f));
+	}
+
+	//把单位向量投影到八面体上再展开为正方形，两个分量都在[-1, 1]
+	inline void encodeOctahedral(float x, float y, float z, int16_t out[2]) {
+		float length = std::fabs(x) + std::fabs(y) + std::fabs(z);
+		if (length == 0.f) {
+			out[0] = 0;
+			out[1] = 0;
+			return;
+		}
+		float u = x / length;
+		float v = y / length;
+		if (z < 0.f) {
+			//下半部分翻折到正方形的四个角
+			float foldedU = (1.f - std::fabs(v)) * (u >= 0.f ? 1.f : -1.f);
+			float foldedV = (1.f - std::fabs(u)) * (v >= 0.f ? 1.f : -1.f);
+			u = foldedU;
+			v = foldedV;
+		}
+		out[0] = quantizeSnorm16(u);
+		out[1] = quantizeSnorm16(v);
+	}
+
+	//位置的包围盒，positions指向第一个顶点的位置(3个float)，stride为相邻顶点之间的字节数
+	struct Bounds {
+		float min[3] = { 0.f, 0.f, 0.f };
+		float max[3] = { 0.f, 0.f, 0.f };
+
+		//反量化: position = min + quantized * extent，退化的轴使用1避免除0
+		float extent(int axis) const {
+			float e = max[axis] - min[axis];
+			return e > 0.f ? e : 1.f;
+		}
+	};
+
+	inline const float* positionAt(const float* positions, size_t stride, size_t i) {
+		return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + i * stride);
+	}
+
+	inline Bounds computeBounds(const float* positions, size_t stride, size_t count) {
+		Bounds bounds;
+		for (size_t i = 0; i < count; ++i) {
+			const float* p = positionAt(positions, stride, i);
+			for (int k = 0; k < 3; ++k) {
+				bounds.min[k] = i == 0 ? p[k] : std::min(bounds.min[k], p[k]);
+				bounds.max[k] = i == 0 ? p[k] : std::max(bounds.max[k], p[k]);
+			}
+		}
+		return bounds;
+	}
+
+	//按面积加权累加面法线得到顶点法线(未归一化，编码时归一化)
+	inline void computeVertexNormals(const float* positions, size_t stride, size_t vertexCount,
+		const uint32_t* indices, size_t indexCount, std::vector<float>& normals) {
+		normals.assign(vertexCount * 3, 0.f);
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+			const float* a = positionAt(positions, stride, indices[i]);
+			const float* b = positionAt(positions, stride, indices[i + 1]);
+			const float* c = positionAt(positions, stride, indices[i + 2]);
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			for (size_t k = 0; k < 3; ++k) {
+				for (int axis = 0; axis < 3; ++axis) {
+					normals[indices[i + k] * 3 + axis] += n[axis];
+				}
+			}
+		}
+	}
+
+}